@@ -35,6 +35,7 @@
 #endif
 #include "sysemu/cpus.h"
 #include "sysemu/replay.h"
+#include "qemu/afl-tcg.h"
 
 /* -icount align implementation. */
 
@@ -373,7 +374,8 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     }
 
     /* patch the native jump address */
-    tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc.ptr);
+    tb_set_jmp_target(tb, n,
+                      (uintptr_t)tb_next->tc.ptr + tb_next->chain_offset);
 
     /* add in TB jmp list */
     tb->jmp_list_next[n] = tb_next->jmp_list_head;
@@ -488,6 +490,15 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
            return true;
         }
 
+#ifndef CONFIG_USER_ONLY
+        /* AFL test case hang, cf. cpu_handle_interrupt() */
+        if (*ret == EXCP_AFL_BUDGET) {
+           cpu->exception_index = -1;
+           vm_stop(RUN_STATE_RESTORE_VM);
+           return true;
+        }
+#endif
+
         if (*ret == EXCP_DEBUG) {
             cpu_handle_debug_exception(cpu);
         }
@@ -609,6 +620,16 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
         atomic_set(&cpu->exit_request, 0);
         if (cpu->exception_index == -1) {
             cpu->exception_index = EXCP_INTERRUPT;
+#ifndef CONFIG_USER_ONLY
+            /* The icount budget was capped by the AFL test case budget,
+             * cf. prepare_icount_for_run(): the test case is over.
+             */
+            if (use_icount && afl_tcg.budget_on &&
+                cpu->icount_decr.u16.low + cpu->icount_extra == 0 &&
+                afl_tcg.budget <= cpu->icount_budget) {
+                cpu->exception_index = EXCP_AFL_BUDGET;
+            }
+#endif
         }
         return true;
     }
@@ -33,6 +33,8 @@
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
 #include "qemu/atomic128.h"
+#include "qemu/qemu-print.h"
+#include "qemu/afl-tcg.h"
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -99,6 +101,9 @@ static void tlb_dyn_init(CPUArchState *env)
         env->tlb_mask[i] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
         env->tlb_table[i] = g_new(CPUTLBEntry, n_entries);
         env->iotlb[i] = g_new(CPUIOTLBEntry, n_entries);
+        desc->l2_table = g_new(CPUTLBEntry, CPU_L2TLB_SIZE);
+        desc->l2_iotlb = g_new(CPUIOTLBEntry, CPU_L2TLB_SIZE);
+        memset(desc->l2_table, -1, CPU_L2TLB_SIZE * sizeof(CPUTLBEntry));
     }
 }
 
@@ -282,10 +287,35 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void dump_tlb_stats(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        int mmu_idx;
+
+        qemu_printf("CPU#%d\n", cpu->cpu_index);
+        qemu_printf("  mmu_idx      misses   vtlb hits     l2 hits"
+                    "       fills\n");
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+
+            qemu_printf("  %7d %11zu %11zu %11zu %11zu\n", mmu_idx,
+                        atomic_read(&desc->miss_count),
+                        atomic_read(&desc->vtlb_hit_count),
+                        atomic_read(&desc->l2_hit_count),
+                        atomic_read(&desc->fill_count));
+        }
+    }
+}
+
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
 {
     tlb_table_flush_by_mmuidx(env, mmu_idx);
     memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+    memset(env->tlb_d[mmu_idx].l2_table, -1,
+           CPU_L2TLB_SIZE * sizeof(CPUTLBEntry));
     env->tlb_d[mmu_idx].large_page_addr = -1;
     env->tlb_d[mmu_idx].large_page_mask = -1;
     env->tlb_d[mmu_idx].vindex = 0;
@@ -406,10 +436,18 @@ static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
     return false;
 }
 
+/* Index of the first way of the second-level tlb set of PAGE */
+static inline size_t tlb_l2_index(target_ulong page)
+{
+    return ((page >> TARGET_PAGE_BITS) & ((1 << CPU_L2TLB_SET_BITS) - 1))
+           * CPU_L2TLB_WAYS;
+}
+
 /* Called with tlb_c.lock held */
 static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
                                               target_ulong page)
 {
+    CPUTLBEntry *l2 = &env->tlb_d[mmu_idx].l2_table[tlb_l2_index(page)];
     int k;
 
     assert_cpu_is_self(ENV_GET_CPU(env));
@@ -418,6 +456,9 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
             tlb_n_used_entries_dec(env, mmu_idx);
         }
     }
+    for (k = 0; k < CPU_L2TLB_WAYS; k++) {
+        tlb_flush_entry_locked(&l2[k], page);
+    }
 }
 
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
@@ -623,6 +664,11 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
             tlb_reset_dirty_range_locked(&env->tlb_v_table[mmu_idx][i], start1,
                                          length);
         }
+
+        for (i = 0; i < CPU_L2TLB_SIZE; i++) {
+            tlb_reset_dirty_range_locked(&env->tlb_d[mmu_idx].l2_table[i],
+                                         start1, length);
+        }
     }
     qemu_spin_unlock(&env->tlb_c.lock);
 }
@@ -652,14 +698,63 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBEntry *l2 = &env->tlb_d[mmu_idx].l2_table[tlb_l2_index(vaddr)];
         int k;
         for (k = 0; k < CPU_VTLB_SIZE; k++) {
             tlb_set_dirty1_locked(&env->tlb_v_table[mmu_idx][k], vaddr);
         }
+        for (k = 0; k < CPU_L2TLB_WAYS; k++) {
+            tlb_set_dirty1_locked(&l2[k], vaddr);
+        }
     }
     qemu_spin_unlock(&env->tlb_c.lock);
 }
 
+/* Called with tlb_c.lock held */
+static void tlb_l2_insert_locked(CPUArchState *env, int mmu_idx,
+                                 const CPUTLBEntry *te,
+                                 const CPUIOTLBEntry *io)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    target_ulong page = te->addr_read;
+    size_t set;
+    int k;
+
+    if (page == -1) {
+        page = te->addr_write != -1 ? te->addr_write : te->addr_code;
+    }
+    set = tlb_l2_index(page & TARGET_PAGE_MASK);
+
+    /* Insert at the head of the set, dropping the least recently used. */
+    for (k = CPU_L2TLB_WAYS - 1; k > 0; k--) {
+        copy_tlb_helper_locked(&desc->l2_table[set + k],
+                               &desc->l2_table[set + k - 1]);
+        desc->l2_iotlb[set + k] = desc->l2_iotlb[set + k - 1];
+    }
+    copy_tlb_helper_locked(&desc->l2_table[set], te);
+    desc->l2_iotlb[set] = *io;
+}
+
+/*
+ * Evict an entry of the main tlb into the victim tlb, and the victim
+ * entry it replaces into the second-level tlb.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_victim_insert_locked(CPUArchState *env, int mmu_idx,
+                                     const CPUTLBEntry *te,
+                                     const CPUIOTLBEntry *io)
+{
+    unsigned vidx = env->tlb_d[mmu_idx].vindex++ % CPU_VTLB_SIZE;
+    CPUTLBEntry *tv = &env->tlb_v_table[mmu_idx][vidx];
+    CPUIOTLBEntry *tvio = &env->iotlb_v[mmu_idx][vidx];
+
+    if (!tlb_entry_is_empty(tv)) {
+        tlb_l2_insert_locked(env, mmu_idx, tv, tvio);
+    }
+    copy_tlb_helper_locked(tv, te);
+    *tvio = *io;
+}
+
 /* Our TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
@@ -684,6 +779,44 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env->tlb_d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * AFL RAM guard: guest RAM pages outside the board windows never get
+ * a TLB entry. The fill is dropped and afl_tlb_fill() raises the
+ * board intercept exception for the faulting access. Device pages
+ * are not filtered.
+ */
+static bool afl_guard_deny(MemoryRegionSection *section, hwaddr paddr)
+{
+    uint32_t i;
+
+    if (likely(!afl_tcg.guard) || !memory_region_is_ram(section->mr)) {
+        return false;
+    }
+
+    for (i = 0; i < afl_tcg.guard_nr; i++) {
+        if (paddr >= afl_tcg.guard_win[i].start &&
+            paddr < afl_tcg.guard_win[i].end) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void afl_tlb_fill(CPUState *cpu, target_ulong addr, int size,
+                         MMUAccessType access_type, int mmu_idx,
+                         uintptr_t retaddr)
+{
+    CPUArchState *env = cpu->env_ptr;
+
+    env->tlb_c.afl_guard_hit = false;
+    tlb_fill(cpu, addr, size, access_type, mmu_idx, retaddr);
+
+    if (unlikely(env->tlb_c.afl_guard_hit)) {
+        cpu->exception_index = EXCP_INTERCEPT + afl_tcg.guard_excp;
+        cpu_loop_exit_restore(cpu, retaddr);
+    }
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
  * supplied size is only used by tlb_flush_page.
@@ -721,6 +854,14 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
                                                 &xlat, &sz, attrs, &prot);
     assert(sz >= TARGET_PAGE_SIZE);
 
+    if (unlikely(afl_guard_deny(section, paddr_page))) {
+        env->tlb_c.afl_guard_hit = true;
+        return;
+    }
+
+    atomic_set(&env->tlb_d[mmu_idx].fill_count,
+               env->tlb_d[mmu_idx].fill_count + 1);
+
     tlb_debug("vaddr=" TARGET_FMT_lx " paddr=0x" TARGET_FMT_plx
               " prot=%x idx=%d\n",
               vaddr, paddr, prot, mmu_idx);
@@ -770,12 +911,8 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = env->tlb_d[mmu_idx].vindex++ % CPU_VTLB_SIZE;
-        CPUTLBEntry *tv = &env->tlb_v_table[mmu_idx][vidx];
-
         /* Evict the old entry into the victim tlb.  */
-        copy_tlb_helper_locked(tv, te);
-        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+        tlb_victim_insert_locked(env, mmu_idx, te, &env->iotlb[mmu_idx][index]);
         tlb_n_used_entries_dec(env, mmu_idx);
     }
 
@@ -878,7 +1015,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         CPUTLBEntry *entry;
         target_ulong tlb_addr;
 
-        tlb_fill(cpu, addr, size, access_type, mmu_idx, retaddr);
+        afl_tlb_fill(cpu, addr, size, access_type, mmu_idx, retaddr);
 
         entry = tlb_entry(env, mmu_idx, addr);
         tlb_addr = (access_type == MMU_DATA_LOAD ?
@@ -946,7 +1083,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         CPUTLBEntry *entry;
         target_ulong tlb_addr;
 
-        tlb_fill(cpu, addr, size, MMU_DATA_STORE, mmu_idx, retaddr);
+        afl_tlb_fill(cpu, addr, size, MMU_DATA_STORE, mmu_idx, retaddr);
 
         entry = tlb_entry(env, mmu_idx, addr);
         tlb_addr = tlb_addr_write(entry);
@@ -988,26 +1125,32 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
     }
 }
 
-/* Return true if ADDR is present in the victim tlb, and has been copied
-   back to the main tlb.  */
+static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
+{
+    /* ofs might correspond to .addr_write, so use atomic_read */
+#if TCG_OVERSIZED_GUEST
+    return *(target_ulong *)((uintptr_t)entry + ofs);
+#else
+    return atomic_read((target_ulong *)((uintptr_t)entry + ofs));
+#endif
+}
+
+/* Return true if ADDR is present in the victim or second-level tlb, and
+   has been copied back to the main tlb.  */
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t set = tlb_l2_index(page);
     size_t vidx;
+    int k;
 
     assert_cpu_is_self(ENV_GET_CPU(env));
+    atomic_set(&desc->miss_count, desc->miss_count + 1);
     for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
         CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
-        target_ulong cmp;
-
-        /* elt_ofs might correspond to .addr_write, so use atomic_read */
-#if TCG_OVERSIZED_GUEST
-        cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
-#else
-        cmp = atomic_read((target_ulong *)((uintptr_t)vtlb + elt_ofs));
-#endif
 
-        if (cmp == page) {
+        if (tlb_read_ofs(vtlb, elt_ofs) == page) {
             /* Found entry in victim tlb, swap tlb and iotlb.  */
             CPUTLBEntry tmptlb, *tlb = &env->tlb_table[mmu_idx][index];
 
@@ -1020,6 +1163,36 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
             CPUIOTLBEntry *vio = &env->iotlb_v[mmu_idx][vidx];
             tmpio = *io; *io = *vio; *vio = tmpio;
+            atomic_set(&desc->vtlb_hit_count, desc->vtlb_hit_count + 1);
+            return true;
+        }
+    }
+
+    for (k = 0; k < CPU_L2TLB_WAYS; k++) {
+        CPUTLBEntry *l2 = &desc->l2_table[set + k];
+
+        if (tlb_read_ofs(l2, elt_ofs) == page) {
+            /*
+             * Found entry in the second-level tlb, move it to the main
+             * tlb, whose entry goes to the victim tlb.
+             */
+            CPUTLBEntry tmptlb, *tlb = &env->tlb_table[mmu_idx][index];
+            CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
+
+            qemu_spin_lock(&env->tlb_c.lock);
+            copy_tlb_helper_locked(&tmptlb, l2);
+            tmpio = desc->l2_iotlb[set + k];
+            memset(l2, -1, sizeof(*l2));
+            if (tlb_entry_is_empty(tlb)) {
+                tlb_n_used_entries_inc(env, mmu_idx);
+            } else {
+                tlb_victim_insert_locked(env, mmu_idx, tlb, io);
+            }
+            copy_tlb_helper_locked(tlb, &tmptlb);
+            *io = tmpio;
+            qemu_spin_unlock(&env->tlb_c.lock);
+
+            atomic_set(&desc->l2_hit_count, desc->l2_hit_count + 1);
             return true;
         }
     }
@@ -1045,7 +1218,7 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
 
     if (unlikely(!tlb_hit(entry->addr_code, addr))) {
         if (!VICTIM_TLB_HIT(addr_code, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, 0, MMU_INST_FETCH, mmu_idx, 0);
+            afl_tlb_fill(ENV_GET_CPU(env), addr, 0, MMU_INST_FETCH, mmu_idx, 0);
             index = tlb_index(env, mmu_idx, addr);
             entry = tlb_entry(env, mmu_idx, addr);
         }
@@ -1083,8 +1256,8 @@ void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
     if (!tlb_hit(tlb_addr_write(entry), addr)) {
         /* TLB entry is for a different page */
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, size, MMU_DATA_STORE,
-                     mmu_idx, retaddr);
+            afl_tlb_fill(ENV_GET_CPU(env), addr, size, MMU_DATA_STORE,
+                         mmu_idx, retaddr);
         }
     }
 }
@@ -1126,8 +1299,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     /* Check TLB entry and enforce page permissions.  */
     if (!tlb_hit(tlb_addr, addr)) {
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_STORE,
-                     mmu_idx, retaddr);
+            afl_tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_STORE,
+                         mmu_idx, retaddr);
             index = tlb_index(env, mmu_idx, addr);
             tlbe = tlb_entry(env, mmu_idx, addr);
         }
@@ -1143,8 +1316,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
 
     /* Let the guest notice RMW on a write-only page.  */
     if (unlikely(tlbe->addr_read != (tlb_addr & ~TLB_NOTDIRTY))) {
-        tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_LOAD,
-                 mmu_idx, retaddr);
+        afl_tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_LOAD,
+                     mmu_idx, retaddr);
         /* Since we don't support reads and writes to different addresses,
            and we do have the proper page loaded for write, this shouldn't
            ever return.  But just in case, handle via stop-the-world.  */
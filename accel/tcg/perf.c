@@ -0,0 +1,195 @@
+/*
+ * Export TCG translations to Linux perf
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "cpu.h"
+#include "elf.h"
+#include "exec/exec-all.h"
+#include "disas/disas.h"
+#include "perf.h"
+
+/*
+ * perf attributes samples in anonymous memory using either:
+ *
+ *  - /tmp/perf-<pid>.map, one "start size name" line per code range,
+ *    read by perf report/top;
+ *
+ *  - /tmp/jit-<pid>.dump, the jitdump format, which also carries a
+ *    copy of the code so that it can be annotated. It is merged into
+ *    a recording with "perf inject --jit", and needs the samples to
+ *    be timestamped with "perf record -k 1".
+ *
+ * Each TB is named after its guest pc, and the guest symbol
+ * containing it when known.
+ */
+static FILE *perfmap;
+static FILE *jitdump;
+
+#define JITDUMP_MAGIC      0x4A695444
+#define JITDUMP_VERSION    1
+#define JIT_CODE_LOAD      0
+
+typedef struct JitHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitHeader;
+
+typedef struct JitCodeLoad {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} JitCodeLoad;
+
+#if defined(__x86_64__)
+#define JITDUMP_ELF_MACH   EM_X86_64
+#elif defined(__i386__)
+#define JITDUMP_ELF_MACH   EM_386
+#elif defined(__aarch64__)
+#define JITDUMP_ELF_MACH   EM_AARCH64
+#elif defined(__arm__)
+#define JITDUMP_ELF_MACH   EM_ARM
+#elif defined(__powerpc64__)
+#define JITDUMP_ELF_MACH   EM_PPC64
+#elif defined(__s390x__)
+#define JITDUMP_ELF_MACH   EM_S390
+#else
+#define JITDUMP_ELF_MACH   EM_NONE
+#endif
+
+/* perf expects the clock of "perf record -k 1" */
+static uint64_t jitdump_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void perf_enable_perfmap(Error **errp)
+{
+    char *path = g_strdup_printf("/tmp/perf-%d.map", getpid());
+
+    perfmap = fopen(path, "w");
+    if (!perfmap) {
+        error_setg_errno(errp, errno, "can't create perf map '%s'", path);
+    }
+    g_free(path);
+}
+
+void perf_enable_jitdump(Error **errp)
+{
+    JitHeader hdr = {
+        .magic = JITDUMP_MAGIC,
+        .version = JITDUMP_VERSION,
+        .total_size = sizeof(hdr),
+        .elf_mach = JITDUMP_ELF_MACH,
+        .pid = getpid(),
+        .timestamp = jitdump_timestamp(),
+    };
+    char *path = g_strdup_printf("/tmp/jit-%d.dump", getpid());
+    void *marker;
+    int fd;
+
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "can't create jitdump '%s'", path);
+        goto out;
+    }
+
+    /*
+     * perf finds the dump by this executable mapping of it, recorded
+     * in the perf.data mmap events.
+     */
+    marker = mmap(NULL, qemu_real_host_page_size, PROT_READ | PROT_EXEC,
+                  MAP_PRIVATE, fd, 0);
+    if (marker == MAP_FAILED) {
+        error_setg_errno(errp, errno, "can't map jitdump '%s'", path);
+        close(fd);
+        goto out;
+    }
+
+    jitdump = fdopen(fd, "w+");
+    if (!jitdump || fwrite(&hdr, sizeof(hdr), 1, jitdump) != 1) {
+        error_setg_errno(errp, errno, "can't write jitdump '%s'", path);
+        munmap(marker, qemu_real_host_page_size);
+        if (jitdump) {
+            fclose(jitdump);
+            jitdump = NULL;
+        } else {
+            close(fd);
+        }
+    }
+out:
+    g_free(path);
+}
+
+bool perf_enabled(void)
+{
+    return perfmap || jitdump;
+}
+
+static void perf_report_jitdump(const void *start, size_t size,
+                                const char *name)
+{
+    static uint64_t code_index;
+    JitCodeLoad rec = {
+        .id = JIT_CODE_LOAD,
+        .total_size = sizeof(rec) + strlen(name) + 1 + size,
+        .timestamp = jitdump_timestamp(),
+        .pid = getpid(),
+        .tid = qemu_get_thread_id(),
+        .vma = (uintptr_t)start,
+        .code_addr = (uintptr_t)start,
+        .code_size = size,
+    };
+
+    /* TBs are translated concurrently with MTTCG */
+    flockfile(jitdump);
+    rec.code_index = code_index++;
+    fwrite(&rec, sizeof(rec), 1, jitdump);
+    fwrite(name, strlen(name) + 1, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+    fflush(jitdump);
+    funlockfile(jitdump);
+}
+
+void perf_report_code(TranslationBlock *tb)
+{
+    const char *symbol = lookup_symbol(tb->pc);
+    char *name;
+
+    if (*symbol) {
+        name = g_strdup_printf("guest-0x" TARGET_FMT_lx " %s",
+                               tb->pc, symbol);
+    } else {
+        name = g_strdup_printf("guest-0x" TARGET_FMT_lx, tb->pc);
+    }
+
+    if (perfmap) {
+        fprintf(perfmap, "%" PRIxPTR " %x %s\n",
+                (uintptr_t)tb->tc.ptr, (unsigned)tb->tc.size, name);
+        fflush(perfmap);
+    }
+    if (jitdump) {
+        perf_report_jitdump(tb->tc.ptr, tb->tc.size, name);
+    }
+    g_free(name);
+}
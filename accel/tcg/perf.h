@@ -0,0 +1,16 @@
+/*
+ * Export TCG translations to Linux perf
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef ACCEL_TCG_PERF_H
+#define ACCEL_TCG_PERF_H
+
+#include "exec/exec-all.h"
+
+bool perf_enabled(void);
+/* Name the host code of @tb after its guest pc in the perf files */
+void perf_report_code(TranslationBlock *tb);
+
+#endif /* ACCEL_TCG_PERF_H */
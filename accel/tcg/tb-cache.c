@@ -0,0 +1,508 @@
+/*
+ * Persistent TCG translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/units.h"
+#include "qemu/thread.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/translator.h"
+#include "exec/ram_addr.h"
+#include "tcg.h"
+#include "tb-cache.h"
+
+/*
+ * Host code of translated TBs is appended to a file, to be reused by
+ * later runs of the same QEMU binary on the same host.
+ *
+ * A record is keyed by the TB physical and virtual pc, cpu flags,
+ * cflags and guest CPU configuration: the CPU model and the values of
+ * its properties (-cpu model,+feature,vendor=...), which select the
+ * instructions the translator accepts. It is only used when the guest
+ * code the TB was translated from is unchanged, and is then copied and
+ * relocated into code_gen_buffer in place of a translation.
+ *
+ * TBs embedding host data addresses or AFL instrumentation are not
+ * cached.
+ *
+ * Each record is written with a single append, so that concurrent
+ * instances may share a file. A truncated record ends the file.
+ * When the file holds records superseded by a later one with the same
+ * key, or grows past TB_CACHE_MAX_SIZE, it is rewritten at startup
+ * with the latest record of each key, oldest ones dropped first down
+ * to half of the limit. Appends stop at the limit.
+ */
+#define TB_CACHE_MAGIC     "QEMUTBC1"
+#define TB_CACHE_FNV_INIT  0xcbf29ce484222325ULL
+#define TB_CACHE_MAX_SIZE  (256 * MiB)
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint64_t id;
+} TBCacheHeader;
+
+typedef struct TBCacheRecord {
+    /* key */
+    uint64_t phys_pc;
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+    uint32_t model;
+    /* guest code, per page */
+    uint64_t hash[2];
+    uint32_t size;
+    uint32_t icount;
+    /* host code */
+    uint16_t jmp_reset_offset[2];
+    uint32_t jmp_target_arg[2];
+    uint32_t chain_offset;
+    uint32_t code_size;
+    uint32_t search_size;
+    uint32_t nb_relocs;
+    /* followed by relocations, code and search data */
+} TBCacheRecord;
+
+#define TB_CACHE_KEY_SIZE  offsetof(TBCacheRecord, hash)
+
+static struct {
+    bool enabled;
+    int fd;
+    QemuMutex lock;
+    GHashTable *records;
+    GHashTable *models;
+    size_t size;
+} tb_cache = { .fd = -1 };
+
+static uint64_t tb_cache_fnv(uint64_t h, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len--) {
+        h = (h ^ *p++) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static guint tb_cache_hash(gconstpointer key)
+{
+    return tb_cache_fnv(TB_CACHE_FNV_INIT, key, TB_CACHE_KEY_SIZE);
+}
+
+static gboolean tb_cache_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, TB_CACHE_KEY_SIZE);
+}
+
+static TCGHostReloc *tb_cache_relocs(TBCacheRecord *r)
+{
+    return (void *)(r + 1);
+}
+
+static void *tb_cache_code(TBCacheRecord *r)
+{
+    return tb_cache_relocs(r) + r->nb_relocs;
+}
+
+static size_t tb_cache_record_size(TBCacheRecord *r)
+{
+    return ROUND_UP(sizeof(*r) + r->nb_relocs * sizeof(TCGHostReloc)
+                    + r->code_size + r->search_size, 8);
+}
+
+/* vCPU topology ids differ between the vCPUs, not their translations */
+static const char *const tb_cache_model_skip[] = {
+    "apic-id", "socket-id", "core-id", "thread-id", "node-id",
+    "mp-affinity", "start-powered-off", NULL
+};
+
+static bool tb_cache_model_prop(ObjectProperty *prop)
+{
+    static const char *const types[] = {
+        "bool", "int", "int8", "int16", "int32", "int64",
+        "uint8", "uint16", "uint32", "uint64", "size", "str", "string",
+        NULL
+    };
+
+    return prop->get && g_strv_contains(types, prop->type) &&
+        !g_strv_contains(tb_cache_model_skip, prop->name);
+}
+
+/*
+ * CPU model and scalar property values. Feature flags are properties
+ * reading the final CPU state (e.g. x86 env->features and vendor), so
+ * this follows +feature, host passthrough and filtered features alike.
+ * Properties are combined independently of their enumeration order.
+ */
+static uint32_t tb_cache_model_compute(CPUState *cpu)
+{
+    const char *type = object_get_typename(OBJECT(cpu));
+    uint64_t h = tb_cache_fnv(TB_CACHE_FNV_INIT, type, strlen(type));
+    ObjectPropertyIterator iter;
+    ObjectProperty *prop;
+
+    object_property_iter_init(&iter, OBJECT(cpu));
+    while ((prop = object_property_iter_next(&iter))) {
+        Error *err = NULL;
+        char *val;
+
+        if (!tb_cache_model_prop(prop)) {
+            continue;
+        }
+        val = object_property_print(OBJECT(cpu), prop->name, false, &err);
+        if (err) {
+            error_free(err);
+            continue;
+        }
+        h += tb_cache_fnv(tb_cache_fnv(TB_CACHE_FNV_INIT, prop->name,
+                                       strlen(prop->name) + 1),
+                          val, strlen(val));
+        g_free(val);
+    }
+    return h ^ (h >> 32);
+}
+
+/* Computed once per vCPU: the configuration is fixed once realized */
+static uint32_t tb_cache_model(CPUState *cpu)
+{
+    gpointer model;
+
+    qemu_mutex_lock(&tb_cache.lock);
+    if (!g_hash_table_lookup_extended(tb_cache.models, cpu, NULL, &model)) {
+        model = GUINT_TO_POINTER(tb_cache_model_compute(cpu));
+        g_hash_table_insert(tb_cache.models, cpu, model);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+    return GPOINTER_TO_UINT(model);
+}
+
+static void tb_cache_key(TBCacheRecord *r, CPUState *cpu,
+                         TranslationBlock *tb, tb_page_addr_t phys_pc)
+{
+    memset(r, 0, sizeof(*r));
+    r->phys_pc = phys_pc;
+    r->pc = tb->pc;
+    r->cs_base = tb->cs_base;
+    r->flags = tb->flags;
+    r->cflags = tb->cflags;
+    r->trace_vcpu_dstate = tb->trace_vcpu_dstate;
+    r->model = tb_cache_model(cpu);
+}
+
+/* Guest code of [pc, pc + size) within the first page and the next one */
+static void tb_cache_guest_hash(uint64_t hash[2], target_ulong pc,
+                                uint32_t size, tb_page_addr_t phys_pc,
+                                tb_page_addr_t phys_page2)
+{
+    uint32_t len = MIN(size, TARGET_PAGE_SIZE - (pc & ~TARGET_PAGE_MASK));
+
+    hash[0] = tb_cache_fnv(TB_CACHE_FNV_INIT,
+                           qemu_map_ram_ptr(NULL, phys_pc), len);
+    hash[1] = 0;
+    if (len < size) {
+        hash[1] = tb_cache_fnv(TB_CACHE_FNV_INIT,
+                               qemu_map_ram_ptr(NULL, phys_page2),
+                               size - len);
+    }
+}
+
+static bool tb_cache_valid(TBCacheRecord *r)
+{
+    TCGHostReloc *relocs = tb_cache_relocs(r);
+    uint32_t i;
+
+    if (!r->size || r->size > TARGET_PAGE_SIZE ||
+        r->chain_offset > r->code_size) {
+        return false;
+    }
+    for (i = 0; i < 2; i++) {
+        if (r->jmp_reset_offset[i] != TB_JMP_RESET_OFFSET_INVALID &&
+            (r->jmp_reset_offset[i] > r->code_size ||
+             r->jmp_target_arg[i] + 4 > r->code_size)) {
+            return false;
+        }
+    }
+    for (i = 0; i < r->nb_relocs; i++) {
+        uint32_t len = relocs[i].kind == TCG_HOST_RELOC_PC32 ? 4 : 8;
+
+        if (relocs[i].offset > r->code_size ||
+            r->code_size - relocs[i].offset < len) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Rewrite @path with the latest record of each key of @order (records
+ * in file order), newest first up to half of TB_CACHE_MAX_SIZE.
+ * Records left out are dropped from tb_cache.records too.
+ */
+static void tb_cache_compact(const char *path, TBCacheHeader *hdr,
+                             GPtrArray *order)
+{
+    char *tmp = g_strdup_printf("%s.%d", path, getpid());
+    GPtrArray *keep = g_ptr_array_new();
+    size_t total = sizeof(*hdr);
+    bool ok;
+    int fd;
+    int i;
+
+    for (i = (int)order->len - 1; i >= 0; i--) {
+        TBCacheRecord *r = g_ptr_array_index(order, i);
+        size_t len = tb_cache_record_size(r);
+
+        if (g_hash_table_lookup(tb_cache.records, r) != r) {
+            continue;
+        }
+        if (total + len > TB_CACHE_MAX_SIZE / 2) {
+            g_hash_table_remove(tb_cache.records, r);
+            continue;
+        }
+        g_ptr_array_add(keep, r);
+        total += len;
+    }
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = fd >= 0 && write(fd, hdr, sizeof(*hdr)) == sizeof(*hdr);
+    for (i = (int)keep->len - 1; ok && i >= 0; i--) {
+        TBCacheRecord *r = g_ptr_array_index(keep, i);
+        size_t len = tb_cache_record_size(r);
+
+        ok = write(fd, r, len) == len;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    /* records appended meanwhile by another instance are lost */
+    if (!ok || rename(tmp, path)) {
+        warn_report("can't compact TB cache '%s': %s", path, strerror(errno));
+        unlink(tmp);
+    }
+    g_ptr_array_free(keep, true);
+    g_free(tmp);
+}
+
+static bool tb_cache_read(const char *path, uint64_t id)
+{
+    TBCacheHeader *hdr;
+    GPtrArray *order;
+    size_t stale = 0;
+    gchar *buf;
+    gsize len, off;
+
+    if (!g_file_get_contents(path, &buf, &len, NULL)) {
+        return false;
+    }
+
+    hdr = (TBCacheHeader *)buf;
+    if (len < sizeof(*hdr) || memcmp(hdr->magic, TB_CACHE_MAGIC, 8) ||
+        hdr->id != id) {
+        g_free(buf);
+        return false;
+    }
+
+    /* records point into the file contents, kept until exit */
+    order = g_ptr_array_new();
+    for (off = sizeof(*hdr); off + sizeof(TBCacheRecord) <= len; ) {
+        TBCacheRecord *r = (TBCacheRecord *)(buf + off);
+
+        if (r->nb_relocs > TCG_MAX_HOST_RELOCS ||
+            tb_cache_record_size(r) > len - off) {
+            break;
+        }
+        if (tb_cache_valid(r)) {
+            if (g_hash_table_contains(tb_cache.records, r)) {
+                stale++;
+            }
+            g_hash_table_replace(tb_cache.records, r, r);
+            g_ptr_array_add(order, r);
+        } else {
+            stale++;
+        }
+        off += tb_cache_record_size(r);
+    }
+
+    if (stale || off != len || len > TB_CACHE_MAX_SIZE) {
+        tb_cache_compact(path, hdr, order);
+    }
+    g_ptr_array_free(order, true);
+    return true;
+}
+
+/* Same binary, host and guest architecture */
+static uint64_t tb_cache_id(void)
+{
+    uint64_t v[4] = { tcg_tb_cache_id(tcg_ctx) };
+    struct stat st;
+
+    if (!stat("/proc/self/exe", &st)) {
+        v[1] = st.st_size;
+        v[2] = st.st_mtime;
+        v[3] = st.st_ino;
+    }
+    return tb_cache_fnv(tb_cache_fnv(TB_CACHE_FNV_INIT, v, sizeof(v)),
+                        TARGET_NAME, strlen(TARGET_NAME));
+}
+
+void tb_cache_init(const char *path, Error **errp)
+{
+    TBCacheHeader hdr = { .magic = TB_CACHE_MAGIC };
+    bool valid;
+
+    if (!TCG_TARGET_HAS_tb_cache) {
+        error_setg(errp, "tb-cache is not supported on this host");
+        return;
+    }
+
+    hdr.id = tb_cache_id();
+    tb_cache.records = g_hash_table_new(tb_cache_hash, tb_cache_equal);
+    tb_cache.models = g_hash_table_new(NULL, NULL);
+    qemu_mutex_init(&tb_cache.lock);
+    valid = tb_cache_read(path, hdr.id);
+
+    tb_cache.fd = open(path, O_WRONLY | O_CREAT | O_APPEND |
+                       (valid ? 0 : O_TRUNC), 0644);
+    if (tb_cache.fd < 0) {
+        error_setg_errno(errp, errno, "can't open TB cache '%s'", path);
+        return;
+    }
+    if (!valid && write(tb_cache.fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        error_setg_errno(errp, errno, "can't write TB cache '%s'", path);
+        close(tb_cache.fd);
+        return;
+    }
+    tb_cache.size = lseek(tb_cache.fd, 0, SEEK_END);
+
+    tb_cache.enabled = true;
+}
+
+bool tb_cache_usable(CPUState *cpu, uint32_t cflags)
+{
+    return tb_cache.enabled && !(cflags & CF_NOCACHE) &&
+        !cpu->singlestep_enabled && !singlestep &&
+        QTAILQ_EMPTY(&cpu->breakpoints);
+}
+
+/*
+ * Fill @tb from a cached translation of the same guest code.
+ * Returns the size of the host code and search data written at
+ * tb->tc.ptr, or 0 on a miss.
+ */
+int tb_cache_load(CPUState *cpu, TranslationBlock *tb, tb_page_addr_t phys_pc)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TBCacheRecord key, *r;
+    tb_page_addr_t phys_page2;
+    size_t len;
+
+    tb_cache_key(&key, cpu, tb, phys_pc);
+
+    qemu_mutex_lock(&tb_cache.lock);
+    r = g_hash_table_lookup(tb_cache.records, &key);
+    qemu_mutex_unlock(&tb_cache.lock);
+
+    if (!r || translator_afl_instrumented(tb->pc, r->size)) {
+        return 0;
+    }
+
+    len = MIN(r->size, TARGET_PAGE_SIZE - (tb->pc & ~TARGET_PAGE_MASK));
+    if (tb_cache_fnv(TB_CACHE_FNV_INIT, qemu_map_ram_ptr(NULL, phys_pc),
+                     len) != r->hash[0]) {
+        return 0;
+    }
+    if (len < r->size) {
+        /* as translation would have, once the first page matched */
+        phys_page2 = get_page_addr_code(env, tb->pc + len);
+        if (phys_page2 == -1 ||
+            tb_cache_fnv(TB_CACHE_FNV_INIT, qemu_map_ram_ptr(NULL, phys_page2),
+                         r->size - len) != r->hash[1]) {
+            return 0;
+        }
+    }
+
+    len = r->code_size + r->search_size;
+    if ((void *)tb->tc.ptr + len > tcg_ctx->code_gen_highwater) {
+        return 0;
+    }
+
+    memcpy(tb->tc.ptr, tb_cache_code(r), len);
+    if (!tcg_tb_cache_relocate(tcg_ctx, tb->tc.ptr, tb_cache_relocs(r),
+                               r->nb_relocs)) {
+        return 0;
+    }
+    flush_icache_range((uintptr_t)tb->tc.ptr,
+                       (uintptr_t)tb->tc.ptr + r->code_size);
+
+    tb->size = r->size;
+    tb->icount = r->icount;
+    tb->tc.size = r->code_size;
+    tb->jmp_reset_offset[0] = r->jmp_reset_offset[0];
+    tb->jmp_reset_offset[1] = r->jmp_reset_offset[1];
+    tb->jmp_target_arg[0] = r->jmp_target_arg[0];
+    tb->jmp_target_arg[1] = r->jmp_target_arg[1];
+    tb->chain_offset = r->chain_offset;
+    return len;
+}
+
+/* Append the translation just generated for @tb */
+void tb_cache_save(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, tb_page_addr_t phys_page2,
+                   int search_size)
+{
+    TCGContext *s = tcg_ctx;
+    TBCacheRecord *r;
+    target_ulong virt_page2;
+    size_t len;
+
+    if (s->tb_cache_skip || !tb->size) {
+        return;
+    }
+    virt_page2 = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+    if ((tb->pc & TARGET_PAGE_MASK) != virt_page2 && phys_page2 == -1) {
+        return;
+    }
+
+    len = ROUND_UP(sizeof(*r) + s->nb_host_relocs * sizeof(TCGHostReloc)
+                   + tb->tc.size + search_size, 8);
+    r = g_malloc0(len);
+
+    tb_cache_key(r, cpu, tb, phys_pc);
+    tb_cache_guest_hash(r->hash, tb->pc, tb->size, phys_pc, phys_page2);
+    r->size = tb->size;
+    r->icount = tb->icount;
+    r->jmp_reset_offset[0] = tb->jmp_reset_offset[0];
+    r->jmp_reset_offset[1] = tb->jmp_reset_offset[1];
+    r->jmp_target_arg[0] = tb->jmp_target_arg[0];
+    r->jmp_target_arg[1] = tb->jmp_target_arg[1];
+    r->chain_offset = tb->chain_offset;
+    r->code_size = tb->tc.size;
+    r->search_size = search_size;
+    r->nb_relocs = s->nb_host_relocs;
+    memcpy(tb_cache_relocs(r), s->host_relocs,
+           r->nb_relocs * sizeof(TCGHostReloc));
+    memcpy(tb_cache_code(r), tb->tc.ptr, tb->tc.size + search_size);
+
+    qemu_mutex_lock(&tb_cache.lock);
+    if (tb_cache.fd < 0 || tb_cache.size + len > TB_CACHE_MAX_SIZE) {
+        qemu_mutex_unlock(&tb_cache.lock);
+        g_free(r);
+        return;
+    }
+    if (write(tb_cache.fd, r, len) != len) {
+        warn_report("can't write TB cache: %s", strerror(errno));
+        close(tb_cache.fd);
+        tb_cache.fd = -1;
+    }
+    tb_cache.size += len;
+    g_hash_table_replace(tb_cache.records, r, r);
+    qemu_mutex_unlock(&tb_cache.lock);
+}
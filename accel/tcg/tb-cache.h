@@ -0,0 +1,38 @@
+/*
+ * Persistent TCG translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef TB_CACHE_H
+#define TB_CACHE_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_SOFTMMU
+bool tb_cache_usable(CPUState *cpu, uint32_t cflags);
+int tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                  tb_page_addr_t phys_pc);
+void tb_cache_save(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, tb_page_addr_t phys_page2,
+                   int search_size);
+#else
+static inline bool tb_cache_usable(CPUState *cpu, uint32_t cflags)
+{
+    return false;
+}
+
+static inline int tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                                tb_page_addr_t phys_pc)
+{
+    return 0;
+}
+
+static inline void tb_cache_save(CPUState *cpu, TranslationBlock *tb,
+                                 tb_page_addr_t phys_pc,
+                                 tb_page_addr_t phys_page2, int search_size)
+{
+}
+#endif
+
+#endif /* TB_CACHE_H */
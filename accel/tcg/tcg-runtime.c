@@ -30,6 +30,7 @@
 #include "exec/tb-lookup.h"
 #include "disas/disas.h"
 #include "exec/log.h"
+#include "qemu/afl-tcg.h"
 
 /* 32-bit helpers */
 
@@ -167,3 +168,31 @@ void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(ENV_GET_CPU(env), GETPC());
 }
+
+void HELPER(afl_cmplog)(uint64_t pc, uint64_t v0, uint64_t v1, uint32_t size)
+{
+    afl_cmp_map_t *map = afl_tcg.cmp_map;
+    uint32_t k = ((pc >> 4) ^ (pc << 8)) & (AFL_CMP_MAP_W - 1);
+    afl_cmp_hdr_t *hdr = &map->headers[k];
+    afl_cmp_ops_t *ops = &map->log[k][hdr->hits & (AFL_CMP_MAP_H - 1)];
+
+    if (size < 8) {
+        v0 &= MAKE_64BIT_MASK(0, size * 8);
+        v1 &= MAKE_64BIT_MASK(0, size * 8);
+    }
+
+    hdr->hits++;
+    hdr->size = size;
+    ops->v0 = v0;
+    ops->v1 = v1;
+}
+
+void HELPER(afl_hook)(void)
+{
+    afl_tcg.hook(afl_tcg.hook_opaque);
+}
+
+void HELPER(trace_hot)(void *tb)
+{
+    tb_trace_hot(tb);
+}
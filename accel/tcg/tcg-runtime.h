@@ -28,6 +28,10 @@ DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG_SE, ptr, env)
 
 DEF_HELPER_FLAGS_1(exit_atomic, TCG_CALL_NO_WG, noreturn, env)
 
+DEF_HELPER_FLAGS_4(afl_cmplog, TCG_CALL_NO_RWG, void, i64, i64, i64, i32)
+DEF_HELPER_FLAGS_0(afl_hook, TCG_CALL_NO_WG, void)
+DEF_HELPER_FLAGS_1(trace_hot, TCG_CALL_NO_RWG, void, ptr)
+
 #ifdef CONFIG_SOFTMMU
 
 DEF_HELPER_FLAGS_5(atomic_cmpxchgb, TCG_CALL_NO_WG,
@@ -46,8 +46,11 @@
 #endif
 
 #include "exec/cputlb.h"
+#include "exec/cpu_ldst.h"
 #include "exec/tb-hash.h"
 #include "translate-all.h"
+#include "tb-cache.h"
+#include "perf.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "qemu/qemu-print.h"
@@ -1137,6 +1140,115 @@ static void tb_htable_init(void)
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
 }
 
+/*
+ * Superblocks: TBs counting their executions up to tb_trace_threshold
+ * are invalidated, and their hash recorded so that they get
+ * retranslated with CF_TRACE. Zero disables counting.
+ */
+uint32_t tb_trace_threshold;
+unsigned int tb_bg_threads;
+
+#ifdef CONFIG_SOFTMMU
+static bool tb_bg_queue(TranslationBlock *tb);
+static void tb_bg_init(void);
+static void tb_bg_pause(void);
+static void tb_bg_resume(void);
+#else
+static inline bool tb_bg_queue(TranslationBlock *tb)
+{
+    return false;
+}
+
+static inline void tb_bg_init(void)
+{
+}
+
+static inline void tb_bg_pause(void)
+{
+}
+
+static inline void tb_bg_resume(void)
+{
+}
+#endif
+
+static struct {
+    QemuMutex lock;
+    GHashTable *hot;
+} tb_trace;
+
+static void tb_trace_init(void)
+{
+    qemu_mutex_init(&tb_trace.lock);
+    tb_trace.hot = g_hash_table_new(NULL, NULL);
+}
+
+void tb_trace_hot(TranslationBlock *tb)
+{
+    tb_page_addr_t phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+    uint32_t h = tb_hash_func(phys_pc, tb->pc, tb->flags,
+                              tb_cflags(tb) & CF_HASH_MASK,
+                              tb->trace_vcpu_dstate);
+
+    if (tb_bg_threads && tb_bg_queue(tb)) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_trace.lock);
+    g_hash_table_add(tb_trace.hot, GUINT_TO_POINTER(h));
+    qemu_mutex_unlock(&tb_trace.lock);
+
+    /* the TB may keep running, it is just no longer found */
+    tb_phys_invalidate(tb, -1);
+}
+
+static bool tb_trace_take(tb_page_addr_t phys_pc, target_ulong pc,
+                          uint32_t flags, uint32_t cflags,
+                          uint32_t trace_vcpu_dstate)
+{
+    uint32_t h = tb_hash_func(phys_pc, pc, flags, cflags & CF_HASH_MASK,
+                              trace_vcpu_dstate);
+    bool hot;
+
+    qemu_mutex_lock(&tb_trace.lock);
+    hot = g_hash_table_remove(tb_trace.hot, GUINT_TO_POINTER(h));
+    qemu_mutex_unlock(&tb_trace.lock);
+    return hot;
+}
+
+/*
+ * Execution count of the TB at @pc sharing the cs_base and flags of @tb.
+ * Background translations only look at the counts snapshotted by the
+ * vCPU, the lookup would walk the vCPU TLB.
+ */
+bool tb_trace_count(CPUState *cpu, TranslationBlock *tb, target_ulong pc,
+                    uint32_t *count)
+{
+    TranslationBlock *next;
+
+#ifdef CONFIG_SOFTMMU
+    if (tb_code_view) {
+        int i;
+
+        for (i = 0; i < tb_code_view->nb_succ; i++) {
+            if (tb_code_view->succ[i].pc == pc) {
+                *count = tb_code_view->succ[i].trace_count;
+                return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+    next = tb_htable_lookup(cpu, pc, tb->cs_base, tb->flags,
+                            tb_cflags(tb) & CF_HASH_MASK);
+    if (!next) {
+        return false;
+    }
+    *count = atomic_read(&next->trace_count);
+    return true;
+}
+
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
    (in bytes) allocated to the translation buffer. Zero means default
    size. */
@@ -1146,6 +1258,8 @@ void tcg_exec_init(unsigned long tb_size)
     cpu_gen_init();
     page_init();
     tb_htable_init();
+    tb_trace_init();
+    tb_bg_init();
     code_gen_alloc(tb_size);
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
@@ -1253,7 +1367,10 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
+    /* background translation threads write to their region */
+    tb_bg_pause();
     tcg_region_reset_all();
+    tb_bg_resume();
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     atomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
@@ -1665,6 +1782,39 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 }
 
 /* Called with mmap_lock held for user mode emulation.  */
+static void tb_init_jumps(TranslationBlock *tb)
+{
+    /* init jump list */
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+
+    /* init original jump addresses which have been set during tcg_gen_code() */
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+}
+
+static void tb_init_jmp_offsets(TranslationBlock *tb)
+{
+    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
+    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
+    tcg_ctx->tb_jmp_reset_offset = tb->jmp_reset_offset;
+    if (TCG_TARGET_HAS_direct_jump) {
+        tcg_ctx->tb_jmp_insn_offset = tb->jmp_target_arg;
+        tcg_ctx->tb_jmp_target_addr = NULL;
+    } else {
+        tcg_ctx->tb_jmp_insn_offset = NULL;
+        tcg_ctx->tb_jmp_target_addr = tb->jmp_target_arg;
+    }
+}
+
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags, int cflags)
@@ -1674,7 +1824,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
-    int gen_code_size, search_size, max_insns;
+    int gen_code_size, search_size, max_insns, cached;
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
@@ -1692,6 +1842,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     cflags &= ~CF_CLUSTER_MASK;
     cflags |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
+    if (tb_trace_threshold && phys_pc != -1 &&
+        tb_trace_take(phys_pc, pc, flags, cflags, *cpu->trace_dstate)) {
+        cflags |= CF_TRACE;
+    }
+
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
         max_insns = CF_COUNT_MASK;
@@ -1721,7 +1876,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->trace_count = 0;
     tcg_ctx->tb_cflags = cflags;
+
+    /* skip translation if a previous run cached it */
+    tcg_ctx->tb_cache = tb_cache_usable(cpu, cflags);
+    cached = tcg_ctx->tb_cache ? tb_cache_load(cpu, tb, phys_pc) : 0;
+    if (cached) {
+        gen_code_size = tb->tc.size;
+        search_size = cached - gen_code_size;
+        goto tb_cached;
+    }
  tb_overflow:
 
 #ifdef CONFIG_PROFILER
@@ -1739,16 +1904,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     trace_translate_block(tb, tb->pc, tb->tc.ptr);
 
     /* generate machine code */
-    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
-    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
-    tcg_ctx->tb_jmp_reset_offset = tb->jmp_reset_offset;
-    if (TCG_TARGET_HAS_direct_jump) {
-        tcg_ctx->tb_jmp_insn_offset = tb->jmp_target_arg;
-        tcg_ctx->tb_jmp_target_addr = NULL;
-    } else {
-        tcg_ctx->tb_jmp_insn_offset = NULL;
-        tcg_ctx->tb_jmp_target_addr = tb->jmp_target_arg;
-    }
+    tb_init_jmp_offsets(tb);
 
 #ifdef CONFIG_PROFILER
     atomic_set(&prof->tb_count, prof->tb_count + 1);
@@ -1835,25 +1991,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
+ tb_cached:
     atomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
 
-    /* init jump list */
-    qemu_spin_init(&tb->jmp_lock);
-    tb->jmp_list_head = (uintptr_t)NULL;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-    tb->jmp_dest[0] = (uintptr_t)NULL;
-    tb->jmp_dest[1] = (uintptr_t)NULL;
-
-    /* init original jump addresses which have been set during tcg_gen_code() */
-    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 0);
-    }
-    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 1);
-    }
+    tb_init_jumps(tb);
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -1861,6 +2004,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
+    if (tcg_ctx->tb_cache && !cached) {
+        tb_cache_save(cpu, tb, phys_pc, phys_page2, search_size);
+    }
     /*
      * No explicit memory barrier is required -- tb_link_page() makes the
      * TB visible in a consistent state.
@@ -1874,10 +2020,421 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         atomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
         return existing_tb;
     }
+    if (perf_enabled()) {
+        perf_report_code(tb);
+    }
     tcg_tb_insert(tb);
     return tb;
 }
 
+#ifdef CONFIG_SOFTMMU
+/*
+ * Background translation: with "-accel tcg,translate-threads=n", a TB
+ * reaching tb_trace_threshold keeps running while helper threads
+ * retranslate it as a superblock, instead of being invalidated for
+ * the vCPU to retranslate it synchronously.
+ *
+ * Helper threads own a TCGContext and region, and translate from a
+ * snapshot taken by the vCPU when queueing the request: the TB pages,
+ * the MMU index, the breakpoints and the execution counts of the
+ * blocks of the first page. They never read the live vCPU state nor
+ * walk its TLB. Translations needing code outside of the snapshot
+ * are dropped.
+ *
+ * The result is published by the vCPU itself (async_run_on_cpu), if
+ * no flush happened, the guest code and breakpoints are unchanged and
+ * no other thread linked the same TB meanwhile, so that it is never
+ * racing with writes of the vCPU to its own code.
+ *
+ * Helper threads translate concurrently, tb_flush only waits for the
+ * translations in progress before resetting the regions.
+ */
+#define TB_BG_QUEUE_MAX  64
+
+typedef struct TBBgRequest {
+    CPUState *cpu;
+    TranslationBlock *orig;
+    TranslationBlock *tb;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+    tb_page_addr_t phys_pc;
+    tb_page_addr_t phys_page2;
+    unsigned flush_count;
+    struct TBCodeView view;
+    QSIMPLEQ_ENTRY(TBBgRequest) entry;
+} TBBgRequest;
+
+__thread struct TBCodeView *tb_code_view;
+static __thread sigjmp_buf tb_bg_abort;
+
+static struct {
+    /* translations in progress, excluded by tb_flush */
+    QemuMutex lock;
+    QemuCond cond;
+    unsigned int active;
+    bool flushing;
+    QemuMutex queue_lock;
+    QemuCond queue_cond;
+    QSIMPLEQ_HEAD(, TBBgRequest) queue;
+    unsigned int queued;
+    bool started;
+    QemuThread *threads;
+} tb_bg;
+
+void tb_code_view_read(target_ulong addr, uint8_t *buf, int size)
+{
+    struct TBCodeView *view = tb_code_view;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        target_ulong off = addr + i - view->vaddr;
+        int page = off >> TARGET_PAGE_BITS;
+
+        if (off >= 2 * TARGET_PAGE_SIZE || !view->valid[page]) {
+            siglongjmp(tb_bg_abort, 1);
+        }
+        buf[i] = view->data[page][off & ~TARGET_PAGE_MASK];
+    }
+}
+
+static bool tb_bg_code_unchanged(TBBgRequest *req, TranslationBlock *tb)
+{
+    target_ulong off = tb->pc & ~TARGET_PAGE_MASK;
+    target_ulong len = MIN(tb->size, TARGET_PAGE_SIZE - off);
+
+    if (memcmp(req->view.data[0] + off,
+               qemu_map_ram_ptr(NULL, req->phys_pc - off) + off, len)) {
+        return false;
+    }
+    return tb->size == len ||
+        !memcmp(req->view.data[1], qemu_map_ram_ptr(NULL, req->phys_page2),
+                tb->size - len);
+}
+
+/* breakpoints within the superblock are those it was translated with */
+static bool tb_bg_breakpoints_unchanged(CPUState *cpu, TBBgRequest *req,
+                                        TranslationBlock *tb)
+{
+    CPUBreakpoint *bp, *snap;
+    int n = 0;
+
+    QTAILQ_FOREACH(bp, &cpu->breakpoints, entry) {
+        if (bp->pc - tb->pc >= tb->size) {
+            continue;
+        }
+        QTAILQ_FOREACH(snap, &req->view.breakpoints, entry) {
+            if (snap->pc == bp->pc && snap->flags == bp->flags) {
+                break;
+            }
+        }
+        if (!snap) {
+            return false;
+        }
+        n++;
+    }
+    QTAILQ_FOREACH(snap, &req->view.breakpoints, entry) {
+        if (snap->pc - tb->pc < tb->size) {
+            n--;
+        }
+    }
+    return n == 0;
+}
+
+static void tb_bg_publish(CPUState *cpu, run_on_cpu_data data)
+{
+    TBBgRequest *req = data.host_ptr;
+    TranslationBlock *tb = req->tb;
+    tb_page_addr_t phys_page2 = -1;
+
+    mmap_lock();
+    rcu_read_lock();
+    if (req->flush_count != atomic_read(&tb_ctx.tb_flush_count) ||
+        (atomic_read(&req->orig->cflags) & CF_INVALID) ||
+        !tb_bg_code_unchanged(req, tb) ||
+        !tb_bg_breakpoints_unchanged(cpu, req, tb)) {
+        goto out;
+    }
+
+    if ((tb->pc & TARGET_PAGE_MASK) !=
+        ((tb->pc + tb->size - 1) & TARGET_PAGE_MASK)) {
+        phys_page2 = req->phys_page2;
+    }
+    /* the superblock has the same hash key, it replaces the TB */
+    tb_phys_invalidate(req->orig, -1);
+    if (tb_link_page(tb, req->phys_pc, phys_page2) == tb) {
+        if (perf_enabled()) {
+            perf_report_code(tb);
+        }
+        tcg_tb_insert(tb);
+    }
+
+out:
+    rcu_read_unlock();
+    mmap_unlock();
+    g_free(req);
+}
+
+static bool tb_bg_gen_intermediate(TBBgRequest *req, TranslationBlock *tb)
+{
+    if (sigsetjmp(tb_bg_abort, 0)) {
+        tb_code_view = NULL;
+        tcg_ctx->cpu = NULL;
+        return false;
+    }
+
+    tb_code_view = &req->view;
+    tcg_ctx->cpu = req->cpu;
+    gen_intermediate_code(req->cpu, tb, TCG_MAX_INSNS);
+    tcg_ctx->cpu = NULL;
+    tb_code_view = NULL;
+    return true;
+}
+
+static TranslationBlock *tb_bg_gen_code(TBBgRequest *req)
+{
+    TranslationBlock *tb;
+    tcg_insn_unit *gen_code_buf;
+    int gen_code_size, search_size;
+
+    tb = tb_alloc(req->pc);
+    if (unlikely(!tb)) {
+        tb_flush(req->cpu);
+        return NULL;
+    }
+
+    gen_code_buf = tcg_ctx->code_gen_ptr;
+    tb->tc.ptr = gen_code_buf;
+    tb->pc = req->pc;
+    tb->cs_base = req->cs_base;
+    tb->flags = req->flags;
+    tb->cflags = req->cflags;
+    tb->trace_vcpu_dstate = req->trace_vcpu_dstate;
+    tb->trace_count = 0;
+    tcg_ctx->tb_cflags = req->cflags;
+    tcg_ctx->tb_cache = false;
+
+    tcg_func_start(tcg_ctx);
+    if (!tb_bg_gen_intermediate(req, tb)) {
+        goto fail;
+    }
+
+    tb_init_jmp_offsets(tb);
+    gen_code_size = tcg_gen_code(tcg_ctx, tb);
+    if (unlikely(gen_code_size < 0)) {
+        goto fail;
+    }
+    search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
+    if (unlikely(search_size < 0)) {
+        goto fail;
+    }
+    tb->tc.size = gen_code_size;
+
+    atomic_set(&tcg_ctx->code_gen_ptr, (void *)
+        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
+                 CODE_GEN_ALIGN));
+    tb_init_jumps(tb);
+    return tb;
+
+fail:
+    atomic_set(&tcg_ctx->code_gen_ptr, (void *)((uintptr_t)gen_code_buf -
+               ROUND_UP(sizeof(*tb), qemu_icache_linesize)));
+    return NULL;
+}
+
+static void *tb_bg_thread(void *arg)
+{
+    rcu_register_thread();
+    tcg_register_thread();
+
+    for (;;) {
+        TBBgRequest *req;
+
+        qemu_mutex_lock(&tb_bg.queue_lock);
+        while (QSIMPLEQ_EMPTY(&tb_bg.queue)) {
+            qemu_cond_wait(&tb_bg.queue_cond, &tb_bg.queue_lock);
+        }
+        req = QSIMPLEQ_FIRST(&tb_bg.queue);
+        QSIMPLEQ_REMOVE_HEAD(&tb_bg.queue, entry);
+        tb_bg.queued--;
+        qemu_mutex_unlock(&tb_bg.queue_lock);
+
+        qemu_mutex_lock(&tb_bg.lock);
+        while (tb_bg.flushing) {
+            qemu_cond_wait(&tb_bg.cond, &tb_bg.lock);
+        }
+        tb_bg.active++;
+        qemu_mutex_unlock(&tb_bg.lock);
+
+        rcu_read_lock();
+        req->tb = NULL;
+        if (req->flush_count == atomic_read(&tb_ctx.tb_flush_count)) {
+            req->tb = tb_bg_gen_code(req);
+        }
+        rcu_read_unlock();
+
+        qemu_mutex_lock(&tb_bg.lock);
+        if (--tb_bg.active == 0) {
+            qemu_cond_broadcast(&tb_bg.cond);
+        }
+        qemu_mutex_unlock(&tb_bg.lock);
+
+        if (req->tb) {
+            async_run_on_cpu(req->cpu, tb_bg_publish, RUN_ON_CPU_HOST_PTR(req));
+        } else {
+            g_free(req);
+        }
+    }
+    return NULL;
+}
+
+static void tb_bg_start(void)
+{
+    unsigned int i;
+
+    tb_bg.threads = g_new0(QemuThread, tb_bg_threads);
+    for (i = 0; i < tb_bg_threads; i++) {
+        char name[16];
+
+        snprintf(name, sizeof(name), "TCG translate %u", i);
+        qemu_thread_create(&tb_bg.threads[i], name, tb_bg_thread,
+                           NULL, QEMU_THREAD_DETACHED);
+    }
+    tb_bg.started = true;
+}
+
+/* execution counts of the blocks starting in the first page of @tb */
+static void tb_bg_snapshot_counts(TBBgRequest *req, TranslationBlock *tb)
+{
+    PageDesc *p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
+    TranslationBlock *t;
+    int n;
+
+    req->view.nb_succ = 0;
+    if (!p) {
+        return;
+    }
+    page_lock(p);
+    PAGE_FOR_EACH_TB(p, t, n) {
+        if (req->view.nb_succ == TB_CODE_VIEW_SUCC) {
+            break;
+        }
+        if (n != 0 || t->cs_base != tb->cs_base || t->flags != tb->flags ||
+            t->trace_vcpu_dstate != tb->trace_vcpu_dstate ||
+            (tb_cflags(t) & (CF_HASH_MASK | CF_INVALID)) !=
+            (tb_cflags(tb) & CF_HASH_MASK)) {
+            continue;
+        }
+        req->view.succ[req->view.nb_succ].pc = t->pc;
+        req->view.succ[req->view.nb_succ].trace_count =
+            atomic_read(&t->trace_count);
+        req->view.nb_succ++;
+    }
+    page_unlock(p);
+}
+
+/* Called by the vCPU executing @tb, returns false if not queued */
+static bool tb_bg_queue(TranslationBlock *tb)
+{
+    CPUState *cpu = current_cpu;
+    CPUBreakpoint *bp;
+    TBBgRequest *req;
+    int i, nb_bps = 0;
+
+    /* the snapshot holds a few breakpoints, and no single step */
+    if (cpu->singlestep_enabled) {
+        return false;
+    }
+    QTAILQ_FOREACH(bp, &cpu->breakpoints, entry) {
+        if (bp->pc - (tb->pc & TARGET_PAGE_MASK) < 2 * TARGET_PAGE_SIZE &&
+            ++nb_bps > TB_CODE_VIEW_BPS) {
+            return false;
+        }
+    }
+
+    qemu_mutex_lock(&tb_bg.queue_lock);
+    if (tb_bg.queued >= TB_BG_QUEUE_MAX) {
+        qemu_mutex_unlock(&tb_bg.queue_lock);
+        return false;
+    }
+    tb_bg.queued++;
+    qemu_mutex_unlock(&tb_bg.queue_lock);
+
+    req = g_new(TBBgRequest, 1);
+    req->cpu = cpu;
+    req->orig = tb;
+    req->pc = tb->pc;
+    req->cs_base = tb->cs_base;
+    req->flags = tb->flags;
+    req->cflags = tb_cflags(tb) | CF_TRACE;
+    req->trace_vcpu_dstate = tb->trace_vcpu_dstate;
+    req->phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+    req->phys_page2 = tb->page_addr[1];
+    req->flush_count = atomic_read(&tb_ctx.tb_flush_count);
+
+    req->view.vaddr = tb->pc & TARGET_PAGE_MASK;
+    for (i = 0; i < 2; i++) {
+        req->view.valid[i] = tb->page_addr[i] != -1;
+        if (req->view.valid[i]) {
+            memcpy(req->view.data[i], qemu_map_ram_ptr(NULL, tb->page_addr[i]),
+                   TARGET_PAGE_SIZE);
+        }
+    }
+
+    req->view.mmu_idx = cpu_mmu_index(cpu->env_ptr, false);
+    QTAILQ_INIT(&req->view.breakpoints);
+    i = 0;
+    QTAILQ_FOREACH(bp, &cpu->breakpoints, entry) {
+        if (bp->pc - req->view.vaddr < 2 * TARGET_PAGE_SIZE) {
+            req->view.bps[i] = *bp;
+            QTAILQ_INSERT_TAIL(&req->view.breakpoints, &req->view.bps[i],
+                               entry);
+            i++;
+        }
+    }
+    tb_bg_snapshot_counts(req, tb);
+
+    qemu_mutex_lock(&tb_bg.queue_lock);
+    if (!tb_bg.started) {
+        tb_bg_start();
+    }
+    QSIMPLEQ_INSERT_TAIL(&tb_bg.queue, req, entry);
+    qemu_cond_signal(&tb_bg.queue_cond);
+    qemu_mutex_unlock(&tb_bg.queue_lock);
+    return true;
+}
+
+/* wait for the translations in progress, and hold new ones */
+static void tb_bg_pause(void)
+{
+    qemu_mutex_lock(&tb_bg.lock);
+    tb_bg.flushing = true;
+    while (tb_bg.active) {
+        qemu_cond_wait(&tb_bg.cond, &tb_bg.lock);
+    }
+    qemu_mutex_unlock(&tb_bg.lock);
+}
+
+static void tb_bg_resume(void)
+{
+    qemu_mutex_lock(&tb_bg.lock);
+    tb_bg.flushing = false;
+    qemu_cond_broadcast(&tb_bg.cond);
+    qemu_mutex_unlock(&tb_bg.lock);
+}
+
+static void tb_bg_init(void)
+{
+    qemu_mutex_init(&tb_bg.lock);
+    qemu_cond_init(&tb_bg.cond);
+    qemu_mutex_init(&tb_bg.queue_lock);
+    qemu_cond_init(&tb_bg.queue_cond);
+    QSIMPLEQ_INIT(&tb_bg.queue);
+}
+#endif /* CONFIG_SOFTMMU */
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -14,9 +14,320 @@
 #include "tcg/tcg.h"
 #include "tcg/tcg-op.h"
 #include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
 #include "exec/gen-icount.h"
 #include "exec/log.h"
 #include "exec/translator.h"
+#include "exec/helper-proto.h"
+#include "exec/helper-gen.h"
+#include "qemu/afl-tcg.h"
+
+afl_tcg_t afl_tcg;
+
+/*
+ * Record compare operands of the insn at pc, for targets providing
+ * an AFL board. Operands are truncated to ot size by the helper.
+ */
+void gen_afl_cmplog(target_ulong pc, TCGv arg0, TCGv arg1, TCGMemOp ot)
+{
+    TCGv_i64 t_pc, v0, v1;
+    TCGv_i32 t_size;
+
+    if (!afl_tcg.cmplog ||
+        pc < afl_tcg.cmplog_start || pc >= afl_tcg.cmplog_end) {
+        return;
+    }
+
+    /* depends on the board configuration, cf. translator_afl_instrumented */
+    tcg_ctx->tb_cache_skip = true;
+
+    t_pc = tcg_const_i64(pc);
+    t_size = tcg_const_i32(1 << (ot & MO_SIZE));
+    v0 = tcg_temp_new_i64();
+    v1 = tcg_temp_new_i64();
+    tcg_gen_extu_tl_i64(v0, arg0);
+    tcg_gen_extu_tl_i64(v1, arg1);
+
+    gen_helper_afl_cmplog(t_pc, v0, v1, t_size);
+
+    tcg_temp_free_i64(v1);
+    tcg_temp_free_i64(v0);
+    tcg_temp_free_i32(t_size);
+    tcg_temp_free_i64(t_pc);
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * AFL edge coverage at TB entry, cf. afl-src/docs/technical_details.txt
+ *
+ *   shared_mem[cur_location ^ prev_location]++;
+ *   prev_location = cur_location >> 1;
+ *
+ * cur_location is derived from the guest pc at translation time.
+ * Nothing is recorded while the vCPU coverage is gated off.
+ */
+static void gen_afl_trace(target_ulong pc)
+{
+    TCGv_ptr prev, bits;
+    TCGv_i32 loc, cnt;
+    TCGLabel *skip;
+    uint32_t cur;
+
+    if (!afl_tcg.trace ||
+        pc < afl_tcg.trace_start || pc >= afl_tcg.trace_end) {
+        return;
+    }
+
+    cur = ((pc >> 4) ^ (pc << 8)) & afl_tcg.trace_mask;
+
+    skip = gen_new_label();
+    loc = tcg_temp_new_i32();
+    tcg_gen_ld8u_i32(loc, cpu_env,
+                     -ENV_OFFSET + offsetof(CPUState, afl_trace_off));
+    tcg_gen_brcondi_i32(TCG_COND_NE, loc, 0, skip);
+
+    prev = tcg_const_ptr(&afl_tcg.prev_loc);
+    tcg_gen_ld_i32(loc, prev, 0);
+    tcg_gen_xori_i32(loc, loc, cur);
+
+    bits = tcg_temp_new_ptr();
+    tcg_gen_ext_i32_ptr(bits, loc);
+    tcg_gen_addi_ptr(bits, bits, (intptr_t)afl_tcg.trace_bits);
+
+    cnt = tcg_temp_new_i32();
+    tcg_gen_ld8u_i32(cnt, bits, 0);
+    tcg_gen_addi_i32(cnt, cnt, 1);
+    tcg_gen_st8_i32(cnt, bits, 0);
+
+    tcg_gen_movi_i32(loc, cur >> 1);
+    tcg_gen_st_i32(loc, prev, 0);
+
+    tcg_temp_free_i32(cnt);
+    tcg_temp_free_ptr(bits);
+    tcg_temp_free_ptr(prev);
+    gen_set_label(skip);
+    tcg_temp_free_i32(loc);
+}
+#endif
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Synchronous board callback, in place of a breakpoint which would
+ * stop the VM and need a single step to resume.
+ */
+static void gen_afl_hook(target_ulong pc)
+{
+    if (unlikely(afl_tcg.hook) && pc == afl_tcg.hook_pc) {
+        tcg_ctx->tb_cache_skip = true;
+        gen_helper_afl_hook();
+    }
+}
+#endif
+
+/*
+ * Cached translations carry no AFL instrumentation: they can't be
+ * used for a guest code range which would now be instrumented.
+ */
+bool translator_afl_instrumented(target_ulong pc, target_ulong size)
+{
+    target_ulong end = pc + size;
+
+    return afl_tcg.tb_ring
+        || (afl_tcg.trace &&
+            pc >= afl_tcg.trace_start && pc < afl_tcg.trace_end)
+        || (afl_tcg.cmplog &&
+            pc < afl_tcg.cmplog_end && end > afl_tcg.cmplog_start)
+        || (afl_tcg.hook &&
+            afl_tcg.hook_pc >= pc && afl_tcg.hook_pc < end);
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Crash records: ring of the last TBs executed by the vCPU, in
+ * CPUState so that vCPUs never share it
+ *
+ *   cpu->afl_tb_ring_idx = (cpu->afl_tb_ring_idx + 1) % AFL_TB_RING;
+ *   cpu->afl_tb_ring_pc[cpu->afl_tb_ring_idx] = pc;
+ */
+static void gen_afl_tb_ring(target_ulong pc)
+{
+    TCGv_ptr slot;
+    TCGv_i32 idx;
+    TCGv_i64 t_pc;
+
+    if (!afl_tcg.tb_ring) {
+        return;
+    }
+
+    idx = tcg_temp_new_i32();
+    tcg_gen_ld_i32(idx, cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, afl_tb_ring_idx));
+    tcg_gen_addi_i32(idx, idx, 1);
+    tcg_gen_andi_i32(idx, idx, AFL_TB_RING - 1);
+    tcg_gen_st_i32(idx, cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, afl_tb_ring_idx));
+
+    tcg_gen_shli_i32(idx, idx, 3);
+    slot = tcg_temp_new_ptr();
+    tcg_gen_ext_i32_ptr(slot, idx);
+    tcg_gen_add_ptr(slot, slot, cpu_env);
+
+    t_pc = tcg_const_i64(pc);
+    tcg_gen_st_i64(t_pc, slot,
+                   -ENV_OFFSET + offsetof(CPUState, afl_tb_ring_pc));
+
+    tcg_temp_free_i64(t_pc);
+    tcg_temp_free_ptr(slot);
+    tcg_temp_free_i32(idx);
+}
+#endif
+
+/*
+ * Superblocks: TB executions are counted at TB entry, and a TB
+ * reaching tb_trace_threshold is retranslated with CF_TRACE.
+ * Translation then follows the hot direct jumps of each block, as long
+ * as they go forward within the first page, so that the TB page
+ * tracking covers the superblock. A jump back to the superblock entry
+ * branches to its start, ahead of the exit request check, so a hot
+ * loop stays within the superblock. Other jumps are side exits.
+ *
+ * A followed block is joined in straight line code: the code emitted
+ * for the rest of the insn after the branch to it, the side exit of a
+ * conditional jump, is moved after the end of the TB. Conditional
+ * branches keep the globals in host registers on their fall through
+ * path, so the globals are not reloaded between the blocks of the hot
+ * path; they are only spilled at the loop back edge and at the side
+ * exits left in place, which need the search data of their insn.
+ */
+#define TRACE_MAX_BLOCKS 16
+
+/* side exits, emitted after the end of the superblock */
+typedef QTAILQ_HEAD(, TCGOp) TraceColdOps;
+
+static bool translator_trace_counted(const TranslatorOps *ops,
+                                     TranslationBlock *tb)
+{
+    /* AFL instrumentation is per block */
+    return tb_trace_threshold && ops->superblock &&
+        !(tb_cflags(tb) & (CF_TRACE | CF_NOCACHE | CF_USE_ICOUNT |
+                           CF_COUNT_MASK)) &&
+        !afl_tcg.trace && !afl_tcg.tb_ring;
+}
+
+/*
+ *   if (++tb->trace_count == tb_trace_threshold)
+ *       helper_trace_hot(tb);
+ */
+static void gen_trace_count(TranslationBlock *tb)
+{
+    TCGv_ptr p_tb;
+    TCGv_i32 cnt;
+    TCGLabel *cold = gen_new_label();
+
+    p_tb = tcg_const_ptr(tb);
+    cnt = tcg_temp_new_i32();
+    tcg_gen_ld_i32(cnt, p_tb, offsetof(TranslationBlock, trace_count));
+    tcg_gen_addi_i32(cnt, cnt, 1);
+    tcg_gen_st_i32(cnt, p_tb, offsetof(TranslationBlock, trace_count));
+    tcg_gen_brcondi_i32(TCG_COND_NE, cnt, tb_trace_threshold, cold);
+    gen_helper_trace_hot(p_tb);
+    gen_set_label(cold);
+
+    tcg_temp_free_i32(cnt);
+    tcg_temp_free_ptr(p_tb);
+}
+
+static bool translator_trace_follows(DisasContextBase *db, target_ulong dest,
+                                     uint32_t *count)
+{
+    if (!(tb_cflags(db->tb) & CF_TRACE) || db->trace_label ||
+        db->trace_blocks == TRACE_MAX_BLOCKS || dest <= db->pc_next ||
+        (dest & TARGET_PAGE_MASK) != (db->pc_first & TARGET_PAGE_MASK)) {
+        return false;
+    }
+
+    /* hot if entered at least half as often as the current block */
+    return tb_trace_count(tcg_ctx->cpu, db->tb, dest, count) &&
+        (uint64_t)*count * 2 >= db->trace_count;
+}
+
+bool translator_trace_hot(DisasContextBase *db, target_ulong dest)
+{
+    uint32_t count;
+
+    return translator_trace_follows(db, dest, &count);
+}
+
+bool translator_trace_goto(DisasContextBase *db, target_ulong dest)
+{
+    uint32_t count;
+
+    if (!(tb_cflags(db->tb) & CF_TRACE)) {
+        return false;
+    }
+
+    /* loop back edge */
+    if (dest == db->pc_first && db->trace_entry) {
+        tcg_gen_br(db->trace_entry);
+        return true;
+    }
+
+    if (!translator_trace_follows(db, dest, &count)) {
+        return false;
+    }
+
+    db->trace_count = count;
+    db->trace_next = dest;
+    db->trace_blocks++;
+    db->trace_label = gen_new_label();
+    tcg_gen_br(db->trace_label);
+    db->trace_br = QTAILQ_LAST(&tcg_ctx->ops);
+    return true;
+}
+
+/*
+ * Continue the superblock at its next block without a label. The ops
+ * emitted after the branch to the block are moved to @cold, and the
+ * branch is dropped. They must end the TB, and not contain anything
+ * that may unwind to their insn, which would no longer be found from
+ * the host pc.
+ */
+static bool translator_trace_join(DisasContextBase *db, TraceColdOps *cold)
+{
+    TCGOp *op, *next, *last = QTAILQ_LAST(&tcg_ctx->ops);
+
+    /* nothing else may branch to the block */
+    if (db->trace_label->refs != 1) {
+        return false;
+    }
+    if (last != db->trace_br && last->opc != INDEX_op_exit_tb &&
+        last->opc != INDEX_op_goto_ptr && last->opc != INDEX_op_br) {
+        return false;
+    }
+    for (op = QTAILQ_NEXT(db->trace_br, link); op;
+         op = QTAILQ_NEXT(op, link)) {
+        if (op->opc == INDEX_op_call ||
+            (tcg_op_defs[op->opc].flags & TCG_OPF_CALL_CLOBBER)) {
+            return false;
+        }
+    }
+
+    for (op = QTAILQ_NEXT(db->trace_br, link); op; op = next) {
+        next = QTAILQ_NEXT(op, link);
+        QTAILQ_REMOVE(&tcg_ctx->ops, op, link);
+        QTAILQ_INSERT_TAIL(cold, op, link);
+    }
+    tcg_op_remove(tcg_ctx, db->trace_br);
+    return true;
+}
+
+int translator_goto_tb_slot(DisasContextBase *db, int n)
+{
+    if (!(tb_cflags(db->tb) & CF_TRACE)) {
+        return n;
+    }
+    return db->trace_slots <= TB_EXIT_IDXMAX ? db->trace_slots++ : -1;
+}
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -35,6 +346,10 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns)
 {
     int bp_insn = 0;
+    target_ulong pc_end;
+    CPUBreakpoint *bp_first;
+    TraceColdOps trace_cold = QTAILQ_HEAD_INITIALIZER(trace_cold);
+    TCGOp *op, *op_next;
 
     /* Initialize DisasContext */
     db->tb = tb;
@@ -43,7 +358,24 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->is_jmp = DISAS_NEXT;
     db->num_insns = 0;
     db->max_insns = max_insns;
-    db->singlestep_enabled = cpu->singlestep_enabled;
+#ifndef CONFIG_USER_ONLY
+    if (tb_code_view) {
+        /* background translation: never queued while single stepping */
+        db->singlestep_enabled = 0;
+        bp_first = QTAILQ_FIRST(&tb_code_view->breakpoints);
+    } else
+#endif
+    {
+        db->singlestep_enabled = cpu->singlestep_enabled;
+        bp_first = QTAILQ_FIRST(&cpu->breakpoints);
+    }
+    db->trace_count = tb_trace_threshold;
+    db->trace_label = NULL;
+    db->trace_br = NULL;
+    db->trace_entry = NULL;
+    db->trace_blocks = 0;
+    db->trace_slots = 0;
+    pc_end = db->pc_first;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -52,7 +384,18 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     tcg_clear_temp_count();
 
     /* Start translating.  */
+    if ((tb_cflags(tb) & (CF_TRACE | CF_USE_ICOUNT)) == CF_TRACE) {
+        db->trace_entry = gen_new_label();
+        gen_set_label(db->trace_entry);
+    }
     gen_tb_start(db->tb);
+#ifndef CONFIG_USER_ONLY
+    gen_afl_trace(db->pc_first);
+    gen_afl_tb_ring(db->pc_first);
+#endif
+    if (translator_trace_counted(ops, tb)) {
+        gen_trace_count(tb);
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -62,10 +405,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
         /* Pass breakpoint hits to target for further processing */
-        if (!db->singlestep_enabled
-            && unlikely(!QTAILQ_EMPTY(&cpu->breakpoints))) {
+        if (!db->singlestep_enabled && unlikely(bp_first)) {
             CPUBreakpoint *bp;
-            QTAILQ_FOREACH(bp, &cpu->breakpoints, entry) {
+            for (bp = bp_first; bp; bp = QTAILQ_NEXT(bp, entry)) {
                 if (bp->pc == db->pc_next) {
                     if (ops->breakpoint_check(db, cpu, bp)) {
                         bp_insn = 1;
@@ -82,6 +424,10 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             }
         }
 
+#ifndef CONFIG_USER_ONLY
+        gen_afl_hook(db->pc_next);
+#endif
+
         /* Disassemble one instruction.  The translate_insn hook should
            update db->pc_next and db->is_jmp to indicate what should be
            done next -- either exiting this loop or locate the start of
@@ -96,6 +442,17 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             ops->translate_insn(db, cpu);
         }
 
+        /* Continue with the next block of the hot path.  */
+        pc_end = MAX(pc_end, db->pc_next);
+        if (db->trace_label) {
+            if (!translator_trace_join(db, &trace_cold)) {
+                gen_set_label(db->trace_label);
+            }
+            db->trace_label = NULL;
+            db->pc_next = db->trace_next;
+            db->is_jmp = DISAS_NEXT;
+        }
+
         /* Stop translation if translate_insn so indicated.  */
         if (db->is_jmp != DISAS_NEXT) {
             break;
@@ -113,8 +470,13 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     ops->tb_stop(db, cpu);
     gen_tb_end(db->tb, db->num_insns - bp_insn);
 
+    QTAILQ_FOREACH_SAFE(op, &trace_cold, link, op_next) {
+        QTAILQ_REMOVE(&trace_cold, op, link);
+        QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+    }
+
     /* The disas_log hook may use these values rather than recompute.  */
-    db->tb->size = db->pc_next - db->pc_first;
+    db->tb->size = MAX(pc_end, db->pc_next) - db->pc_first;
     db->tb->icount = db->num_insns;
 
 #ifdef DEBUG_DISAS
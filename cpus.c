@@ -54,6 +54,7 @@
 #include "hw/nmi.h"
 #include "sysemu/replay.h"
 #include "hw/boards.h"
+#include "qemu/afl-tcg.h"
 
 #ifdef CONFIG_LINUX
 
@@ -230,6 +231,30 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+    /* before tb-cache, whose translations depend on it */
+    tcg_pin_globals = qemu_opt_get_bool(opts, "pin-globals", false);
+
+    t = qemu_opt_get(opts, "tb-cache");
+    if (t) {
+        tb_cache_init(t, errp);
+    }
+
+    tb_trace_threshold = qemu_opt_get_number(opts, "superblock-threshold", 0);
+
+    tb_bg_threads = qemu_opt_get_number(opts, "translate-threads", 0);
+    if (tb_bg_threads > TCG_MAX_BG_THREADS) {
+        error_setg(errp, "translate-threads must be at most %d",
+                   TCG_MAX_BG_THREADS);
+        tb_bg_threads = 0;
+    }
+
+    if (qemu_opt_get_bool(opts, "perfmap", false)) {
+        perf_enable_perfmap(errp);
+    }
+    if (qemu_opt_get_bool(opts, "jitdump", false)) {
+        perf_enable_jitdump(errp);
+    }
 }
 
 /* The current number of executed instructions is based on what we
@@ -251,6 +276,12 @@ static void cpu_update_icount_locked(CPUState *cpu)
     int64_t executed = cpu_get_icount_executed(cpu);
     cpu->icount_budget -= executed;
 
+#ifdef CONFIG_TCG
+    if (afl_tcg.budget_on) {
+        afl_tcg.budget -= executed;
+    }
+#endif
+
     atomic_set_i64(&timers_state.qemu_icount,
                    timers_state.qemu_icount + executed);
 }
@@ -1390,6 +1421,13 @@ static void prepare_icount_for_run(CPUState *cpu)
         g_assert(cpu->icount_extra == 0);
 
         cpu->icount_budget = tcg_get_icount_limit();
+#ifdef CONFIG_TCG
+        /* never run past the AFL test case instruction budget */
+        if (afl_tcg.budget_on) {
+            cpu->icount_budget = MIN(cpu->icount_budget,
+                                     MAX(afl_tcg.budget, 0));
+        }
+#endif
         insns_left = MIN(0xffff, cpu->icount_budget);
         cpu->icount_decr.u16.low = insns_left;
         cpu->icount_extra = cpu->icount_budget - insns_left;
@@ -297,6 +297,24 @@ STEXI
 Show dynamic compiler info.
 ETEXI
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tlb-stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show software TLB statistics",
+        .cmd        = hmp_info_tlb_stats,
+    },
+#endif
+
+STEXI
+@item info tlb-stats
+@findex info tlb-stats
+Show, for each CPU and MMU index, the lookups that missed the inline TLB
+fast path, how many of them hit in the victim TLB and in the
+second-level TLB, and the TLB fills (page table walks).
+ETEXI
+
 #if defined(CONFIG_TCG)
     {
         .name       = "opcount",
@@ -932,6 +950,22 @@ STEXI
 Show SEV information.
 ETEXI
 
+#if defined(TARGET_I386) || defined(TARGET_PPC) || defined(TARGET_PPC64)
+    {
+        .name       = "gustave",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show GUSTAVE fuzzing board statistics",
+        .cmd        = hmp_info_gustave,
+    },
+#endif
+
+STEXI
+@item info gustave
+@findex info gustave
+Show GUSTAVE fuzzing board per phase timings and histograms.
+ETEXI
+
 STEXI
 @end table
 ETEXI
@@ -38,35 +38,69 @@ static void afl_init_ram(afl_t *afl, MachineState *mcs, MemoryRegion *sysmem)
    }
 }
 
-static void afl_init_fuzz(afl_t *afl)
+#ifdef AFL_CONTACT
+/* AFL SHM identifier given by environment variable 'env' */
+static int afl_shm_id(const char *env)
 {
-#ifndef AFL_CONTACT
-   afl->trace_bits = mmap(NULL, afl->config.afl.trace_size,
-                          PROT_READ|PROT_WRITE,
-                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-   if (afl->trace_bits == MAP_FAILED) {
-      error_report("AFL trace bits mmap() failed");
-      exit(EXIT_FAILURE);
-   }
-#else
-   char *env = getenv(afl->config.afl.trace_env);
-   if (!env) {
-      error_report("can't get AFL SHM env: '%s'", afl->config.afl.trace_env);
+   char *val = getenv(env);
+   int   id;
+
+   if (!val) {
+      error_report("can't get AFL SHM env: '%s'", env);
       exit(EXIT_FAILURE);
    }
 
-   afl->shm_id = strtol(env, NULL, 10);
-   if (afl->shm_id < 0) {
+   id = strtol(val, NULL, 10);
+   if (id < 0) {
       error_report("can't get AFL SHM id");
       exit(EXIT_FAILURE);
    }
 
-   afl->trace_bits = shmat(afl->shm_id, NULL, 0);
-   if (afl->trace_bits == (void*)-1) {
+   return id;
+}
+#endif
+
+/*
+ * Get a buffer shared with AFL, whose SHM identifier is given by
+ * environment variable 'env'.
+ */
+static void* afl_shm_attach(const char *env, size_t size)
+{
+   void *ptr;
+#ifndef AFL_CONTACT
+   ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (ptr == MAP_FAILED) {
+      error_report("AFL '%s' mmap() failed", env);
+      exit(EXIT_FAILURE);
+   }
+#else
+   ptr = shmat(afl_shm_id(env), NULL, 0);
+   if (ptr == (void*)-1) {
       error_report("AFL SHM attach failed");
       exit(EXIT_FAILURE);
    }
 #endif
+   return ptr;
+}
+
+static void afl_init_fuzz(afl_t *afl)
+{
+   afl->trace_bits = afl_shm_attach(afl->config.afl.trace_env,
+                                    afl->config.afl.trace_size);
+#ifdef AFL_TRACE_CMPLOG
+   afl->cmp_map = afl_shm_attach(afl->config.afl.cmplog_env,
+                                 sizeof(afl_cmp_map_t));
+#endif
+#ifdef AFL_BATCH
+   afl->batch = afl_shm_attach(afl->config.afl.testcase_env,
+                               afl_batch_size(afl));
+#elif defined(AFL_SHM_TESTCASE)
+   afl->testcase = afl_shm_attach(afl->config.afl.testcase_env,
+                                  sizeof(afl_testcase_t) +
+                                  afl->config.afl.testcase_size);
+#endif
+
    afl->euid = geteuid();
    afl->pid  = getpid();
    afl->ppid = getppid();
@@ -78,11 +112,31 @@ static void afl_init_fuzz(afl_t *afl)
                                   afl_user_timeout_cb, afl);
 }
 
+/*
+ * Deterministic time out: each test case may run a fixed number of
+ * instructions, counted by TCG icount.
+ */
+#ifdef AFL_INSN_BUDGET
+static void afl_init_insn_budget(afl_t *afl)
+{
+   if (kvm_enabled() || !use_icount) {
+      error_report("AFL instruction budget needs TCG with -icount");
+      exit(EXIT_FAILURE);
+   }
+
+   debug("instruction budget %lu\n", afl->config.qemu.insn_budget);
+}
+#endif
+
 static void afl_init_vm(afl_t *afl)
 {
+#ifdef AFL_MEMORY_VMSTATE
+   afl_vmb_init(&afl->vms, 0);
+#else
    strncpy(afl->vms_path, afl->config.qemu.vms_tpl, sizeof(afl->vms_path));
    afl->vms_path[sizeof(afl->vms_path) - 1] = 0;
    afl->vms_fd = mkstemp(afl->vms_path);
+#endif
 }
 
 /*
@@ -103,7 +157,7 @@ static void afl_init_cpu(afl_t *afl, MachineState *mcs)
 
 #ifdef AFL_CONTROL_CSWITCH
    debug("%s: ctxt switch 0x"TARGET_FMT_lx"\n", __func__, afl->config.tgt.cswitch);
-   afl_insert_breakpoint(afl, afl->config.tgt.cswitch);
+   afl_init_cswitch(afl);
 #endif
 
    qemu_add_vm_change_state_handler(afl_vm_state_change, (void*)afl);
@@ -115,8 +169,30 @@ void afl_cleanup(afl_t *afl)
    if (afl->user_timer)
       timer_del(afl->user_timer);
 
+#ifdef AFL_MEMORY_VMSTATE
+   afl_vmb_cleanup(&afl->vms);
+#else
    close(afl->vms_fd);
    unlink(afl->vms_path);
+#endif
+
+#ifdef AFL_DIRTY_RESTORE
+   afl_vmb_cleanup(&afl->dev_vmb);
+#ifdef AFL_SHARED_SNAPSHOT
+   afl_shared_cleanup(afl);
+#else
+   g_free(afl->ram_snap);
+#endif
+#endif
+#ifdef AFL_PERSISTENT
+   g_free(afl->regs_snap);
+#endif
+#ifdef AFL_STANDALONE
+   afl_engine_cleanup(afl);
+#endif
+#ifdef AFL_CRASH_TRIAGE
+   afl_triage_cleanup(afl);
+#endif
    //XXX: unmap(), shmdt() ...
 }
 
@@ -125,12 +201,36 @@ void afl_init(afl_t *afl, MachineState *mcs)
    MemoryRegion *sysmem = get_system_memory();
 
    afl_init_conf(afl);
+#ifdef AFL_STATS
+   afl_stats_init();
+#endif
    afl_init_arch(afl, mcs, sysmem);
    afl_init_cpu(afl, mcs);
    afl_init_ram(afl, mcs, sysmem);
    afl_init_vm(afl);
    afl_init_fuzz(afl);
+#ifdef AFL_INSN_BUDGET
+   afl_init_insn_budget(afl);
+#endif
+#ifdef AFL_STANDALONE
+   afl_init_engine(afl);
+#endif
    afl_init_trace_mem(afl);
+#ifdef AFL_KVM_DOORBELL
+   afl_init_doorbell(afl);
+#endif
+#ifdef AFL_SHARED_SNAPSHOT
+   afl_init_shared(afl);
+#endif
+#ifdef AFL_TRACE_TCG
+   afl_init_trace_tcg(afl);
+#endif
+#ifdef AFL_TRACE_CMPLOG
+   afl_init_cmplog(afl);
+#endif
+#ifdef AFL_CRASH_TRIAGE
+   afl_init_triage(afl);
+#endif
 
    debug("board ready\n");
 }
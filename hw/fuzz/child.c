@@ -53,3 +53,85 @@ void afl_forward_child(afl_t *afl)
    }
 }
 #endif
+
+/*
+ * Batched protocol. A single control read releases 'count' test
+ * cases from the shared ring and a single fake pid is given for the
+ * batch. The board runs them back to back, restoring the VM in
+ * between, and stores each status in the ring. The coverage of
+ * each test case is moved from trace_bits to the map of its slot,
+ * leaving trace_bits clear for the next one: the fuzzer must read
+ * coverage per slot, not from trace_bits. Once the batch is over,
+ * the number of test cases run is written in place of a status.
+ */
+#ifdef AFL_BATCH
+#define afl_batch_hdr_size(afl)                                         \
+   QEMU_ALIGN_UP(sizeof(afl_batch_t) +                                  \
+                 (afl)->config.afl.batch_count*sizeof(uint32_t), 8)
+
+#define afl_batch_case_size(afl)                                        \
+   QEMU_ALIGN_UP(sizeof(afl_testcase_t) + (afl)->config.afl.testcase_size, 8)
+
+#define afl_batch_slot_size(afl)                                        \
+   QEMU_ALIGN_UP(afl_batch_case_size(afl) + (afl)->config.afl.trace_size, 8)
+
+size_t afl_batch_size(afl_t *afl)
+{
+   return afl_batch_hdr_size(afl) +
+      afl->config.afl.batch_count*afl_batch_slot_size(afl);
+}
+
+bool afl_batch_pending(afl_t *afl)
+{
+   return afl->batch_idx < afl->batch_cnt;
+}
+
+afl_testcase_t* afl_batch_case(afl_t *afl)
+{
+   return (afl_testcase_t*)((uint8_t*)afl->batch + afl_batch_hdr_size(afl) +
+                            afl->batch_idx*afl_batch_slot_size(afl));
+}
+
+static void afl_batch_done(afl_t *afl)
+{
+   debug("batch done (%u)\n", afl->batch_cnt);
+   if (write(afl->config.afl.sts_fd, &afl->batch_cnt, 4) != 4) {
+      error_report("can't write batch status to afl");
+      exit(EXIT_FAILURE);
+   }
+}
+
+void afl_batch_start(afl_t *afl)
+{
+   afl->batch_idx = 0;
+   afl->batch_cnt = MIN(afl->batch->count, afl->config.afl.batch_count);
+
+   debug("batch of %u test cases\n", afl->batch_cnt);
+
+   if (!afl->batch_cnt) {
+      afl_batch_done(afl);
+      return;
+   }
+
+#ifdef AFL_CONTACT
+   afl_forward_child(afl);
+#endif
+}
+
+static void afl_batch_trace(afl_t *afl)
+{
+   uint8_t *map = (uint8_t*)afl_batch_case(afl) + afl_batch_case_size(afl);
+
+   memcpy(map, afl->trace_bits, afl->config.afl.trace_size);
+   memset(afl->trace_bits, 0, afl->config.afl.trace_size);
+}
+
+void afl_batch_status(afl_t *afl)
+{
+   afl_batch_trace(afl);
+   afl->batch->status[afl->batch_idx++] = afl->status;
+   if (afl->batch_idx == afl->batch_cnt) {
+      afl_batch_done(afl);
+   }
+}
+#endif
@@ -86,17 +86,63 @@ static void afl_map_obj_conf(afl_t *afl, QDict *json)
                      QTYPE_QNUM, QNum, qnum_get_int);
    __afl_obj_to_conf(afl->config.qemu.vms_tpl, json,"vm-state-template",
                      QTYPE_QSTRING, QString, qstring_get_str);
+#ifdef AFL_INSN_BUDGET
+   __afl_obj_to_conf(afl->config.qemu.insn_budget, json,"insn-budget",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
+#ifdef AFL_SHARED_SNAPSHOT
+   __afl_obj_to_conf(afl->config.qemu.shared_path, json,"vm-shared-snapshot",
+                     QTYPE_QSTRING, QString, qstring_get_str);
+#endif
+#ifdef AFL_CRASH_TRIAGE
+   __afl_obj_to_conf(afl->config.qemu.crash_dir, json,"vm-crash-dir",
+                     QTYPE_QSTRING, QString, qstring_get_str);
+#endif
 
+#ifdef AFL_CONTACT
    __afl_obj_to_conf(afl->config.afl.ctl_fd, json,"afl-control-fd",
                      QTYPE_QNUM, QNum, qnum_get_int);
    __afl_obj_to_conf(afl->config.afl.sts_fd, json,"afl-status-fd",
                      QTYPE_QNUM, QNum, qnum_get_int);
+#endif
    __afl_obj_to_conf(afl->config.afl.trace_size, json,"afl-trace-size",
                      QTYPE_QNUM, QNum, qnum_get_uint);
    __afl_obj_to_conf(afl->config.afl.trace_addr, json,"afl-trace-addr",
                      QTYPE_QNUM, QNum, qnum_get_uint);
    __afl_obj_to_conf(afl->config.afl.trace_env, json,"afl-trace-env",
                      QTYPE_QSTRING, QString, qstring_get_str);
+#ifdef AFL_SHM_TESTCASE
+   __afl_obj_to_conf(afl->config.afl.testcase_env, json,"afl-testcase-env",
+                     QTYPE_QSTRING, QString, qstring_get_str);
+   __afl_obj_to_conf(afl->config.afl.testcase_size, json,"afl-testcase-size",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
+#ifdef AFL_BATCH
+   __afl_obj_to_conf(afl->config.afl.batch_count, json,"afl-batch-count",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
+#ifdef AFL_STANDALONE
+   __afl_obj_to_conf(afl->config.afl.fuzz_in, json,"fuzz-input-dir",
+                     QTYPE_QSTRING, QString, qstring_get_str);
+   __afl_obj_to_conf(afl->config.afl.fuzz_out, json,"fuzz-output-dir",
+                     QTYPE_QSTRING, QString, qstring_get_str);
+   __afl_obj_to_conf(afl->config.afl.fuzz_seed, json,"fuzz-seed",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
+#ifdef AFL_TRACE_TCG
+   __afl_obj_to_conf(afl->config.afl.tcg_start, json,"afl-tcg-trace-start",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+   __afl_obj_to_conf(afl->config.afl.tcg_end, json,"afl-tcg-trace-end",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
+#ifdef AFL_TRACE_CMPLOG
+   __afl_obj_to_conf(afl->config.afl.cmplog_env, json,"afl-cmplog-env",
+                     QTYPE_QSTRING, QString, qstring_get_str);
+   __afl_obj_to_conf(afl->config.afl.cmplog_start, json,"afl-cmplog-start",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+   __afl_obj_to_conf(afl->config.afl.cmplog_end, json,"afl-cmplog-end",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
    __afl_obj_to_conf(afl->config.tgt.part_base, json,"vm-part-base",
                      QTYPE_QNUM, QNum, qnum_get_uint);
    __afl_obj_to_conf(afl->config.tgt.part_size, json,"vm-part-size",
@@ -123,6 +169,14 @@ static void afl_map_obj_conf(afl_t *afl, QDict *json)
                      QTYPE_QNUM, QNum, qnum_get_uint);
    __afl_obj_to_conf(afl->config.tgt.cswitch_next, json,"vm-cswitch-next",
                      QTYPE_QNUM, QNum, qnum_get_uint);
+#ifdef AFL_PERSISTENT
+   __afl_obj_to_conf(afl->config.tgt.persistent_iter, json,"vm-persistent-iter",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
+#ifdef AFL_KVM_DOORBELL
+   __afl_obj_to_conf(afl->config.tgt.doorbell, json,"vm-doorbell-addr",
+                     QTYPE_QNUM, QNum, qnum_get_uint);
+#endif
 }
 
 void afl_init_conf(afl_t *afl)
@@ -143,6 +197,9 @@ void afl_init_conf(afl_t *afl)
    }
 
    afl_map_obj_conf(afl, json);
+#ifdef AFL_GEN_TABLE
+   afl_init_gen(afl, json);
+#endif
 
    /* XXX: should unref object, but copy retrieved strings first */
    /* qobject_unref(json); */
@@ -107,6 +107,12 @@ static void afl_trace_write(void *opaque, hwaddr addr,
       return;
    }
 
+#ifdef AFL_CONTROL_CSWITCH
+   if (current_cpu && current_cpu->afl_trace_off) {
+      return;
+   }
+#endif
+
    debug("%p w %d\n", &ptr[addr], (uint8_t)data);
    ptr[addr] = data & 0xff;
 
@@ -163,33 +169,9 @@ void afl_init_trace_mem(afl_t *afl)
       &afl->trace_mr, NULL, "afl_trace_bits",
       afl->config.afl.trace_size, afl->trace_bits);
 
-#ifdef AFL_CONTROL_CSWITCH
-   /* fake trace bitmap */
-   afl->fake_bits = mmap(NULL, afl->config.afl.trace_size,
-                         PROT_READ|PROT_WRITE,
-                         MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-
-   if (afl->fake_bits == MAP_FAILED) {
-      error_report("AFL fake bits mmap() failed");
-      exit(EXIT_FAILURE);
-   }
-
-   memory_region_init_ram_ptr(
-      &afl->fake_mr, NULL,
-      "afl_fake_bits", afl->config.afl.trace_size, afl->fake_bits);
-
-   memory_region_add_subregion_overlap(get_system_memory(),
-                                       afl->config.afl.trace_addr,
-                                       &afl->fake_mr, 0);
-
-   memory_region_add_subregion_overlap(get_system_memory(),
-                                       afl->config.afl.trace_addr,
-                                       &afl->trace_mr, 1);
-#else
    memory_region_add_subregion(get_system_memory(),
                                afl->config.afl.trace_addr,
                                &afl->trace_mr);
-#endif
 
    /* debug("AFL trace MR %p ram block %p offset 0x%lx\n", */
    /*       &afl->trace_mr, */
@@ -198,3 +180,71 @@ void afl_init_trace_mem(afl_t *afl)
    /*    ); */
 }
 #endif
+
+/*
+ * Partition filtered coverage. The vCPU flag is checked by the
+ * trace write paths (MMIO handler and TCG edge coverage), the trace
+ * bitmap mapping is left untouched.
+ */
+#ifdef AFL_CONTROL_CSWITCH
+void afl_trace_gate(afl_t *afl, bool on)
+{
+   CPU(afl->arch.cpu)->afl_trace_off = !on;
+}
+#endif
+
+/*
+ * Edge coverage emitted by TCG at TB entry, for targets which
+ * can't be built to write into the trace bitmap themselves.
+ */
+#ifdef AFL_TRACE_TCG
+void afl_init_trace_tcg(afl_t *afl)
+{
+   size_t size = afl->config.afl.trace_size;
+
+   if (!size || (size & (size - 1))) {
+      error_report("AFL trace map size must be a power of 2");
+      exit(EXIT_FAILURE);
+   }
+
+   if (kvm_enabled()) {
+      error_report("AFL TCG trace not available with KVM");
+      exit(EXIT_FAILURE);
+   }
+
+   afl_tcg.trace_bits  = afl->trace_bits;
+   afl_tcg.trace_mask  = size - 1;
+   afl_tcg.trace_start = afl->config.afl.tcg_start;
+   afl_tcg.trace_end   = afl->config.afl.tcg_end;
+   afl_tcg.prev_loc    = 0;
+   afl_tcg.trace       = true;
+
+   debug("TCG trace 0x"TARGET_FMT_lx" - 0x"TARGET_FMT_lx"\n",
+         afl->config.afl.tcg_start, afl->config.afl.tcg_end);
+}
+#endif
+
+/*
+ * Compare operands logging (cmp/sub/test on x86, cmpw/cmplw on
+ * PowerPC) for input-to-state replacement by the fuzzer.
+ */
+#ifdef AFL_TRACE_CMPLOG
+void afl_init_cmplog(afl_t *afl)
+{
+   if (kvm_enabled()) {
+      error_report("AFL compare log not available with KVM");
+      exit(EXIT_FAILURE);
+   }
+
+   memset(afl->cmp_map->headers, 0, sizeof(afl->cmp_map->headers));
+
+   afl_tcg.cmp_map      = afl->cmp_map;
+   afl_tcg.cmplog_start = afl->config.afl.cmplog_start;
+   afl_tcg.cmplog_end   = afl->config.afl.cmplog_end;
+   afl_tcg.cmplog       = true;
+
+   debug("compare log %p 0x"TARGET_FMT_lx" - 0x"TARGET_FMT_lx"\n",
+         afl->cmp_map, afl->config.afl.cmplog_start,
+         afl->config.afl.cmplog_end);
+}
+#endif
@@ -0,0 +1,410 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * built-in fuzz loop
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+#include "qemu/afl.h"
+
+#ifdef AFL_STANDALONE
+/*
+ * Standalone fuzzing, without any AFL parent process. Test cases are
+ * generated in place of reading the control pipe, and the status is
+ * analysed in place of writing it to the status pipe:
+ *
+ *  - the initial corpus is run once as is (dry run)
+ *  - then each queue entry gets a number of havoc rounds, sometimes
+ *    spliced with another entry
+ *  - hit counts are bucketed and compared to the virgin maps as done
+ *    by afl-fuzz, 8 bytes at a time
+ *  - inputs with new coverage are added to the queue and saved under
+ *    <fuzz-output-dir>/queue, crashes under <fuzz-output-dir>/crashes
+ *
+ * Time outs are counted but never saved.
+ */
+#define AFL_ENGINE_ROUNDS   256  /* havoc rounds per queue entry */
+#define AFL_ENGINE_STACK    7    /* at most 2^7 stacked mutations */
+#define AFL_ENGINE_SPLICE   16   /* 1/16 rounds splice */
+#define AFL_ENGINE_BLOCK    32   /* max block operations length */
+#define AFL_ENGINE_ARITH    35   /* max arithmetic delta */
+
+static const int8_t  interesting_8[]  = { -128, -1, 0, 1, 16, 32, 64, 100,
+                                          127 };
+static const int16_t interesting_16[] = { -32768, -129, 128, 255, 256, 512,
+                                          1000, 1024, 4096, 32767 };
+static const int32_t interesting_32[] = { INT32_MIN, -100663046, -32769,
+                                          32768, 65535, 65536, 100663045,
+                                          INT32_MAX };
+
+static uint16_t count_class16[65536];
+
+static void afl_engine_init_classes(void)
+{
+   static const uint8_t lookup8[256] = {
+      [0]          = 0,   [1]          = 1,  [2]         = 2,
+      [3]          = 4,   [4 ... 7]    = 8,  [8 ... 15]  = 16,
+      [16 ... 31]  = 32,  [32 ... 127] = 64, [128 ... 255] = 128,
+   };
+   uint32_t b1, b2;
+
+   for (b1 = 0 ; b1 < 256 ; b1++) {
+      for (b2 = 0 ; b2 < 256 ; b2++) {
+         count_class16[(b1 << 8) + b2] = (lookup8[b1] << 8) | lookup8[b2];
+      }
+   }
+}
+
+/* bucket hit counts, zero words are skipped */
+static void afl_engine_classify(afl_t *afl)
+{
+   uint64_t *cur = (uint64_t*)afl->trace_bits;
+   size_t    i, n = afl->config.afl.trace_size / 8;
+
+   for (i = 0 ; i < n ; i++) {
+      uint16_t *w;
+
+      if (likely(!cur[i])) {
+         continue;
+      }
+
+      w = (uint16_t*)&cur[i];
+      w[0] = count_class16[w[0]];
+      w[1] = count_class16[w[1]];
+      w[2] = count_class16[w[2]];
+      w[3] = count_class16[w[3]];
+   }
+}
+
+/* 2 for new tuples, 1 for new hit counts only, 0 otherwise */
+static int afl_engine_new_bits(afl_t *afl, uint8_t *virgin_map)
+{
+   uint64_t *cur    = (uint64_t*)afl->trace_bits;
+   uint64_t *virgin = (uint64_t*)virgin_map;
+   size_t    i, j, n = afl->config.afl.trace_size / 8;
+   int       ret = 0;
+
+   for (i = 0 ; i < n ; i++) {
+      if (likely(!(cur[i] & virgin[i]))) {
+         continue;
+      }
+
+      if (ret < 2) {
+         uint8_t *c = (uint8_t*)&cur[i];
+         uint8_t *v = (uint8_t*)&virgin[i];
+
+         ret = 1;
+         for (j = 0 ; j < 8 ; j++) {
+            if (c[j] && v[j] == 0xff) {
+               ret = 2;
+               break;
+            }
+         }
+      }
+
+      virgin[i] &= ~cur[i];
+   }
+
+   return ret;
+}
+
+static uint32_t afl_engine_rand(afl_t *afl, uint32_t limit)
+{
+   return g_rand_int_range(afl->fuzz.rand, 0, limit);
+}
+
+static void afl_engine_add(afl_t *afl, const uint8_t *data, size_t len)
+{
+   afl_fuzz_entry_t entry = {
+      .data = g_memdup(data, len),
+      .len  = len,
+   };
+
+   g_array_append_val(afl->fuzz.queue, entry);
+}
+
+static void afl_engine_save(afl_t *afl, const char *dir, uint64_t id,
+                            const char *tag)
+{
+   GError *err = NULL;
+   char   *path;
+
+   path = g_strdup_printf("%s/%s/id:%06"PRIu64"%s", afl->config.afl.fuzz_out,
+                          dir, id, tag);
+   if (!g_file_set_contents(path, (const char*)afl->testcase->data,
+                            afl->testcase->len, &err)) {
+      error_report("can't save '%s': %s", path, err->message);
+      exit(EXIT_FAILURE);
+   }
+   g_free(path);
+}
+
+static void afl_engine_load(afl_t *afl)
+{
+   const char *name;
+   GError     *err = NULL;
+   GDir       *dir;
+
+   dir = g_dir_open(afl->config.afl.fuzz_in, 0, &err);
+   if (!dir) {
+      error_report("can't open fuzz input directory: %s", err->message);
+      exit(EXIT_FAILURE);
+   }
+
+   while ((name = g_dir_read_name(dir))) {
+      char  *path = g_build_filename(afl->config.afl.fuzz_in, name, NULL);
+      char  *data;
+      gsize  len;
+
+      if (g_file_test(path, G_FILE_TEST_IS_REGULAR) &&
+          g_file_get_contents(path, &data, &len, NULL)) {
+         if (len) {
+            afl_engine_add(afl, (uint8_t*)data,
+                           MIN(len, afl->config.afl.testcase_size));
+         }
+         g_free(data);
+      }
+      g_free(path);
+   }
+   g_dir_close(dir);
+
+   if (!afl->fuzz.queue->len) {
+      error_report("no test case in fuzz input directory '%s'",
+                   afl->config.afl.fuzz_in);
+      exit(EXIT_FAILURE);
+   }
+
+   afl->fuzz.seeds = afl->fuzz.queue->len;
+   debug("fuzz corpus: %u test cases\n", afl->fuzz.seeds);
+}
+
+void afl_init_engine(afl_t *afl)
+{
+   afl_fuzz_t *fuzz = &afl->fuzz;
+   char       *path;
+
+   if (afl->config.afl.trace_size % 8) {
+      error_report("fuzz engine needs 8 bytes aligned trace size");
+      exit(EXIT_FAILURE);
+   }
+
+   afl_engine_init_classes();
+
+   fuzz->queue        = g_array_new(false, false, sizeof(afl_fuzz_entry_t));
+   fuzz->rand         = g_rand_new_with_seed(afl->config.afl.fuzz_seed);
+   fuzz->virgin       = g_malloc(afl->config.afl.trace_size);
+   fuzz->virgin_crash = g_malloc(afl->config.afl.trace_size);
+   memset(fuzz->virgin, 0xff, afl->config.afl.trace_size);
+   memset(fuzz->virgin_crash, 0xff, afl->config.afl.trace_size);
+
+   path = g_build_filename(afl->config.afl.fuzz_out, "queue", NULL);
+   g_mkdir_with_parents(path, 0700);
+   g_free(path);
+   path = g_build_filename(afl->config.afl.fuzz_out, "crashes", NULL);
+   g_mkdir_with_parents(path, 0700);
+   g_free(path);
+
+   afl_engine_load(afl);
+}
+
+void afl_engine_cleanup(afl_t *afl)
+{
+   afl_fuzz_t *fuzz = &afl->fuzz;
+   uint32_t    i;
+
+   if (!fuzz->queue) {
+      return;
+   }
+
+   debug("fuzz: %"PRIu64" execs, %u paths, %"PRIu64" crashes, "
+         "%"PRIu64" hangs\n", fuzz->execs, fuzz->queue->len,
+         fuzz->crashes, fuzz->hangs);
+
+   for (i = 0 ; i < fuzz->queue->len ; i++) {
+      g_free(g_array_index(fuzz->queue, afl_fuzz_entry_t, i).data);
+   }
+   g_array_free(fuzz->queue, true);
+   g_rand_free(fuzz->rand);
+   g_free(fuzz->virgin);
+   g_free(fuzz->virgin_crash);
+}
+
+/* AFL havoc stage, one round */
+static size_t afl_engine_havoc(afl_t *afl, uint8_t *buf, size_t len)
+{
+   size_t   max = afl->config.afl.testcase_size;
+   uint32_t n   = 1 << (1 + afl_engine_rand(afl, AFL_ENGINE_STACK));
+   uint8_t  tmp[AFL_ENGINE_BLOCK];
+
+   while (n--) {
+      size_t pos = afl_engine_rand(afl, len);
+      size_t blk, from;
+
+      switch (afl_engine_rand(afl, 12)) {
+      case 0:
+         buf[pos] ^= 1 << afl_engine_rand(afl, 8);
+         break;
+      case 1:
+         buf[pos] = interesting_8[afl_engine_rand(afl,
+                                                  ARRAY_SIZE(interesting_8))];
+         break;
+      case 2:
+         if (len >= 2) {
+            pos = afl_engine_rand(afl, len - 1);
+            stw_he_p(buf + pos, interesting_16[
+                        afl_engine_rand(afl, ARRAY_SIZE(interesting_16))]);
+         }
+         break;
+      case 3:
+         if (len >= 4) {
+            pos = afl_engine_rand(afl, len - 3);
+            stl_he_p(buf + pos, interesting_32[
+                        afl_engine_rand(afl, ARRAY_SIZE(interesting_32))]);
+         }
+         break;
+      case 4:
+         buf[pos] -= 1 + afl_engine_rand(afl, AFL_ENGINE_ARITH);
+         break;
+      case 5:
+         buf[pos] += 1 + afl_engine_rand(afl, AFL_ENGINE_ARITH);
+         break;
+      case 6:
+         if (len >= 2) {
+            pos = afl_engine_rand(afl, len - 1);
+            stw_he_p(buf + pos, lduw_he_p(buf + pos) +
+                     1 + afl_engine_rand(afl, AFL_ENGINE_ARITH));
+         }
+         break;
+      case 7:
+         if (len >= 4) {
+            pos = afl_engine_rand(afl, len - 3);
+            stl_he_p(buf + pos, ldl_he_p(buf + pos) -
+                     1 - afl_engine_rand(afl, AFL_ENGINE_ARITH));
+         }
+         break;
+      case 8:
+         buf[pos] ^= 1 + afl_engine_rand(afl, 255);
+         break;
+      case 9:
+         /* delete block */
+         if (len >= 2) {
+            blk = 1 + afl_engine_rand(afl, MIN(len - 1, AFL_ENGINE_BLOCK));
+            pos = afl_engine_rand(afl, len - blk + 1);
+            memmove(buf + pos, buf + pos + blk, len - pos - blk);
+            len -= blk;
+         }
+         break;
+      case 10:
+         /* clone block */
+         if (len < max) {
+            blk  = 1 + afl_engine_rand(afl, MIN(MIN(len, max - len),
+                                                AFL_ENGINE_BLOCK));
+            from = afl_engine_rand(afl, len - blk + 1);
+            pos  = afl_engine_rand(afl, len + 1);
+            memcpy(tmp, buf + from, blk);
+            memmove(buf + pos + blk, buf + pos, len - pos);
+            memcpy(buf + pos, tmp, blk);
+            len += blk;
+         }
+         break;
+      case 11:
+         /* overwrite block */
+         if (len >= 2) {
+            blk  = 1 + afl_engine_rand(afl, MIN(len - 1, AFL_ENGINE_BLOCK));
+            from = afl_engine_rand(afl, len - blk + 1);
+            pos  = afl_engine_rand(afl, len - blk + 1);
+            memmove(buf + pos, buf + from, blk);
+         }
+         break;
+      }
+   }
+
+   return len;
+}
+
+/* head of 'buf' followed by tail of another entry */
+static size_t afl_engine_splice(afl_t *afl, uint8_t *buf, size_t len)
+{
+   afl_fuzz_entry_t *other;
+   size_t            split;
+
+   other = &g_array_index(afl->fuzz.queue, afl_fuzz_entry_t,
+                          afl_engine_rand(afl, afl->fuzz.queue->len));
+   if (MIN(len, other->len) < 2) {
+      return len;
+   }
+
+   split = 1 + afl_engine_rand(afl, MIN(len, other->len) - 1);
+
+   memcpy(buf + split, other->data + split, other->len - split);
+   return other->len;
+}
+
+/*
+ * Next test case, written into afl->testcase. The trace bitmap is
+ * reset as afl-fuzz does before each run.
+ */
+void afl_engine_next(afl_t *afl)
+{
+   afl_fuzz_t       *fuzz = &afl->fuzz;
+   afl_fuzz_entry_t *entry;
+   size_t            len;
+
+   memset(afl->trace_bits, 0, afl->config.afl.trace_size);
+
+   if (fuzz->execs < fuzz->seeds) {
+      entry = &g_array_index(fuzz->queue, afl_fuzz_entry_t, fuzz->execs);
+      memcpy(afl->testcase->data, entry->data, entry->len);
+      afl->testcase->len = entry->len;
+      return;
+   }
+
+   if (!fuzz->rounds) {
+      fuzz->cur    = (fuzz->cur + 1) % fuzz->queue->len;
+      fuzz->rounds = AFL_ENGINE_ROUNDS;
+   }
+   fuzz->rounds--;
+
+   entry = &g_array_index(fuzz->queue, afl_fuzz_entry_t, fuzz->cur);
+   memcpy(afl->testcase->data, entry->data, entry->len);
+   len = entry->len;
+
+   if (fuzz->queue->len > 1 && !afl_engine_rand(afl, AFL_ENGINE_SPLICE)) {
+      len = afl_engine_splice(afl, afl->testcase->data, len);
+   }
+
+   afl->testcase->len = afl_engine_havoc(afl, afl->testcase->data, len);
+}
+
+void afl_engine_status(afl_t *afl)
+{
+   afl_fuzz_t *fuzz = &afl->fuzz;
+   bool        dry  = fuzz->execs++ < fuzz->seeds;
+
+   if (afl->status == sts_kill()) {
+      fuzz->hangs++;
+      return;
+   }
+
+   afl_engine_classify(afl);
+
+   if (WIFSIGNALED(afl->status)) {
+      if (afl_engine_new_bits(afl, fuzz->virgin_crash)) {
+         char tag[16];
+
+         snprintf(tag, sizeof(tag), ",sig:%02d", WTERMSIG(afl->status));
+         afl_engine_save(afl, "crashes", fuzz->crashes++, tag);
+         debug("fuzz: new crash (%"PRIu64")\n", fuzz->crashes);
+      }
+      return;
+   }
+
+   /* initial corpus is already queued */
+   if (afl_engine_new_bits(afl, fuzz->virgin) && !dry) {
+      afl_engine_save(afl, "queue", fuzz->queue->len, "");
+      afl_engine_add(afl, afl->testcase->data, afl->testcase->len);
+      debug("fuzz: new path (%u) after %"PRIu64" execs\n",
+            fuzz->queue->len, fuzz->execs);
+   }
+}
+#endif
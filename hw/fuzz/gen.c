@@ -0,0 +1,168 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * table driven code generator
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+#include "qemu/afl.h"
+
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
+
+#ifdef AFL_GEN_TABLE
+/*
+ * Syscalls are described in the GUSTAVE configuration file:
+ *
+ *  "gen-syscalls": [ { "id": 4, "args": [ 8, 0 ] }, ... ]
+ *
+ * Each argument is either a scalar (0) or a pointer to a memory area
+ * of the given size, filled from the test case. An optional
+ * "enabled": false entry still consumes its input but generates
+ * nothing.
+ *
+ * The test case is a sequence of table index bytes, each followed by
+ * its arguments input. At startup, each syscall is compiled by the
+ * architecture into a code template and a list of holes to be filled
+ * with input bytes. Generation is then a copy of the template and of
+ * its holes per syscall.
+ */
+void afl_gen_emit(afl_gen_syscall_t *sc, const void *code, size_t len)
+{
+   sc->tpl = g_realloc(sc->tpl, sc->tpl_size + len);
+   memcpy(sc->tpl + sc->tpl_size, code, len);
+   sc->tpl_size += len;
+}
+
+void afl_gen_emit_hole(afl_gen_syscall_t *sc, size_t in, size_t len)
+{
+   static const uint8_t zero[8];
+   afl_gen_hole_t *hole;
+
+   assert(len <= sizeof(zero) && in + len <= sc->in_size);
+
+   sc->holes = g_renew(afl_gen_hole_t, sc->holes, sc->nholes + 1);
+   hole = &sc->holes[sc->nholes++];
+   hole->out = sc->tpl_size;
+   hole->in  = in;
+   hole->len = len;
+
+   afl_gen_emit(sc, zero, len);
+}
+
+static void afl_gen_load_syscall(afl_gen_syscall_t *sc, QDict *entry)
+{
+   QNum       *id;
+   QList      *args;
+   QListEntry *e;
+   int64_t     nr;
+
+   if (!qdict_haskey(entry, "id") || !qdict_haskey(entry, "args")) {
+      error_report("gen-syscalls entry needs 'id' and 'args'");
+      exit(EXIT_FAILURE);
+   }
+
+   id = qobject_to(QNum, qdict_get(entry, "id"));
+   if (!id || !qnum_get_try_int(id, &nr) || nr < 0 || nr > UINT32_MAX) {
+      error_report("gen-syscalls entry bad 'id'");
+      exit(EXIT_FAILURE);
+   }
+
+   sc->id      = nr;
+   sc->enabled = qdict_get_try_bool(entry, "enabled", true);
+   args        = qdict_get_qlist(entry, "args");
+
+   if (!args || qlist_size(args) > AFL_GEN_MAX_ARGS) {
+      error_report("gen-syscalls id %u: bad 'args'", sc->id);
+      exit(EXIT_FAILURE);
+   }
+
+   QLIST_FOREACH_ENTRY(args, e) {
+      QNum    *size = qobject_to(QNum, qlist_entry_obj(e));
+      uint64_t val;
+
+      if (!size || !qnum_get_try_uint(size, &val) || val > 4 * KiB) {
+         error_report("gen-syscalls id %u: bad argument size", sc->id);
+         exit(EXIT_FAILURE);
+      }
+
+      /* pointed areas are filled by words */
+      sc->sizes[sc->nbargs]  = QEMU_ALIGN_UP(val, 4);
+      sc->in_off[sc->nbargs] = sc->in_size;
+      sc->in_size += sc->sizes[sc->nbargs] ? sc->sizes[sc->nbargs] : 4;
+      sc->nbargs++;
+   }
+
+   if (sc->enabled) {
+      afl_arch_gen_template(sc);
+   }
+}
+
+void afl_init_gen(afl_t *afl, QDict *json)
+{
+   afl_gen_t  *gen = &afl->gen;
+   QList      *list;
+   QListEntry *e;
+
+   list = qdict_get_qlist(json, "gen-syscalls");
+   if (!list || !qlist_size(list) || qlist_size(list) > 256) {
+      error_report("afl conf bad 'gen-syscalls'");
+      exit(EXIT_FAILURE);
+   }
+
+   gen->sc = g_new0(afl_gen_syscall_t, qlist_size(list));
+
+   QLIST_FOREACH_ENTRY(list, e) {
+      QDict *entry = qobject_to(QDict, qlist_entry_obj(e));
+
+      if (!entry) {
+         error_report("afl conf bad 'gen-syscalls' entry");
+         exit(EXIT_FAILURE);
+      }
+      afl_gen_load_syscall(&gen->sc[gen->nr++], entry);
+   }
+
+   debug("code generator: %u syscalls\n", gen->nr);
+}
+
+ssize_t afl_gen_table_code(afl_t *afl, uint8_t *in, size_t in_size,
+                           uint8_t *out, size_t out_max)
+{
+   afl_gen_t *gen = &afl->gen;
+   size_t     in_cur = 0, out_cur = 0;
+   uint32_t   i;
+
+   while (in_cur < in_size) {
+      afl_gen_syscall_t *sc;
+      uint8_t           *cur;
+
+      if (in[in_cur] >= gen->nr) {
+         break;
+      }
+
+      sc = &gen->sc[in[in_cur++]];
+      if (in_cur + sc->in_size > in_size) {
+         break;
+      }
+
+      if (sc->enabled) {
+         if (out_cur + sc->tpl_size > out_max) {
+            break;
+         }
+
+         cur = out + out_cur;
+         memcpy(cur, sc->tpl, sc->tpl_size);
+         for (i = 0 ; i < sc->nholes ; i++) {
+            afl_gen_hole_t *hole = &sc->holes[i];
+            memcpy(cur + hole->out, in + in_cur + hole->in, hole->len);
+         }
+         out_cur += sc->tpl_size;
+      }
+
+      in_cur += sc->in_size;
+   }
+
+   return out_cur;
+}
+#endif
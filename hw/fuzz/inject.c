@@ -29,28 +29,59 @@ static void afl_dump_mem(const char *log, uint8_t *mm, size_t size)
 #ifdef AFL_INJECT_TESTCASE
 size_t afl_inject_test_case(afl_t *afl)
 {
+#ifdef AFL_SHM_TESTCASE
+   /* AFL wrote the test case in shared memory, no syscall */
+   uint8_t *mm   = afl->testcase->data;
+   size_t   size = MIN(afl->testcase->len, afl->config.afl.testcase_size);
+#else
    struct stat st; fstat(0, &st);
    void *mm = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+   size_t size = st.st_size;
 
    if (mm == MAP_FAILED) {
       error_report("Unable to mmap test case");
       exit(EXIT_FAILURE);
    }
+#endif
 #ifdef AFL_DUMP_TESTCASE
-   afl_dump_mem("TEST CASE", mm, st.st_size);
+   afl_dump_mem("TEST CASE", mm, size);
 #endif
 
    uint8_t *out = afl->ram_ptr + afl->config.tgt.fuzz_inj;
-   ssize_t len = afl_gen_code(mm, st.st_size, out, afl->config.tgt.part_size);
+   size_t   max = afl->config.tgt.part_size;
+
+#ifdef AFL_KVM_DOORBELL
+   /* leave room for the doorbell */
+   if (afl->doorbell) {
+      max -= AFL_DOORBELL_SIZE;
+   }
+#endif
+
+#ifdef AFL_GEN_TABLE
+   ssize_t len = afl_gen_table_code(afl, mm, size, out, max);
+#else
+   ssize_t len = afl_gen_code(mm, size, out, max);
+#endif
+
+#ifdef AFL_KVM_DOORBELL
+   if (len > 0 && afl->doorbell) {
+      len += afl_arch_gen_doorbell(afl, out + len);
+   }
+#endif
 
    if (len > 0) {
       afl_mem_invalidate(afl->ram_mr, afl->config.tgt.fuzz_inj, len);
+#ifdef AFL_DIRTY_RESTORE
+      afl->inj_len = MAX(afl->inj_len, len);
+#endif
 #ifdef AFL_DUMP_PARTITION
       afl_dump_mem("PART CODE", out, len);
 #endif
    }
 
+#ifndef AFL_SHM_TESTCASE
    munmap(mm, st.st_size);
+#endif
    return len;
 }
 #endif // INJECT_TESTCASE
@@ -35,7 +35,9 @@
  */
 #if defined(AFL_RAM_GUARD) ||                                   \
    defined(AFL_DUMMY_CASE) ||                                   \
-   defined(AFL_INJECT_TESTCASE)
+   defined(AFL_INJECT_TESTCASE) ||                              \
+   defined(AFL_DIRTY_RESTORE) ||                                \
+   defined(AFL_PERSISTENT_TB)
 void afl_mem_invalidate(MemoryRegion *mr, hwaddr addr, hwaddr len)
 {
    assert(mr->ram_block);
@@ -52,3 +54,58 @@ void afl_mem_invalidate(MemoryRegion *mr, hwaddr addr, hwaddr len)
       xen_hvm_modified_memory(addr, len);
 }
 #endif
+
+/*
+ * Architecture independent RAM guard, for TCG: RAM outside the
+ * target memory and the trace bitmap can't be mapped into the TLB,
+ * whatever the guest MMU setup. Violations raise intercepted
+ * exception 'excp', cf. afl_tlb_fill().
+ */
+#ifdef AFL_RAM_GUARD
+void afl_ram_guard_tcg(afl_t *afl, int excp)
+{
+   afl_tcg_t *g = &afl_tcg;
+
+   if (!tcg_enabled()) {
+      debug("ramguard: TCG only\n");
+      return;
+   }
+
+   g->guard_nr = 0;
+   g->guard_win[g->guard_nr].start = 0;
+   g->guard_win[g->guard_nr].end   = afl->config.tgt.size;
+   g->guard_nr++;
+   g->guard_win[g->guard_nr].start = afl->config.afl.trace_addr;
+   g->guard_win[g->guard_nr].end   = afl->config.afl.trace_addr +
+                                     afl->config.afl.trace_size;
+   g->guard_nr++;
+
+   g->guard_excp = excp;
+   g->guard      = true;
+
+   /* drop entries filled before the guard */
+   tlb_flush(CPU(afl->arch.cpu));
+
+   debug("ramguard: TCG windows 0x"TARGET_FMT_lx" 0x%"PRIx64"\n",
+         afl->config.tgt.size, afl->config.afl.trace_addr);
+}
+#endif
+
+/*
+ * Keep translated code across test cases instead of flushing the
+ * whole TB cache on each VM stop. Guest writes to code pages are
+ * caught by TCG self-modifying code detection. Only host side writes
+ * escape it: test case injection, done inside the partition window,
+ * and snapshot restore which invalidates what it rewrites (cf.
+ * afl_restore_ram() or tb_flush() on full reload).
+ */
+#ifdef AFL_PERSISTENT_TB
+void afl_tb_invalidate(afl_t *afl)
+{
+   if (kvm_enabled())
+      return;
+
+   afl_mem_invalidate(afl->ram_mr, afl->config.tgt.fuzz_inj,
+                      afl->config.tgt.part_size);
+}
+#endif
@@ -0,0 +1,280 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * shared snapshot between fuzzing instances
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+#include "qemu/afl.h"
+#include "qemu/memfd.h"
+
+#ifdef AFL_SHARED_SNAPSHOT
+/*
+ * The first instance to lock the descriptor file becomes the
+ * primary. It boots up to the fuzzing entry point and publishes the
+ * pristine RAM and the device state as memfds. The descriptor
+ * then holds a single line:
+ *
+ *   <pid> <ram fd> <dev fd> <dev size>
+ *
+ * Secondary instances wait for it, open memfds through procfs,
+ * map the RAM image copy-on-write in place of their own guest RAM
+ * and never boot. All instances must run the same VM
+ * configuration, as the same user.
+ *
+ * The primary holds a write lock on the descriptor for its whole
+ * life. The kernel drops it when the primary dies, even from
+ * SIGKILL which skips afl_shared_cleanup(): a waiting instance then
+ * takes the lock over and becomes the primary of a fresh
+ * descriptor.
+ */
+#define AFL_SHARED_SEALS (F_SEAL_GROW|F_SEAL_SHRINK|F_SEAL_SEAL)
+
+/* Secondaries give up after waiting that long for the primary */
+#define AFL_SHARED_TIMEOUT (10 * 60 * G_USEC_PER_SEC)
+
+static int afl_shared_open(pid_t pid, int fd)
+{
+   char path[64];
+   int  lfd;
+
+   snprintf(path, sizeof(path), "/proc/%d/fd/%d", pid, fd);
+   lfd = open(path, O_RDONLY);
+   if (lfd < 0) {
+      error_report("can't open shared snapshot '%s': %s",
+                   path, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   return lfd;
+}
+
+/*
+ * Open the descriptor and try to become the primary. The lock is
+ * only valid if the descriptor was not unlinked by a leaving
+ * primary in between.
+ */
+static bool afl_shared_lock(afl_t *afl, int *fd)
+{
+   const char  *path = afl->config.qemu.shared_path;
+   struct stat  st, cur;
+   int          ret;
+
+   for (;;) {
+      *fd = open(path, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+      if (*fd < 0) {
+         error_report("can't open shared snapshot descriptor '%s': %s",
+                      path, strerror(errno));
+         exit(EXIT_FAILURE);
+      }
+
+      ret = qemu_lock_fd(*fd, 0, 0, true);
+      if (ret == -EAGAIN || ret == -EACCES) {
+         return false;
+      }
+      if (ret < 0) {
+         error_report("can't lock shared snapshot descriptor '%s': %s",
+                      path, strerror(-ret));
+         exit(EXIT_FAILURE);
+      }
+
+      if (!fstat(*fd, &cur) && !stat(path, &st) &&
+          cur.st_dev == st.st_dev && cur.st_ino == st.st_ino) {
+         /* drop what a dead primary may have left */
+         if (ftruncate(*fd, 0) < 0) {
+            error_report("can't reset shared snapshot descriptor '%s'", path);
+            exit(EXIT_FAILURE);
+         }
+         return true;
+      }
+      close(*fd);
+   }
+}
+
+static bool afl_shared_alive(pid_t pid)
+{
+   return pid > 0 && (!kill(pid, 0) || errno == EPERM);
+}
+
+/*
+ * Wait for the primary to publish. Returns false once the
+ * descriptor is read, true if the primary died meanwhile and this
+ * instance took over.
+ */
+static bool afl_shared_wait(afl_t *afl, int fd,
+                            pid_t *pid, int *ram_fd, int *dev_fd)
+{
+   const char *path = afl->config.qemu.shared_path;
+   int64_t     deadline = g_get_monotonic_time() + AFL_SHARED_TIMEOUT;
+   char        line[128];
+   ssize_t     len;
+
+   debug("waiting for shared snapshot '%s'\n", path);
+
+   for (;;) {
+      len = pread(fd, line, sizeof(line) - 1, 0);
+      if (len < 0) {
+         error_report("can't read shared snapshot descriptor");
+         exit(EXIT_FAILURE);
+      }
+      line[len] = 0;
+
+      /* descriptor is complete once the line is */
+      if (strchr(line, '\n')) {
+         if (sscanf(line, "%d %d %d %zu", pid, ram_fd, dev_fd,
+                    &afl->shared.dev_size) != 4) {
+            error_report("bad shared snapshot descriptor '%s'", path);
+            exit(EXIT_FAILURE);
+         }
+         if (afl_shared_alive(*pid)) {
+            close(fd);
+            return false;
+         }
+      }
+
+      /* primary is gone, before publishing or leaving a stale line */
+      if (!qemu_lock_fd_test(fd, 0, 0, true)) {
+         close(fd);
+         if (afl_shared_lock(afl, &fd)) {
+            afl->shared.desc_fd = fd;
+            debug("took over shared snapshot '%s'\n", path);
+            return true;
+         }
+         continue;
+      }
+
+      if (g_get_monotonic_time() > deadline) {
+         error_report("timed out waiting for shared snapshot '%s'", path);
+         exit(EXIT_FAILURE);
+      }
+      g_usleep(10 * 1000);
+   }
+}
+
+/*
+ * Guest RAM becomes a private mapping of the primary RAM image, so
+ * that only pages written by this instance are duplicated. The
+ * pristine copy used to restore them is a read-only view of the
+ * same image.
+ */
+static void afl_shared_attach(afl_t *afl, pid_t pid, int ram_fd, int dev_fd)
+{
+   QEMUFile *f;
+   void     *dev;
+
+   afl->shared.ram_fd = afl_shared_open(pid, ram_fd);
+   afl->shared.dev_fd = afl_shared_open(pid, dev_fd);
+
+   if (mmap(afl->ram_ptr, afl->ram_size, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_FIXED, afl->shared.ram_fd, 0) == MAP_FAILED) {
+      error_report("can't map shared RAM image");
+      exit(EXIT_FAILURE);
+   }
+
+   afl->ram_snap = mmap(NULL, afl->ram_size, PROT_READ,
+                        MAP_SHARED, afl->shared.ram_fd, 0);
+   if (afl->ram_snap == MAP_FAILED) {
+      error_report("can't map shared pristine RAM");
+      exit(EXIT_FAILURE);
+   }
+
+   dev = mmap(NULL, afl->shared.dev_size, PROT_READ,
+              MAP_SHARED, afl->shared.dev_fd, 0);
+   if (dev == MAP_FAILED) {
+      error_report("can't map shared device state");
+      exit(EXIT_FAILURE);
+   }
+
+   afl_vmb_init(&afl->dev_vmb, 0);
+   f = afl_vmb_writer(&afl->dev_vmb, afl->shared.dev_size);
+   qemu_put_buffer(f, dev, afl->shared.dev_size);
+   qemu_fflush(f);
+   munmap(dev, afl->shared.dev_size);
+
+   debug("attached to shared snapshot of instance %d\n", pid);
+
+   /* anything written from now on (roms, bios) is restored */
+   afl_dirty_log_start(afl);
+
+   /* skip boot, cf. afl_vm_state_change() */
+   afl->shared.attach = true;
+   qemu_system_vmstop_request_prepare();
+   qemu_system_vmstop_request(RUN_STATE_RESTORE_VM);
+}
+
+void afl_init_shared(afl_t *afl)
+{
+   const char *path = afl->config.qemu.shared_path;
+   pid_t       pid;
+   int         fd, ram_fd, dev_fd;
+
+   afl->shared.ram_fd = afl->shared.dev_fd = afl->shared.desc_fd = -1;
+
+   if (afl_shared_lock(afl, &fd)) {
+      afl->shared.desc_fd = fd;
+   } else if (!afl_shared_wait(afl, fd, &pid, &ram_fd, &dev_fd)) {
+      afl_shared_attach(afl, pid, ram_fd, dev_fd);
+      return;
+   }
+
+   debug("primary instance, publishing to '%s'\n", path);
+}
+
+/* Primary instance pristine RAM, directly allocated as a memfd */
+void* afl_shared_ram_alloc(afl_t *afl)
+{
+   Error *err = NULL;
+   void  *ptr;
+
+   ptr = qemu_memfd_alloc("afl-ram", afl->ram_size, AFL_SHARED_SEALS,
+                          &afl->shared.ram_fd, &err);
+   if (!ptr) {
+      error_report_err(err);
+      exit(EXIT_FAILURE);
+   }
+   return ptr;
+}
+
+void afl_shared_publish(afl_t *afl)
+{
+   Error *err = NULL;
+   void  *dev;
+
+   afl->shared.dev_size = afl->dev_vmb.bioc->usage;
+   dev = qemu_memfd_alloc("afl-dev", afl->shared.dev_size, AFL_SHARED_SEALS,
+                          &afl->shared.dev_fd, &err);
+   if (!dev) {
+      error_report_err(err);
+      exit(EXIT_FAILURE);
+   }
+
+   memcpy(dev, afl->dev_vmb.bioc->data, afl->shared.dev_size);
+   munmap(dev, afl->shared.dev_size);
+
+   if (dprintf(afl->shared.desc_fd, "%d %d %d %zu\n", getpid(),
+               afl->shared.ram_fd, afl->shared.dev_fd,
+               afl->shared.dev_size) < 0) {
+      error_report("can't publish shared snapshot");
+      exit(EXIT_FAILURE);
+   }
+
+   debug("shared snapshot published\n");
+}
+
+void afl_shared_cleanup(afl_t *afl)
+{
+   if (afl->ram_snap) {
+      munmap(afl->ram_snap, afl->ram_size);
+   }
+   if (afl->shared.ram_fd >= 0) {
+      close(afl->shared.ram_fd);
+   }
+   if (afl->shared.dev_fd >= 0) {
+      close(afl->shared.dev_fd);
+   }
+   if (afl->shared.desc_fd >= 0) {
+      /* unlink first, a waiter locking the old file retries */
+      unlink(afl->config.qemu.shared_path);
+      close(afl->shared.desc_fd);
+   }
+}
+#endif
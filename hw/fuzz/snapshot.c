@@ -41,14 +41,224 @@ static void __qlist_rcu_restore(RAMBlock *prev, RAMBlock *block)
 }
 #endif
 
+#ifdef AFL_DIRTY_RESTORE
+/*
+ * Incremental restore. Once the VM has been saved, we keep a
+ * pristine copy of guest RAM and the device state serialized into a
+ * memory buffer. Dirty logging is then enabled (DIRTY_MEMORY_MIGRATION
+ * client, fed by TCG notdirty writes or KVM dirty log sync) so that
+ * reloading the VM only rewrites pages touched by the test case.
+ *
+ * Only the main RAM region is tracked. Other RAM blocks (vram, roms)
+ * are left as is.
+ */
+void afl_dirty_log_start(afl_t *afl)
+{
+   ram_addr_t base = memory_region_get_ram_addr(afl->ram_mr);
+
+   memory_global_dirty_log_start();
+   memory_global_dirty_log_sync();
+   cpu_physical_memory_test_and_clear_dirty(base, afl->ram_size,
+                                            DIRTY_MEMORY_MIGRATION);
+}
+
+static void afl_save_dirty(afl_t *afl)
+{
+   QEMUFile   *f;
+   int         ret;
+
+#ifdef AFL_SHARED_SNAPSHOT
+   afl->ram_snap = afl_shared_ram_alloc(afl);
+#else
+   afl->ram_snap = g_malloc(afl->ram_size);
+#endif
+   memcpy(afl->ram_snap, afl->ram_ptr, afl->ram_size);
+
+   afl_vmb_init(&afl->dev_vmb, 0);
+   f = afl_vmb_writer(&afl->dev_vmb, 64 * KiB);
+
+   ret = qemu_save_device_state(f);
+   qemu_fflush(f);
+   if (ret < 0) {
+      error_report("Error %d while saving device state", ret);
+      exit(EXIT_FAILURE);
+   }
+
+   debug("device state %zu bytes\n", afl->dev_vmb.bioc->usage);
+
+#ifdef AFL_PERSISTENT
+   afl->regs_snap = g_malloc(AFL_REGS_SIZE);
+   afl_save_regs(&afl->arch, afl->regs_snap);
+#endif
+
+#ifdef AFL_SHARED_SNAPSHOT
+   afl_shared_publish(afl);
+#endif
+
+   afl_dirty_log_start(afl);
+}
+
+static void afl_restore_ram(afl_t *afl, hwaddr addr, hwaddr len)
+{
+   memcpy(afl->ram_ptr + addr, afl->ram_snap + addr, len);
+   afl_mem_invalidate(afl->ram_mr, addr, len);
+}
+
+/*
+ * Restore dirty pages of guest RAM range [from, from+size[
+ * and clear their dirty state.
+ */
+static void afl_restore_dirty_ram(afl_t *afl, hwaddr from, hwaddr size)
+{
+   ram_addr_t base = memory_region_get_ram_addr(afl->ram_mr) + from;
+   hwaddr     addr, start;
+   uint32_t   pages = 0;
+   int64_t    t = afl_stats_start();
+
+   memory_global_dirty_log_sync();
+
+   /* coalesce contiguous dirty pages */
+   for (addr = 0 ; addr < size ; ) {
+      if (!cpu_physical_memory_get_dirty(base + addr, TARGET_PAGE_SIZE,
+                                         DIRTY_MEMORY_MIGRATION)) {
+         addr += TARGET_PAGE_SIZE;
+         continue;
+      }
+
+      start = addr;
+      do {
+         addr += TARGET_PAGE_SIZE;
+         pages++;
+      } while (addr < size &&
+               cpu_physical_memory_get_dirty(base + addr, TARGET_PAGE_SIZE,
+                                             DIRTY_MEMORY_MIGRATION));
+
+      afl_restore_ram(afl, from + start, addr - start);
+   }
+
+   cpu_physical_memory_test_and_clear_dirty(base, size,
+                                            DIRTY_MEMORY_MIGRATION);
+
+   /* test case injection is done from host, not tracked */
+   if (afl->inj_len) {
+      afl_restore_ram(afl, afl->config.tgt.fuzz_inj, afl->inj_len);
+      afl->inj_len = 0;
+   }
+
+   afl_stats_end(GUSTAVE_PHASE_RESTORE_RAM, t);
+   debug("restored %u dirty pages\n", pages);
+}
+
+static void afl_load_dirty(afl_t *afl)
+{
+   QEMUFile *f;
+   int       ret;
+   int64_t   t;
+
+   debug("%s()\n", __func__);
+
+   if (!runstate_check(RUN_STATE_RESTORE_VM)) {
+      vm_stop(RUN_STATE_RESTORE_VM);
+   }
+
+   t = afl_stats_start();
+   qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+
+   f = afl_vmb_reader(&afl->dev_vmb);
+   if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+       qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+      error_report("bad cached device state");
+      exit(EXIT_FAILURE);
+   }
+
+   ret = qemu_load_device_state(f);
+   if (ret < 0) {
+      error_report("error %d while loading device state", ret);
+      exit(EXIT_FAILURE);
+   }
+   afl_stats_end(GUSTAVE_PHASE_RESTORE_DEVICES, t);
+
+   /* after reset, which may have written roms to RAM */
+   afl_restore_dirty_ram(afl, 0, afl->ram_size);
+}
+#endif
+
+#ifdef AFL_SHARED_SNAPSHOT
+/*
+ * Secondary instance first restore. RAM and device state come from
+ * the primary instance, cf. afl_shared_attach().
+ */
+void afl_attach_vm(afl_t *afl)
+{
+   afl_load_dirty(afl);
+
+#ifdef AFL_PERSISTENT
+   afl->regs_snap = g_malloc(AFL_REGS_SIZE);
+   afl_save_regs(&afl->arch, afl->regs_snap);
+#endif
+}
+#endif
+
+#ifdef AFL_PERSISTENT
+/*
+ * Persistent mode: on clean exits, only rewind CPU registers and
+ * partition memory. Kernel memory and devices are left as is, until
+ * a full restore every 'vm-persistent-iter' test cases or on any
+ * other outcome.
+ */
+static void afl_load_persistent(afl_t *afl)
+{
+   debug("%s(%u)\n", __func__, afl->persistent_cnt);
+
+   afl_load_regs(&afl->arch, afl->regs_snap);
+   if (!kvm_enabled()) {
+      tlb_flush(CPU(afl->arch.cpu));
+   }
+
+   afl_restore_dirty_ram(afl, afl->config.tgt.part_base,
+                         afl->config.tgt.part_size);
+}
+#endif
+
+#ifdef AFL_KVM_DOORBELL
+/*
+ * Persistent restore from the vCPU thread, while the VM is running.
+ * KVM registers are never fetched: they are overwritten and pushed
+ * back by kvm_cpu_exec() before the next KVM_RUN. Returns false when
+ * a full restore is due.
+ */
+bool afl_load_vm_running(afl_t *afl)
+{
+   if (++afl->persistent_cnt >= afl->config.tgt.persistent_iter) {
+      return false;
+   }
+
+   afl_load_persistent(afl);
+   CPU(afl->arch.cpu)->vcpu_dirty = true;
+   return true;
+}
+#endif
+
 /* Save the VM in a "dirty way"
  * (ie. don't use save_snapshot())
+ *
+ * With incremental restore, RAM is never reloaded from the savevm
+ * stream so we only keep the pristine copy and device state.
  */
-void afl_save_vm(afl_t *afl, int afd)
+void afl_save_vm(afl_t *afl)
 {
+#ifdef AFL_DIRTY_RESTORE
+   debug("save vm state (dirty restore)\n");
+   vm_stop(RUN_STATE_SAVE_VM);
+   afl_save_dirty(afl);
+#else
    /* int vm_running; */
    int ret;
-   int fd = dup(afd); // qfile will close it
+
+#ifdef AFL_MEMORY_VMSTATE
+   QEMUFile *f = afl_vmb_writer(&afl->vms, afl->ram_size + MiB);
+#else
+   int fd = dup(afl->vms_fd); // qfile will close it
 
    lseek(fd, 0, SEEK_SET);
    if (ftruncate(fd, 0) < 0) {
@@ -58,6 +268,7 @@ void afl_save_vm(afl_t *afl, int afd)
 
    QIOChannel *ioc = QIO_CHANNEL(qio_channel_file_new_fd(fd));
    QEMUFile *f = qemu_fopen_channel_output(ioc);
+#endif
 
    debug("save vm state\n");
 
@@ -65,7 +276,9 @@ void afl_save_vm(afl_t *afl, int afd)
       error_report("qemu_fopen failed");
       return;
    }
+#ifndef AFL_MEMORY_VMSTATE
    object_unref(OBJECT(ioc));
+#endif
 
    /* prevent saving AFL trace bitmaps to keep activity trace when
     * reloading the VM.
@@ -104,16 +317,30 @@ void afl_save_vm(afl_t *afl, int afd)
       error_report("Error %d while saving VM state", ret);
    }
 
+#ifdef AFL_MEMORY_VMSTATE
+   qemu_fflush(f);
+   debug("vm state %zu bytes\n", afl->vms.bioc->usage);
+#else
    qemu_fclose(f);
+#endif
 
 #if !defined(AFL_TRACE_MMIO) && defined(AFL_PRESERVE_TRACEMAP)
    __qlist_rcu_restore(prev, afl->trace_mr.ram_block);
 #endif
+#endif
 }
 
-void afl_load_vm(afl_t *afl, int afd)
+void afl_load_vm(afl_t *afl)
 {
-#ifdef AFL_FAST_RESTORE
+#ifdef AFL_PERSISTENT
+   if (afl->status == sts_exit(0) &&
+       ++afl->persistent_cnt < afl->config.tgt.persistent_iter) {
+      afl_load_persistent(afl);
+      return;
+   }
+   afl->persistent_cnt = 0;
+
+#elif defined(AFL_FAST_RESTORE)
    /* We triggered #BP on EXEC_END. We can either inject a "jmp main"
     * or directly fix CPU regs as we are executing in the context of
     * the partition.
@@ -128,13 +355,21 @@ void afl_load_vm(afl_t *afl, int afd)
    }
 #endif
 
+#ifdef AFL_DIRTY_RESTORE
+   afl_load_dirty(afl);
+#else
    int ret;
-   int fd = dup(afd); // qfile will close it
+
+#ifdef AFL_MEMORY_VMSTATE
+   QEMUFile *f = afl_vmb_reader(&afl->vms);
+#else
+   int fd = dup(afl->vms_fd); // qfile will close it
 
    lseek(fd, 0, SEEK_SET);
 
    QIOChannel *ioc = QIO_CHANNEL(qio_channel_file_new_fd(fd));
    QEMUFile *f = qemu_fopen_channel_input(ioc);
+#endif
 
    debug("%s()\n", __func__);
 
@@ -142,7 +377,9 @@ void afl_load_vm(afl_t *afl, int afd)
       error_report("qemu_fopen failed");
       return;
    }
+#ifndef AFL_MEMORY_VMSTATE
    object_unref(OBJECT(ioc));
+#endif
 
 #ifdef AFL_TRACE_CHKSM
    afl_trace_checksum(afl, "pre-load");
@@ -158,7 +395,17 @@ void afl_load_vm(afl_t *afl, int afd)
       error_report("error %d while loading VM state", ret);
       return;
    }
+
+#ifdef AFL_PERSISTENT_TB
+   /* RAM was entirely rewritten behind TCG back */
+   if (!kvm_enabled()) {
+      tb_flush(CPU(afl->arch.cpu));
+   }
+#endif
+#ifndef AFL_MEMORY_VMSTATE
    qemu_fclose(f);
+#endif
+#endif
 
 #ifdef AFL_TRACE_CHKSM
    afl_trace_checksum(afl, "post-load");
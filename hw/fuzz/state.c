@@ -8,17 +8,36 @@
 #include "qemu/afl.h"
 
 static void afl_run_target(afl_t *afl);
+static void afl_prepare_target(afl_t *afl);
 
 static void afl_forward_status(afl_t *afl)
 {
    /* relay waitpid() status to AFL */
+   int64_t t = afl_stats_start();
+
+#ifdef AFL_CONTROL_CSWITCH
+   /* test cases start in the target partition */
+   afl_trace_gate(afl, true);
+#endif
+
+#ifdef AFL_STANDALONE
+   afl_engine_status(afl);
+#endif
+
 #ifdef AFL_CONTACT
    debug("forward status (%d) to AFL\n", afl->status);
+#ifdef AFL_BATCH
+   afl_batch_status(afl);
+#else
    if (write(afl->config.afl.sts_fd, &afl->status, 4) != 4) {
       error_report("can't write status to afl");
       exit(EXIT_FAILURE);
    }
 #endif
+#endif
+
+   afl_stats_end(GUSTAVE_PHASE_FORWARD, t);
+   afl_stats_iteration();
 
 #ifdef AFL_TRACE_CHKSM
    afl_trace_checksum(afl, "post-fwd-status");
@@ -31,7 +50,10 @@ static void afl_forward_status(afl_t *afl)
 
 static void afl_reload_forward(afl_t *afl)
 {
-   afl_load_vm(afl, afl->vms_fd);
+   int64_t t = afl_stats_start();
+
+   afl_load_vm(afl);
+   afl_stats_end(GUSTAVE_PHASE_RESTORE, t);
    afl_forward_status(afl);
    afl_run_target(afl);
 }
@@ -45,14 +67,17 @@ static void afl_reload_forward(afl_t *afl)
  * to SIGKILL it (upon timeout) between read(pid)
  * & read(status).
  */
-#if defined(AFL_CONTACT) && defined(AFL_INJECT_TESTCASE)
+#if (defined(AFL_CONTACT) || defined(AFL_STANDALONE)) &&                \
+   defined(AFL_INJECT_TESTCASE)
 static void afl_flash_forward(afl_t *afl)
 {
+#if defined(AFL_CONTACT) && !defined(AFL_BATCH)
    int child_pid = 1;
    if (write(afl->config.afl.sts_fd, &child_pid, 4) != 4) {
       error_report("can't write fast pid to afl");
       exit(EXIT_FAILURE);
    }
+#endif
 
    debug("--> vm fast exit() !\n");
    afl->status = sts_exit(1);
@@ -98,51 +123,52 @@ static inline void afl_setup_timer(QEMUTimer *timer, int64_t duration)
  * only when scheduling attacker partition
  */
 #ifdef AFL_CONTROL_CSWITCH
-static void afl_handle_cswitch(afl_t *afl)
+static void afl_cswitch_gate(afl_t *afl)
 {
    target_ulong sp = afl_get_stack(&afl->arch);
+   bool         on;
 
-   if (sp >= afl->config.tgt.part_kstack &&
-       sp < (afl->config.tgt.part_kstack+afl->config.tgt.part_kstack_size)) {
-
-      debug("scheduling target partition (0x"TARGET_FMT_lx")\n", sp);
-      memory_region_set_enabled(&afl->fake_mr, false);
-      memory_region_set_enabled(&afl->trace_mr, true);
-
-      /* afl->fake_mr.priority  = 0; */
-      /* afl->trace_mr.priority = 1; */
-      /* memory_region_update_pending = true; */
-      /* memory_region_transaction_commit(); */
-
-      /* memory_region_del_subregion(get_system_memory(),&afl->fake_mr); */
-      /* memory_region_add_subregion(get_system_memory(), */
-      /*                             afl->config.afl.trace_addr, &afl->trace_mr); */
-   } else {
-      debug("scheduling other partition (0x"TARGET_FMT_lx")\n", sp);
-      memory_region_set_enabled(&afl->fake_mr, true);
-      memory_region_set_enabled(&afl->trace_mr, false);
-
-      /* afl->fake_mr.priority  = 1; */
-      /* afl->trace_mr.priority = 0; */
-      /* memory_region_update_pending = true; */
-      /* memory_region_transaction_commit(); */
-
-      /* memory_region_del_subregion(get_system_memory(),&afl->trace_mr); */
-      /* memory_region_add_subregion(get_system_memory(), */
-      /*                             afl->config.afl.trace_addr, &afl->fake_mr); */
-   }
+   on = sp >= afl->config.tgt.part_kstack &&
+      sp < (afl->config.tgt.part_kstack+afl->config.tgt.part_kstack_size);
+
+   debug("scheduling %s partition (0x"TARGET_FMT_lx")\n",
+         on ? "target" : "other", sp);
+   afl_trace_gate(afl, on);
+}
+
+/* TCG: called by generated code, the vCPU keeps running */
+static void afl_cswitch_hook(void *opaque)
+{
+   afl_cswitch_gate((afl_t*)opaque);
+}
+
+/* KVM: context switch breakpoint */
+static void afl_handle_cswitch(afl_t *afl)
+{
+   afl_cswitch_gate(afl);
 
    debug("<-- resume VM (scheduled)\n");
 
    /*
     * We could not use "env->hflags |= HF_RF_MASK" to ignore the
     * breakpoint and resume insn because GDB_BP are always triggered.
-    * To speed up things, we should fix qemu breakpoints logic.
     */
    afl_remove_breakpoint(afl, afl->config.tgt.cswitch);
    cpu_single_step(CPU(afl->arch.cpu), true);
    vm_start();
 }
+
+void afl_init_cswitch(afl_t *afl)
+{
+   if (kvm_enabled()) {
+      afl_insert_breakpoint(afl, afl->config.tgt.cswitch);
+      return;
+   }
+
+   afl_tcg.hook_pc     = afl->config.tgt.cswitch;
+   afl_tcg.hook_opaque = afl;
+   afl_tcg.hook        = afl_cswitch_hook;
+}
 #endif
 
 /*
@@ -162,9 +188,75 @@ static void afl_handle_abort(afl_t *afl)
 {
    debug("--> vm abort() !\n");
    afl->status = sts_abort();
+#ifdef AFL_CRASH_TRIAGE
+   afl_triage_crash(afl);
+#endif
    afl_reload_forward(afl);
 }
 
+/*
+ * KVM end of test case doorbell. The partition code generated for
+ * the test case ends with a write to this MMIO page. The write is
+ * dispatched from kvm_cpu_exec() exit path, in the vCPU thread, while
+ * the VM is still running: we rewind it in place and prepare the next
+ * test case without any runstate change, breakpoint or register
+ * fetch. Full restores still go through afl_vm_state_change().
+ *
+ * Guest RAM guard (or the target page tables) must map the doorbell
+ * page in the partition.
+ */
+#ifdef AFL_KVM_DOORBELL
+static void afl_doorbell_write(void *opaque, hwaddr addr,
+                               uint64_t data, unsigned size)
+{
+   afl_t   *afl = (afl_t*)opaque;
+   int64_t  t;
+
+   afl_stats_stop();
+   debug("--> vm doorbell()\n");
+   afl->status = sts_exit(0);
+
+   t = afl_stats_start();
+   if (!afl_load_vm_running(afl)) {
+      qemu_system_vmstop_request_prepare();
+      qemu_system_vmstop_request(RUN_STATE_RESTORE_VM);
+      return;
+   }
+   afl_stats_end(GUSTAVE_PHASE_RESTORE, t);
+
+   afl_forward_status(afl);
+   afl_prepare_target(afl);
+   afl_stats_resume();
+}
+
+static uint64_t afl_doorbell_read(void *opaque, hwaddr addr, unsigned size)
+{
+   return 0;
+}
+
+static const MemoryRegionOps afl_doorbell_ops = {
+   .read = afl_doorbell_read,
+   .write = afl_doorbell_write,
+   .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+void afl_init_doorbell(afl_t *afl)
+{
+   afl->doorbell = kvm_enabled();
+   if (!afl->doorbell) {
+      return;
+   }
+
+   memory_region_init_io(&afl->doorbell_mr, NULL, &afl_doorbell_ops, afl,
+                         "afl_doorbell", TARGET_PAGE_SIZE);
+   memory_region_add_subregion(get_system_memory(),
+                               afl->config.tgt.doorbell,
+                               &afl->doorbell_mr);
+
+   debug("doorbell @ 0x"TARGET_FMT_lx"\n", afl->config.tgt.doorbell);
+}
+#endif
+
 /*
  * Prepare the VM to be resumed :
  *  - wait for AFL to generate test case
@@ -180,33 +272,64 @@ static void afl_handle_abort(afl_t *afl)
 static uint64_t test_nr = 1;
 #endif
 
-static void afl_run_target(afl_t *afl)
+#ifdef AFL_CONTACT
+static void afl_wait_test_case(afl_t *afl)
 {
-#if defined(AFL_INJECT_TESTCASE) ||                                     \
-   (defined(AFL_CONTROL_EXECUTION) && !defined(AFL_CONTROL_EXEC_ZERO))
-   ssize_t len = afl->config.tgt.nop_size;
-#endif
+   int64_t t = afl_stats_start();
+   int     prev_timed_out; //last child did time out ?
 
-#ifdef AFL_CONTACT
-__wait_test_case:
    /* Wait for parent by reading from the pipe. Abort if read fails. */
    debug("waiting for test case [%lu]\n", test_nr++);
 
-   int prev_timed_out; //last child did time out ?
    if (read(afl->config.afl.ctl_fd, &prev_timed_out, 4) != 4) {
       error_report("not ready to run test case");
       exit(EXIT_FAILURE);
    }
+   afl_stats_end(GUSTAVE_PHASE_WAIT, t);
+}
+#endif
+
+static void afl_prepare_target(afl_t *afl)
+{
+#if defined(AFL_INJECT_TESTCASE) ||                                     \
+   (defined(AFL_CONTROL_EXECUTION) && !defined(AFL_CONTROL_EXEC_ZERO))
+   ssize_t len = afl->config.tgt.nop_size;
+#endif
+#ifdef AFL_INJECT_TESTCASE
+   int64_t t;
+#endif
+
+#ifdef AFL_CONTACT
+__wait_test_case:
+#ifdef AFL_BATCH
+   /* next test case of the batch, or a new batch */
+   while (!afl_batch_pending(afl)) {
+      afl_wait_test_case(afl);
+      afl_batch_start(afl);
+   }
+   afl->testcase = afl_batch_case(afl);
+#else
+   afl_wait_test_case(afl);
+#endif
 #endif // CONTACT
 
+#ifdef AFL_STANDALONE
+__wait_test_case:
+   t = afl_stats_start();
+   afl_engine_next(afl);
+   afl_stats_end(GUSTAVE_PHASE_WAIT, t);
+#endif
+
 #ifdef AFL_TRACE_CHKSM
    afl_trace_checksum(afl, "pre-test-case");
 #endif
 
    /* inject test case in VM partition */
 #ifdef AFL_INJECT_TESTCASE
+   t = afl_stats_start();
    len = afl_inject_test_case(afl);
-#ifdef AFL_CONTACT
+   afl_stats_end(GUSTAVE_PHASE_INJECT, t);
+#if defined(AFL_CONTACT) || defined(AFL_STANDALONE)
    if (len <= 0) {
       afl_flash_forward(afl);
       goto __wait_test_case;
@@ -228,11 +351,14 @@ __wait_test_case:
    debug("vm exec end @ 0x"TARGET_FMT_lx" (%ld)\n", afl->vm_exit, len);
 #endif // EXEC_ZERO
 
+#ifdef AFL_KVM_DOORBELL
+   if (!afl->doorbell)
+#endif
    afl_insert_breakpoint(afl, afl->vm_exit);
 #endif // CONTROL_EXECUTION
 
    /* Write fake PID to pipe to release AFL (run_target()) */
-#ifdef AFL_CONTACT
+#if defined(AFL_CONTACT) && !defined(AFL_BATCH)
    afl_forward_child(afl);
 #endif
 
@@ -256,14 +382,64 @@ __wait_test_case:
     * return FAULT_NONE
     */
 #ifdef AFL_CONTROL_EXECUTION
+#ifdef AFL_INSN_BUDGET
+   /* vCPU stops on its own, cf. EXCP_AFL_BUDGET */
+   afl_tcg.budget = afl->config.qemu.insn_budget;
+   afl_tcg.budget_on = true;
+#else
    afl_setup_timer(afl->user_timer, afl->config.qemu.timeout - afl->config.qemu.overhead);
 #endif
+#endif
+
+#ifdef AFL_TRACE_TCG
+   afl_tcg.prev_loc = 0;
+#endif
+
+#ifdef AFL_TRACE_CMPLOG
+   memset(afl->cmp_map->headers, 0, sizeof(afl->cmp_map->headers));
+#endif
+}
+
+static void afl_run_target(afl_t *afl)
+{
+   afl_prepare_target(afl);
 
    /* Resume VM until memory fault, timeout or end of execution */
    debug("<-- resume vm (new test case)\n");
+   afl_stats_resume();
    vm_start();
 }
 
+static void afl_say_hello(afl_t *afl)
+{
+#ifdef AFL_CONTACT
+   /* release AFL init_forkserver() */
+   debug("say hello to AFL\n");
+#ifdef AFL_SHM_TESTCASE
+   /* announce shared memory test cases */
+   uint32_t hello = AFL_FS_OPT_ENABLED | AFL_FS_OPT_SHDMEM_FUZZ;
+   if (write(afl->config.afl.sts_fd, &hello, 4) != 4) {
+#else
+   if (write(afl->config.afl.sts_fd, "hello", 4) != 4) {
+#endif
+      error_report("can't write hello to afl");
+      exit(EXIT_FAILURE);
+   }
+#ifdef AFL_SHM_TESTCASE
+   /* AFL++ echoes the options it accepted */
+   uint32_t reply;
+   if (read(afl->config.afl.ctl_fd, &reply, 4) != 4) {
+      error_report("can't read hello reply from afl");
+      exit(EXIT_FAILURE);
+   }
+   if (reply != hello) {
+      error_report("afl refused shared memory test cases (0x%x)", reply);
+      exit(EXIT_FAILURE);
+   }
+#endif
+#endif
+}
+
 /*
  * The VM has run enough code to boot, init devices,
  * setup partitions and now its interesting to start
@@ -284,20 +460,33 @@ static void afl_handle_start_fuzzing(afl_t *afl)
    afl_arch_ram_guard_setup(afl);
 #endif
 
-#ifdef AFL_CONTACT
-   /* release AFL init_forkserver() */
-   debug("say hello to AFL\n");
-   if (write(afl->config.afl.sts_fd, "hello", 4) != 4) {
-      error_report("can't write hello to afl");
-      exit(EXIT_FAILURE);
-   }
-#endif
+   afl_say_hello(afl);
 
    /* trace bitmap is reset at this stage */
-   afl_save_vm(afl, afl->vms_fd);
+   afl_save_vm(afl);
    afl_run_target(afl);
 }
 
+/*
+ * Secondary instance: the VM is stopped right after machine init
+ * and restored from the primary instance snapshot, which already
+ * went through afl_handle_start_fuzzing().
+ */
+#ifdef AFL_SHARED_SNAPSHOT
+static void afl_handle_attach(afl_t *afl)
+{
+   debug("--> vm attach()\n");
+   afl->shared.attach = false;
+   afl_attach_vm(afl);
+#ifdef AFL_RAM_GUARD
+   /* guard windows live in host state, not in the shared snapshot */
+   afl_arch_ram_guard_setup(afl);
+#endif
+   afl_say_hello(afl);
+   afl_run_target(afl);
+}
+#endif
+
 /*
  * When running with KVM, it seems unsafe to change vm state inside a
  * vm_state_change_handler(). The vcpu is running very slowly. When
@@ -308,6 +497,13 @@ static void afl_handle_start_fuzzing(afl_t *afl)
 static void async_restore_vm(CPUState *cpu, run_on_cpu_data data)
 {
     afl_t *afl = (afl_t*)data.host_ptr;
+
+#ifdef AFL_SHARED_SNAPSHOT
+    if (afl->shared.attach) {
+       afl_handle_attach(afl);
+       return;
+    }
+#endif
     afl_reload_forward(afl);
 }
 
@@ -363,6 +559,9 @@ static void async_panic_vm(CPUState *cpu, run_on_cpu_data data)
 
    debug("excp #%d @ 0x"TARGET_FMT_lx"\n",
          intno, afl_get_pc(&afl->arch));
+#ifdef AFL_CRASH_TRIAGE
+   afl->triage.excp = intno;
+#endif
 
    afl_handle_abort(afl);
 }
@@ -383,6 +582,8 @@ void afl_vm_state_change(void *opaque, int running, RunState state)
       return;
    }
 
+   afl_stats_stop();
+
    if (state == RUN_STATE_SHUTDOWN) {
       debug("vm is shutting down\n");
       afl_cleanup(afl);
@@ -391,9 +592,27 @@ void afl_vm_state_change(void *opaque, int running, RunState state)
 
    // XXX: do it only on async handlers ?
    cpu_synchronize_state(cpu);
+#ifdef AFL_PERSISTENT_TB
+   afl_tb_invalidate(afl);
+#else
    if (!kvm_enabled()) {
       tb_flush(cpu);
    }
+#endif
+
+#ifdef AFL_INSN_BUDGET
+   /* instruction budget exhausted, simulate AFL timeout */
+   if (state == RUN_STATE_RESTORE_VM &&
+       afl_tcg.budget_on && afl_tcg.budget <= 0) {
+      debug("--> vm timeout() (instruction budget)\n");
+      afl->status = sts_kill();
+   }
+   /* test case is over (breakpoints may resume it),
+    * re-armed by afl_prepare_target() */
+   if (state != RUN_STATE_DEBUG) {
+      afl_tcg.budget_on = false;
+   }
+#endif
 
    /* VM async request RESTORE_VM, cf. afl_user_timeout_cb() */
    if (state == RUN_STATE_RESTORE_VM) {
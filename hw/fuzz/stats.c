@@ -0,0 +1,160 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * performance counters
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+#include "qemu/afl.h"
+#include "qemu/host-utils.h"
+#include "qapi/qapi-commands-target.h"
+#include "monitor/monitor.h"
+#include "hmp.h"
+
+/*
+ * Phases are timed with the host cycle counter and accumulated into
+ * log2 histograms. Nothing is logged: counters are only read through
+ * QMP 'query-gustave-stats' or HMP 'info gustave'.
+ */
+#define AFL_STATS_BUCKETS 64
+
+typedef struct afl_phase_stats
+{
+   uint64_t count;
+   uint64_t total;
+   uint64_t min;
+   uint64_t max;
+   uint64_t hist[AFL_STATS_BUCKETS];
+
+} afl_phase_stats_t;
+
+typedef struct afl_stats
+{
+   bool              enabled;
+   uint64_t          iterations;
+   int64_t           exec_start;
+   afl_phase_stats_t phases[GUSTAVE_PHASE__MAX];
+
+} afl_stats_t;
+
+static afl_stats_t afl_stats;
+
+#ifdef AFL_STATS
+void afl_stats_init(void)
+{
+   afl_stats.enabled = true;
+}
+
+void afl_stats_end(GustavePhase phase, int64_t start)
+{
+   afl_phase_stats_t *ps = &afl_stats.phases[phase];
+   uint64_t           d  = cpu_get_host_ticks() - start;
+
+   if (!ps->count || d < ps->min)
+      ps->min = d;
+   if (d > ps->max)
+      ps->max = d;
+
+   ps->count++;
+   ps->total += d;
+   ps->hist[d ? 63 - clz64(d) : 0]++;
+}
+
+void afl_stats_resume(void)
+{
+   afl_stats.exec_start = cpu_get_host_ticks();
+}
+
+void afl_stats_stop(void)
+{
+   if (afl_stats.exec_start) {
+      afl_stats_end(GUSTAVE_PHASE_EXEC, afl_stats.exec_start);
+      afl_stats.exec_start = 0;
+   }
+}
+
+void afl_stats_iteration(void)
+{
+   afl_stats.iterations++;
+}
+#endif
+
+GustaveStats *qmp_query_gustave_stats(Error **errp)
+{
+   GustaveStats *stats;
+   GustavePhaseStatsList **tail;
+   int phase, len;
+
+   if (!afl_stats.enabled) {
+      error_setg(errp, "GUSTAVE statistics are not available");
+      return NULL;
+   }
+
+   stats = g_new0(GustaveStats, 1);
+   stats->iterations = afl_stats.iterations;
+   tail = &stats->phases;
+
+   for (phase = 0 ; phase < GUSTAVE_PHASE__MAX ; phase++) {
+      afl_phase_stats_t     *ps   = &afl_stats.phases[phase];
+      GustavePhaseStats     *info = g_new0(GustavePhaseStats, 1);
+      GustavePhaseStatsList *elm  = g_new0(GustavePhaseStatsList, 1);
+      uint64List           **hist = &info->histogram;
+
+      info->phase = phase;
+      info->count = ps->count;
+      info->total = ps->total;
+      info->min   = ps->min;
+      info->max   = ps->max;
+
+      for (len = AFL_STATS_BUCKETS ; len && !ps->hist[len - 1] ; len--);
+      for (int i = 0 ; i < len ; i++) {
+         *hist = g_new0(uint64List, 1);
+         (*hist)->value = ps->hist[i];
+         hist = &(*hist)->next;
+      }
+
+      elm->value = info;
+      *tail = elm;
+      tail = &elm->next;
+   }
+
+   return stats;
+}
+
+void hmp_info_gustave(Monitor *mon, const QDict *qdict)
+{
+   Error *err = NULL;
+   GustaveStats *stats = qmp_query_gustave_stats(&err);
+   GustavePhaseStatsList *elm;
+   uint64List *hist;
+   int i;
+
+   if (err) {
+      monitor_printf(mon, "%s\n", error_get_pretty(err));
+      error_free(err);
+      return;
+   }
+
+   monitor_printf(mon, "iterations: %" PRIu64 "\n", stats->iterations);
+   monitor_printf(mon, "%-16s %12s %16s %12s %12s %12s\n",
+                  "phase", "count", "total", "avg", "min", "max");
+
+   for (elm = stats->phases ; elm ; elm = elm->next) {
+      GustavePhaseStats *ps = elm->value;
+
+      monitor_printf(mon, "%-16s %12" PRIu64 " %16" PRIu64 " %12" PRIu64
+                     " %12" PRIu64 " %12" PRIu64 "\n",
+                     GustavePhase_str(ps->phase), ps->count, ps->total,
+                     ps->count ? ps->total / ps->count : 0,
+                     ps->min, ps->max);
+
+      for (hist = ps->histogram, i = 0 ; hist ; hist = hist->next, i++) {
+         if (hist->value) {
+            monitor_printf(mon, "%16s [2^%-2d] %12" PRIu64 "\n",
+                           "", i, hist->value);
+         }
+      }
+   }
+
+   qapi_free_GustaveStats(stats);
+}
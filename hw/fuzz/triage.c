@@ -0,0 +1,136 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * crash triage
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+#include "qemu/afl.h"
+
+#ifdef AFL_CRASH_TRIAGE
+/*
+ * Each crash is identified by a hash of its faulting pc and guest
+ * call stack. The first crash of a given hash gets a record in the
+ * crash directory, named after the hash:
+ *
+ *  - status, intercepted exception and faulting pc
+ *  - guest backtrace
+ *  - last executed TB addresses (TCG only), newest first
+ *  - CPU state
+ *
+ * Later crashes with the same hash are only counted.
+ */
+#define AFL_TRIAGE_FRAMES  16
+
+static uint64_t afl_triage_hash(target_ulong pc, target_ulong *frames, int n)
+{
+   uint64_t h = 0xcbf29ce484222325ULL;
+   int      i;
+
+   h = (h ^ pc) * 0x100000001b3ULL;
+   for (i = 0 ; i < n ; i++) {
+      h = (h ^ frames[i]) * 0x100000001b3ULL;
+   }
+   return h;
+}
+
+static void afl_triage_record(afl_t *afl, FILE *f, uint64_t hash,
+                              target_ulong pc, target_ulong *frames, int n)
+{
+   CPUState *cpu = CPU(afl->arch.cpu);
+   int       i;
+
+   fprintf(f, "status  0x%x\n", afl->status);
+   if (afl->triage.excp < 0) {
+      fprintf(f, "excp    panic\n");
+   } else {
+      fprintf(f, "excp    %d\n", afl->triage.excp - EXCP_INTERCEPT);
+   }
+   fprintf(f, "pc      0x"TARGET_FMT_lx"\n", pc);
+   fprintf(f, "hash    0x%016"PRIx64"\n", hash);
+
+   fprintf(f, "backtrace\n");
+   for (i = 0 ; i < n ; i++) {
+      fprintf(f, "  #%-2d 0x"TARGET_FMT_lx"\n", i, frames[i]);
+   }
+
+   if (afl_tcg.tb_ring) {
+      fprintf(f, "last tbs\n");
+      for (i = 0 ; i < AFL_TB_RING ; i++) {
+         uint32_t k = (cpu->afl_tb_ring_idx - i) & (AFL_TB_RING - 1);
+         if (cpu->afl_tb_ring_pc[k]) {
+            fprintf(f, "  0x%"PRIx64"\n", cpu->afl_tb_ring_pc[k]);
+         }
+      }
+   }
+
+   fprintf(f, "cpu\n");
+   cpu_dump_state(cpu, f, CPU_DUMP_FPU);
+}
+
+void afl_triage_crash(afl_t *afl)
+{
+   afl_triage_t *triage = &afl->triage;
+   target_ulong  frames[AFL_TRIAGE_FRAMES];
+   target_ulong  pc;
+   uint64_t      hash;
+   char         *path;
+   FILE         *f;
+   int           n;
+
+   cpu_synchronize_state(CPU(afl->arch.cpu));
+
+   pc   = afl_get_pc(&afl->arch);
+   n    = afl_arch_backtrace(afl, frames, AFL_TRIAGE_FRAMES);
+   hash = afl_triage_hash(pc, frames, n);
+
+   triage->crashes++;
+   if (g_hash_table_contains(triage->seen, &hash)) {
+      goto out;
+   }
+
+   g_hash_table_add(triage->seen, g_memdup(&hash, sizeof(hash)));
+   triage->unique++;
+
+   path = g_strdup_printf("%s/%016"PRIx64, afl->config.qemu.crash_dir, hash);
+   f = fopen(path, "w");
+   if (!f) {
+      error_report("can't write crash record '%s'", path);
+      exit(EXIT_FAILURE);
+   }
+   afl_triage_record(afl, f, hash, pc, frames, n);
+   fclose(f);
+   g_free(path);
+
+   debug("new crash 0x%016"PRIx64" (%"PRIu64"/%"PRIu64")\n",
+         hash, triage->unique, triage->crashes);
+
+out:
+   triage->excp = -1;
+}
+
+void afl_init_triage(afl_t *afl)
+{
+   if (g_mkdir_with_parents(afl->config.qemu.crash_dir, 0700) < 0) {
+      error_report("can't create crash directory '%s'",
+                   afl->config.qemu.crash_dir);
+      exit(EXIT_FAILURE);
+   }
+
+   afl->triage.seen = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                            g_free, NULL);
+   afl->triage.excp = -1;
+
+   /* TB addresses are recorded by TCG generated code */
+   afl_tcg.tb_ring = !kvm_enabled();
+}
+
+void afl_triage_cleanup(afl_t *afl)
+{
+   if (afl->triage.seen) {
+      debug("crashes: %"PRIu64", unique: %"PRIu64"\n",
+            afl->triage.crashes, afl->triage.unique);
+      g_hash_table_destroy(afl->triage.seen);
+   }
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * replayable in-memory savevm stream
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+#include "qemu/osdep.h"
+#include "migration/qemu-file-types.h"
+#include "migration/qemu-file.h"
+#include "migration/qemu-file-channel.h"
+#include "qemu/afl-vmb.h"
+
+/*
+ * Both QEMUFile share the same buffer channel and are kept opened:
+ * closing one would release the buffer. We rewind the channel as
+ * done by COLO for cached device state, so that a stream is saved
+ * once and loaded many times without any syscall.
+ *
+ * Target independent, so that tests/benchmark-vmstate-replay uses
+ * the very same code.
+ */
+void afl_vmb_init(afl_vmb_t *vmb, size_t capacity)
+{
+   vmb->bioc = qio_channel_buffer_new(capacity);
+   vmb->out  = qemu_fopen_channel_output(QIO_CHANNEL(vmb->bioc));
+   vmb->in   = qemu_fopen_channel_input(QIO_CHANNEL(vmb->bioc));
+   object_unref(OBJECT(vmb->bioc));
+}
+
+/* size hint prevents the buffer from growing on each write */
+QEMUFile* afl_vmb_writer(afl_vmb_t *vmb, size_t hint)
+{
+   QIOChannelBuffer *bioc = vmb->bioc;
+
+   if (bioc->capacity < hint) {
+      bioc->capacity = hint;
+      bioc->data = g_realloc(bioc->data, bioc->capacity);
+   }
+
+   qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
+   bioc->usage = 0;
+   return vmb->out;
+}
+
+QEMUFile* afl_vmb_reader(afl_vmb_t *vmb)
+{
+   qio_channel_io_seek(QIO_CHANNEL(vmb->bioc), 0, 0, NULL);
+   return vmb->in;
+}
+
+void afl_vmb_cleanup(afl_vmb_t *vmb)
+{
+   if (vmb->in)
+      qemu_fclose(vmb->in);
+   if (vmb->out)
+      qemu_fclose(vmb->out);
+   vmb->in = vmb->out = NULL;
+}
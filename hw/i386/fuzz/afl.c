@@ -71,7 +71,7 @@ void afl_arch_ram_guard_setup(afl_t *afl)
    uint32_t *hpgd, *hptb, gptb;
    uint32_t f, i, m, n;
 
-   if (atop < (vtop + 3*PAGE_SIZE)) {
+   if (atop < (vtop + 4*PAGE_SIZE)) {
       error_report("not enough RAM to inject PTB (0x%x/0x%x)", atop, vtop);
       exit(EXIT_FAILURE);
    }
@@ -113,17 +113,175 @@ void afl_arch_ram_guard_setup(afl_t *afl)
    debug("ramguard: (trace) idmap %d 4KB pg from frame 0x%x\n",
          afl->config.afl.trace_size/PAGE_SIZE, f);
 
+#ifdef AFL_KVM_DOORBELL
+   // map doorbell, sharing trace page table when possible
+   n = pd32_idx(afl->config.tgt.doorbell);
+   m = pt32_idx(afl->config.tgt.doorbell);
+   f = page_nr(afl->config.tgt.doorbell);
+   if (n != pd32_idx(afl->config.afl.trace_addr)) {
+      gptb = atop - 4*PAGE_SIZE;
+      hptb = (uint32_t*)(afl->ram_ptr + gptb);
+      memset((void*)hptb, 0, PAGE_SIZE);
+      pg_set_entry(&hpgd[n], PG_FULL, page_nr(gptb));
+   }
+   pg_set_entry(&hptb[m], PG_FULL, f);
+   debug("ramguard: (doorbell) idmap 4KB pg frame 0x%x\n", f);
+#endif
+
    // enable paging
    CPUX86State *env = &afl->cpu->env;
    env->cr[0] |= CR0_PG_MASK;
    env->cr[4] |= CR4_PGE_MASK;
    cpu_x86_update_cr3(env, gpgd);
-   afl_mem_invalidate(afl->ram_mr, gpgd, 3*PAGE_SIZE);
+   afl_mem_invalidate(afl->ram_mr, atop - 4*PAGE_SIZE, 4*PAGE_SIZE);
 
    debug("ramguard: enabled\n");
 }
 #endif
 
+#ifdef AFL_KVM_DOORBELL
+size_t afl_arch_gen_doorbell(afl_t *afl, uint8_t *out)
+{
+   out[0] = 0xa3; // mov %eax, moffs32
+   stl_le_p(&out[1], afl->config.tgt.doorbell);
+   return AFL_DOORBELL_SIZE;
+}
+#endif
+
+#ifdef AFL_CRASH_TRIAGE
+/* stack slot of the current code size */
+static target_ulong afl_ld_slot(const uint8_t *buf, int size)
+{
+   switch (size) {
+   case 8:
+      return ldq_le_p(buf);
+   case 4:
+      return (uint32_t)ldl_le_p(buf);
+   default:
+      return lduw_le_p(buf);
+   }
+}
+
+/*
+ * Frame pointer chain, slots of 2, 4 or 8 bytes
+ * depending on the 16, 32 or 64 bits code segment:
+ *   [ebp] caller ebp, [ebp+size] return address
+ */
+int afl_arch_backtrace(afl_t *afl, target_ulong *frames, int max)
+{
+   CPUState     *cpu  = CPU(afl->arch.cpu);
+   CPUX86State  *env  = &afl->arch.cpu->env;
+   target_ulong  fp   = env->regs[R_EBP];
+   target_ulong  base = 0;
+   uint8_t       buf[16];
+   int           size, n;
+
+   if (env->hflags & HF_CS64_MASK) {
+      size = 8;
+   } else {
+      size = (env->hflags & HF_CS32_MASK) ? 4 : 2;
+      fp  &= (size == 4) ? 0xffffffff : 0xffff;
+      base = env->segs[R_SS].base;
+   }
+
+   for (n = 0 ; n < max && fp ; n++) {
+      target_ulong next;
+
+      if (cpu_memory_rw_debug(cpu, base + fp, buf, 2*size, 0) < 0)
+         break;
+
+      next      = afl_ld_slot(&buf[0], size);
+      frames[n] = afl_ld_slot(&buf[size], size);
+
+      /* stack grows down */
+      if (next <= fp)
+         return n + 1;
+
+      fp = next;
+   }
+   return n;
+}
+#endif
+
+#ifdef AFL_GEN_TABLE
+/*
+ * POK syscall template: pointed areas are pushed on the stack and
+ * their address kept in a register, then arguments, their number and
+ * the syscall id are set up before 'int 42'.
+ */
+static void afl_gen_push_imm(afl_gen_syscall_t *sc, uint32_t imm)
+{
+   uint8_t insn[5] = { 0x68 };
+
+   stl_le_p(&insn[1], imm);
+   afl_gen_emit(sc, insn, sizeof(insn));
+}
+
+static void afl_gen_push_input(afl_gen_syscall_t *sc, size_t in)
+{
+   static const uint8_t push = 0x68;
+
+   afl_gen_emit(sc, &push, 1);
+   afl_gen_emit_hole(sc, in, 4);
+}
+
+void afl_arch_gen_template(afl_gen_syscall_t *sc)
+{
+   uint8_t  regs[AFL_GEN_MAX_ARGS];
+   uint8_t  insn[5];
+   uint8_t  reg = 0;
+   uint32_t i, j;
+
+   for (i = 0 ; i < sc->nbargs ; i++) {
+      if (!sc->sizes[i])
+         continue;
+
+      if (reg > R_EBX) {
+         error_report("gen-syscalls id %u: too many pointers", sc->id);
+         exit(EXIT_FAILURE);
+      }
+
+      for (j = 0 ; j < sc->sizes[i] ; j += 4)
+         afl_gen_push_input(sc, sc->in_off[i] + j);
+
+      // mov %esp, %e{a,c,d,b}x
+      insn[0] = 0x89;
+      insn[1] = 0xe0 | reg;
+      afl_gen_emit(sc, insn, 2);
+      regs[i] = reg++;
+   }
+
+   for (i = AFL_GEN_MAX_ARGS ; i > 0 ; i--) {
+      if (i > sc->nbargs) {
+         afl_gen_push_imm(sc, 0);
+      } else if (!sc->sizes[i-1]) {
+         afl_gen_push_input(sc, sc->in_off[i-1]);
+      } else {
+         // push %e{a,c,d,b}x
+         insn[0] = 0x50 | regs[i-1];
+         afl_gen_emit(sc, insn, 1);
+      }
+   }
+
+   afl_gen_push_imm(sc, sc->nbargs);
+
+   // mov %esp, %ebx
+   insn[0] = 0x89;
+   insn[1] = 0xe3;
+   afl_gen_emit(sc, insn, 2);
+
+   // mov id, %eax
+   insn[0] = 0xb8;
+   stl_le_p(&insn[1], sc->id);
+   afl_gen_emit(sc, insn, 5);
+
+   // int 42
+   insn[0] = 0xcd;
+   insn[1] = 42;
+   afl_gen_emit(sc, insn, 2);
+}
+#endif
+
 void afl_init_arch(afl_t *afl, MachineState *mcs, MemoryRegion *sysmem)
 {
    CPUState *cpu = first_cpu;
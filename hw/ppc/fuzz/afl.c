@@ -16,7 +16,118 @@ static void ppc_afl_reset(void *opaque)
 #ifdef AFL_RAM_GUARD
 void afl_arch_ram_guard_setup(afl_t *afl)
 {
-   debug("ramguard: NOT IMPLEMENTED !\n");
+   afl_ram_guard_tcg(afl, POWERPC_EXCP_DSI);
+}
+#endif
+
+#ifdef AFL_KVM_DOORBELL
+size_t afl_arch_gen_doorbell(afl_t *afl, uint8_t *out)
+{
+   target_ulong db = afl->config.tgt.doorbell;
+
+   // lis r11, db@ha ; stw r0, db@l(r11)
+   stl_be_p(&out[0], (15u<<26)|(11<<21)|(((db + 0x8000) >> 16) & 0xffff));
+   stl_be_p(&out[4], (36u<<26)|(11<<16)|(db & 0xffff));
+   return AFL_DOORBELL_SIZE;
+}
+#endif
+
+#ifdef AFL_CRASH_TRIAGE
+/*
+ * SVR4 32 bits back chain:
+ *   [r1] caller frame, [frame+4] saved LR
+ * The innermost return address is still in LR.
+ */
+int afl_arch_backtrace(afl_t *afl, target_ulong *frames, int max)
+{
+   CPUState    *cpu = CPU(afl->arch.cpu);
+   target_ulong sp  = afl->arch.cpu->env.gpr[1];
+   uint8_t      buf[4];
+   int          n   = 0;
+
+   if (max)
+      frames[n++] = afl->arch.cpu->env.lr;
+
+   while (n < max && sp) {
+      target_ulong next;
+
+      if (cpu_memory_rw_debug(cpu, sp, buf, sizeof(buf), 0) < 0)
+         break;
+
+      next = ldl_be_p(buf);
+      if (next <= sp ||
+          cpu_memory_rw_debug(cpu, next + 4, buf, sizeof(buf), 0) < 0)
+         break;
+
+      frames[n++] = ldl_be_p(buf);
+      sp = next;
+   }
+   return n;
+}
+#endif
+
+#ifdef AFL_GEN_TABLE
+/*
+ * POK syscall template: arguments in r4-r8, pointed areas stored in
+ * a stack frame, syscall id in r3 before 'sc'.
+ */
+static void afl_gen_insn(afl_gen_syscall_t *sc, uint32_t insn)
+{
+   uint8_t code[4];
+
+   stl_be_p(code, insn);
+   afl_gen_emit(sc, code, sizeof(code));
+}
+
+/* immediate field is taken from input */
+static void afl_gen_insn_input(afl_gen_syscall_t *sc, uint32_t insn, size_t in)
+{
+   uint8_t code[2];
+
+   stw_be_p(code, insn >> 16);
+   afl_gen_emit(sc, code, sizeof(code));
+   afl_gen_emit_hole(sc, in, 2);
+}
+
+#define PPC_LIS(rd)          ((15u<<26)|((rd)<<21))
+#define PPC_ORI(ra, rs)      ((24u<<26)|((rs)<<21)|((ra)<<16))
+#define PPC_MR(ra, rs)       ((31u<<26)|((rs)<<21)|((ra)<<16)|((rs)<<11)|(444<<1))
+#define PPC_STWU(rs, ra, d)  ((37u<<26)|((rs)<<21)|((ra)<<16)|((d)&0xffff))
+#define PPC_STW(rs, ra, d)   ((36u<<26)|((rs)<<21)|((ra)<<16)|((d)&0xffff))
+#define PPC_ADDI(rd, ra, si) ((14u<<26)|((rd)<<21)|((ra)<<16)|((si)&0xffff))
+#define PPC_SC               0x44000002
+
+void afl_arch_gen_template(afl_gen_syscall_t *sc)
+{
+   uint32_t frame = 0;
+   uint32_t i, j, r;
+
+   for (i = 0 ; i < sc->nbargs ; i++) {
+      r = i + 4;
+
+      if (!sc->sizes[i]) {
+         afl_gen_insn_input(sc, PPC_LIS(r), sc->in_off[i]);
+         afl_gen_insn_input(sc, PPC_ORI(r, r), sc->in_off[i] + 2);
+         continue;
+      }
+
+      afl_gen_insn(sc, PPC_MR(r, 1));
+      afl_gen_insn(sc, PPC_STWU(1, 1, -sc->sizes[i]));
+      for (j = 0 ; j < sc->sizes[i] ; j += 4) {
+         afl_gen_insn_input(sc, PPC_LIS(27), sc->in_off[i] + j);
+         afl_gen_insn_input(sc, PPC_ORI(27, 27), sc->in_off[i] + j + 2);
+         afl_gen_insn(sc, PPC_STW(27, 1, j + 4));
+      }
+      frame += sc->sizes[i];
+   }
+
+   // li r3, id
+   afl_gen_insn(sc, PPC_ADDI(3, 0, sc->id));
+   afl_gen_insn(sc, PPC_SC);
+
+   if (frame) {
+      afl_gen_insn(sc, PPC_ADDI(1, 1, frame));
+   }
 }
 #endif
 
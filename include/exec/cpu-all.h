@@ -32,6 +32,7 @@
 #define EXCP_HALTED     0x10003 /* cpu is halted (waiting for external event) */
 #define EXCP_YIELD      0x10004 /* cpu wants to yield timeslice to another */
 #define EXCP_ATOMIC     0x10005 /* stop-the-world and emulate atomic */
+#define EXCP_AFL_BUDGET 0x10006 /* AFL test case instruction budget exhausted */
 #define EXCP_INTERCEPT  0x20000 /* event interception */
 
 /* some important defines:
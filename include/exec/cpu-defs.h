@@ -61,6 +61,14 @@ typedef uint64_t target_ulong;
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
+/*
+ * Entries evicted from the victim tlb go to a set-associative
+ * second-level tlb of 64 sets of 4 ways, indexed by virtual page.
+ */
+#define CPU_L2TLB_SET_BITS 6
+#define CPU_L2TLB_WAYS 4
+#define CPU_L2TLB_SIZE ((1 << CPU_L2TLB_SET_BITS) * CPU_L2TLB_WAYS)
+
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -152,6 +160,22 @@ typedef struct CPUTLBDesc {
     size_t vindex;
     CPUTLBWindow window;
     size_t n_used_entries;
+    /*
+     * The second-level tlb, CPU_L2TLB_WAYS consecutive entries per set,
+     * most recently used first.  Protected by tlb_c.lock.
+     */
+    CPUTLBEntry *l2_table;
+    CPUIOTLBEntry *l2_iotlb;
+    /*
+     * Statistics, read and written atomically like those of CPUTLBCommon.
+     * A miss is a lookup that left the inline fast path; it hits in the
+     * victim tlb, in the second-level tlb, or ends in a fill.  Fills are
+     * counted for every entry installed by tlb_set_page_with_attrs().
+     */
+    size_t miss_count;
+    size_t vtlb_hit_count;
+    size_t l2_hit_count;
+    size_t fill_count;
 } CPUTLBDesc;
 
 /*
@@ -174,6 +198,11 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /*
+     * The last fill was refused by the AFL RAM guard.
+     * Only accessed by the owning vCPU.
+     */
+    bool afl_guard_hit;
 } CPUTLBCommon;
 
 # define CPU_TLB                                                        \
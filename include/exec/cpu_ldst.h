@@ -403,6 +403,14 @@ static inline CPUTLBEntry *tlb_entry(CPUArchState *env, uintptr_t mmu_idx,
 #undef CPU_MMU_INDEX
 #undef MEMSUFFIX
 
+/*
+ * Background translation threads read guest code from a snapshot
+ * instead of the vCPU TLB (see translate-all.c and exec-all.h).
+ */
+struct TBCodeView;
+extern __thread struct TBCodeView *tb_code_view;
+void tb_code_view_read(target_ulong addr, uint8_t *buf, int size);
+
 #define CPU_MMU_INDEX (cpu_mmu_index(env, true))
 #define MEMSUFFIX _code
 #define SOFTMMU_CODE_ACCESS
@@ -94,6 +94,14 @@ glue(glue(glue(cpu_ld, USUFFIX), MEMSUFFIX), _ra)(CPUArchState *env,
 #endif
 
     addr = ptr;
+#ifdef SOFTMMU_CODE_ACCESS
+    if (unlikely(tb_code_view)) {
+        uint8_t buf[DATA_SIZE];
+
+        tb_code_view_read(addr, buf, DATA_SIZE);
+        return glue(glue(ld, USUFFIX), _p)(buf);
+    }
+#endif
     mmu_idx = CPU_MMU_INDEX;
     entry = tlb_entry(env, mmu_idx, addr);
     if (unlikely(entry->ADDR_READ !=
@@ -133,6 +141,14 @@ glue(glue(glue(cpu_lds, SUFFIX), MEMSUFFIX), _ra)(CPUArchState *env,
 #endif
 
     addr = ptr;
+#ifdef SOFTMMU_CODE_ACCESS
+    if (unlikely(tb_code_view)) {
+        uint8_t buf[DATA_SIZE];
+
+        tb_code_view_read(addr, buf, DATA_SIZE);
+        return glue(glue(lds, SUFFIX), _p)(buf);
+    }
+#endif
     mmu_idx = CPU_MMU_INDEX;
     entry = tlb_entry(env, mmu_idx, addr);
     if (unlikely(entry->ADDR_READ !=
@@ -351,6 +351,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_TRACE       0x00100000 /* Superblock of a hot path */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 /* cflags' mask for hashing/comparison */
@@ -360,6 +361,9 @@ struct TranslationBlock {
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /* Executions, counted for superblock formation */
+    uint32_t trace_count;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -384,6 +388,12 @@ struct TranslationBlock {
 #define TB_JMP_RESET_OFFSET_INVALID 0xffff /* indicates no jump generated */
     uintptr_t jmp_target_arg[2];  /* target address or offset */
 
+    /* Offset of the code that jumps from other TBs enter, past the loads
+     * of the pinned globals done when entering from cpu_exec.
+     * See tcg_global_pin_internal().
+     */
+    uint16_t chain_offset;
+
     /*
      * Each TB has a NULL-terminated list (jmp_list_head) of incoming jumps.
      * Each TB can have two outgoing jumps, and therefore can participate
@@ -435,6 +445,39 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    uint32_t cf_mask);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
+/* Superblocks, cf. translator_trace_goto() */
+extern uint32_t tb_trace_threshold;
+extern unsigned int tb_bg_threads;
+void tb_trace_hot(TranslationBlock *tb);
+bool tb_trace_count(CPUState *cpu, TranslationBlock *tb, target_ulong pc,
+                    uint32_t *count);
+
+/*
+ * Snapshot taken by the vCPU when queueing a background translation,
+ * cf. tb_bg_queue(). The helper thread reads the guest code and vCPU
+ * state from it, never from the live vCPU.
+ */
+#define TB_CODE_VIEW_BPS   8
+#define TB_CODE_VIEW_SUCC  32
+
+struct TBCodeView {
+    /* guest code of the TB pages */
+    target_ulong vaddr;
+    uint8_t data[2][TARGET_PAGE_SIZE];
+    bool valid[2];
+    /* cpu_mmu_index(env, false) */
+    int mmu_idx;
+    /* breakpoints within the TB pages */
+    QTAILQ_HEAD(, CPUBreakpoint) breakpoints;
+    CPUBreakpoint bps[TB_CODE_VIEW_BPS];
+    /* execution counts of the TBs starting in the first page */
+    int nb_succ;
+    struct {
+        target_ulong pc;
+        uint32_t trace_count;
+    } succ[TB_CODE_VIEW_SUCC];
+};
+
 /* GETPC is the true target of the return instruction that we'll execute.  */
 #if defined(CONFIG_TCG_INTERPRETER)
 extern uintptr_t tci_tb_ptr;
@@ -60,6 +60,13 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @trace_count: Executions of the current block, when forming a superblock.
+ * @trace_next: Address of the next block on the hot path.
+ * @trace_label: Start of the next block, once its jump is followed.
+ * @trace_br: Branch to @trace_label.
+ * @trace_entry: Superblock entry, target of its loop back edges.
+ * @trace_blocks: Number of blocks followed.
+ * @trace_slots: Number of direct jump slots used.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -71,6 +78,13 @@ typedef struct DisasContextBase {
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    uint32_t trace_count;
+    target_ulong trace_next;
+    TCGLabel *trace_label;
+    TCGOp *trace_br;
+    TCGLabel *trace_entry;
+    int trace_blocks;
+    int trace_slots;
 } DisasContextBase;
 
 /**
@@ -105,6 +119,10 @@ typedef struct DisasContextBase {
  *
  * @disas_log:
  *      Print instruction disassembly to log.
+ *
+ * @superblock:
+ *      The target direct jumps go through translator_trace_goto() and
+ *      translator_goto_tb_slot(), its TBs may be turned into superblocks.
  */
 typedef struct TranslatorOps {
     void (*init_disas_context)(DisasContextBase *db, CPUState *cpu);
@@ -115,6 +133,7 @@ typedef struct TranslatorOps {
     void (*translate_insn)(DisasContextBase *db, CPUState *cpu);
     void (*tb_stop)(DisasContextBase *db, CPUState *cpu);
     void (*disas_log)(const DisasContextBase *db, CPUState *cpu);
+    bool superblock;
 } TranslatorOps;
 
 /**
@@ -142,4 +161,66 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * translator_trace_goto:
+ * @db: Disassembly context.
+ * @dest: Guest address of a direct jump target.
+ *
+ * When forming a superblock, follow the jump to @dest if it is on the
+ * hot path. A branch to the next block has then been emitted in place
+ * of the jump: the target sets db->is_jmp to DISAS_NORETURN, and
+ * translation continues at @dest once the current insn is done.
+ * Code the target emits after the branch must end the TB.
+ * A jump back to the superblock entry becomes a branch to its start.
+ *
+ * Returns: true if the jump was followed.
+ */
+bool translator_trace_goto(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_trace_hot:
+ * @db: Disassembly context.
+ * @dest: Guest address of a direct jump target.
+ *
+ * Returns: true if translator_trace_goto() would follow the jump to
+ * @dest. A conditional jump whose taken arm is hot should then be
+ * emitted with the inverse condition, so that the hot path falls
+ * through the branch and the cold arm becomes a side exit.
+ */
+bool translator_trace_hot(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_goto_tb_slot:
+ * @db: Disassembly context.
+ * @n: Direct jump slot the target would use.
+ *
+ * Superblocks have more exits than direct jump slots. Slots are then
+ * handed out in order, the remaining exits must use an indirect jump.
+ *
+ * Returns: the slot for tcg_gen_goto_tb() and tcg_gen_exit_tb(), or -1.
+ */
+int translator_goto_tb_slot(DisasContextBase *db, int n);
+
+/**
+ * gen_afl_cmplog:
+ * @pc: guest address of the compare instruction
+ * @arg0: first operand
+ * @arg1: second operand
+ * @ot: operands size
+ *
+ * Log compare operands into the AFL board compare map, when enabled
+ * and @pc lies into the configured range.
+ */
+void gen_afl_cmplog(target_ulong pc, TCGv arg0, TCGv arg1, TCGMemOp ot);
+
+/**
+ * translator_afl_instrumented:
+ * @pc: guest address of the first instruction
+ * @size: guest code size
+ *
+ * Whether AFL instrumentation would be generated for guest code
+ * in [@pc, @pc + @size).
+ */
+bool translator_afl_instrumented(target_ulong pc, target_ulong size);
+
 #endif  /* EXEC__TRANSLATOR_H */
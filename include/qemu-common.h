@@ -79,6 +79,9 @@ int qemu_openpty_raw(int *aslave, char *pty_name);
 
 extern bool tcg_allowed;
 void tcg_exec_init(unsigned long tb_size);
+void tb_cache_init(const char *path, Error **errp);
+void perf_enable_perfmap(Error **errp);
+void perf_enable_jitdump(Error **errp);
 #ifdef CONFIG_TCG
 #define tcg_enabled() (tcg_allowed)
 #else
@@ -0,0 +1,89 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * TCG instrumentation interface
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+
+#ifndef __AFL_TCG_H__
+#define __AFL_TCG_H__
+
+/*
+ * Compare operands log, shared with the fuzzer for input-to-state
+ * replacement. Each instrumented compare site hashes to a header
+ * counting its hits, and a ring of AFL_CMP_MAP_H operand pairs.
+ */
+#define AFL_CMP_MAP_W  8192
+#define AFL_CMP_MAP_H  32
+
+/* Guest physical windows allowed by the RAM guard */
+#define AFL_GUARD_WIN  4
+
+typedef struct afl_guard_window
+{
+   uint64_t    start;
+   uint64_t    end;
+
+} afl_guard_win_t;
+
+typedef struct afl_cmp_header
+{
+   uint32_t    hits;
+   uint32_t    size;        /* operands size in bytes */
+
+} afl_cmp_hdr_t;
+
+typedef struct afl_cmp_operands
+{
+   uint64_t    v0;
+   uint64_t    v1;
+
+} afl_cmp_ops_t;
+
+typedef struct afl_cmp_map
+{
+   afl_cmp_hdr_t headers[AFL_CMP_MAP_W];
+   afl_cmp_ops_t log[AFL_CMP_MAP_W][AFL_CMP_MAP_H];
+
+} afl_cmp_map_t;
+
+/*
+ * Board state consulted at translation time and by generated
+ * code. Kept apart from afl.h which is only usable by targets
+ * providing an AFL board.
+ */
+typedef struct afl_tcg_state
+{
+   bool        trace;       /* emit edge coverage at TB entry */
+   uint8_t    *trace_bits;  /* AFL coverage bitmap */
+   uint32_t    trace_mask;  /* coverage bitmap size - 1 */
+   uint64_t    trace_start; /* instrumented guest vaddr range */
+   uint64_t    trace_end;
+   uint32_t    prev_loc;    /* AFL previous block location */
+
+   bool           cmplog;       /* log compare operands */
+   afl_cmp_map_t *cmp_map;
+   uint64_t       cmplog_start; /* instrumented guest vaddr range */
+   uint64_t       cmplog_end;
+
+   bool        budget_on;   /* instruction budget armed (icount) */
+   int64_t     budget;      /* instructions left for the test case */
+
+   void      (*hook)(void*);   /* called before the insn at hook_pc */
+   void       *hook_opaque;
+   uint64_t    hook_pc;
+
+   bool            guard;       /* filter RAM TLB fills */
+   int             guard_excp;  /* intercepted exception to raise */
+   uint32_t        guard_nr;
+   afl_guard_win_t guard_win[AFL_GUARD_WIN];
+
+   bool        tb_ring;     /* record TB addresses in CPUState */
+
+} afl_tcg_t;
+
+extern afl_tcg_t afl_tcg;
+
+// __AFL_TCG_H__
+#endif
@@ -0,0 +1,29 @@
+/*
+ * QEMU American Fuzzy Lop board
+ * replayable in-memory savevm stream
+ *
+ * Copyright (c) 2019 S. Duverger Airbus
+ * GPLv2
+ */
+
+#ifndef __AFL_VMB_H__
+#define __AFL_VMB_H__
+
+#include "io/channel-buffer.h"
+
+/* Replayable in-memory savevm stream */
+typedef struct afl_vm_buffer
+{
+   QIOChannelBuffer *bioc;
+   QEMUFile         *out;
+   QEMUFile         *in;
+
+} afl_vmb_t;
+
+void      afl_vmb_init(afl_vmb_t*, size_t);
+void      afl_vmb_cleanup(afl_vmb_t*);
+QEMUFile* afl_vmb_writer(afl_vmb_t*, size_t);
+QEMUFile* afl_vmb_reader(afl_vmb_t*);
+
+// __AFL_VMB_H__
+#endif
@@ -18,6 +18,7 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
 #include "qapi/qapi-events-run-state.h"
+#include "qapi/qapi-types-target.h"
 #include "qapi/qmp/qerror.h"
 
 #include "cpu.h"
@@ -41,6 +42,7 @@
 #include "sysemu/arch_init.h"
 #include "sysemu/numa.h"
 #include "sysemu/kvm.h"
+#include "sysemu/cpus.h"
 
 #include "migration/migration.h"
 #include "migration/global_state.h"
@@ -51,6 +53,9 @@
 #include "migration/qemu-file-channel.h"
 #include "migration/savevm.h"
 #include "io/channel-file.h"
+#include "io/channel-buffer.h"
+#include "qemu/afl-tcg.h"
+#include "qemu/afl-vmb.h"
 
 #include <sys/types.h>
 #include <sys/shm.h>
@@ -68,15 +73,44 @@ typedef uint64_t u64;
 #define AFL_CONTACT              1
 #define AFL_INJECT_TESTCASE      1
 //#define AFL_DUMMY_CASE           1
+//#define AFL_GEN_TABLE            1
+//#define AFL_SHM_TESTCASE         1
+//#define AFL_BATCH                1
+//#define AFL_STANDALONE           1
 
 #define AFL_FAST_RESTORE         1
+//#define AFL_DIRTY_RESTORE        1
+//#define AFL_MEMORY_VMSTATE       1
+//#define AFL_PERSISTENT_TB        1
+//#define AFL_PERSISTENT           1
+//#define AFL_SHARED_SNAPSHOT      1
+//#define AFL_KVM_DOORBELL         1
+//#define AFL_INSN_BUDGET          1
 #define AFL_CONTROL_EXECUTION    1
 //#define AFL_CONTROL_EXEC_ZERO    1
 #define AFL_CONTROL_PANIC        1
 //#define AFL_CONTROL_CSWITCH      1
 #define AFL_RAM_GUARD            1
 //#define AFL_TRACE_MMIO           1
+//#define AFL_TRACE_TCG            1
+//#define AFL_TRACE_CMPLOG         1
 #define AFL_PRESERVE_TRACEMAP    1
+//#define AFL_STATS                1
+//#define AFL_CRASH_TRIAGE         1
+
+/* built-in fuzz loop replaces AFL */
+#ifdef AFL_STANDALONE
+#undef  AFL_CONTACT
+#ifdef AFL_BATCH
+#error "AFL_STANDALONE does not support AFL_BATCH"
+#endif
+#ifndef AFL_INJECT_TESTCASE
+#define AFL_INJECT_TESTCASE 1
+#endif
+#ifndef AFL_SHM_TESTCASE
+#define AFL_SHM_TESTCASE 1
+#endif
+#endif
 
 #ifdef AFL_CONTACT
 #ifndef AFL_INJECT_TESTCASE
@@ -84,6 +118,41 @@ typedef uint64_t u64;
 #endif
 #endif
 
+/* batched test cases are read from a shared ring */
+#ifdef AFL_BATCH
+#ifndef AFL_SHM_TESTCASE
+#define AFL_SHM_TESTCASE 1
+#endif
+#endif
+
+/* partition filtering gates the MMIO or TCG coverage writes */
+#ifdef AFL_CONTROL_CSWITCH
+#if !defined(AFL_TRACE_MMIO) && !defined(AFL_TRACE_TCG)
+#error "AFL_CONTROL_CSWITCH needs AFL_TRACE_MMIO or AFL_TRACE_TCG"
+#endif
+#endif
+
+/* doorbell rewinds the running VM as persistent mode does */
+#ifdef AFL_KVM_DOORBELL
+#ifndef AFL_PERSISTENT
+#define AFL_PERSISTENT 1
+#endif
+#endif
+
+/* persistent mode restores partition from pristine RAM */
+#ifdef AFL_PERSISTENT
+#ifndef AFL_DIRTY_RESTORE
+#define AFL_DIRTY_RESTORE 1
+#endif
+#endif
+
+/* instances share the pristine RAM and device state */
+#ifdef AFL_SHARED_SNAPSHOT
+#ifndef AFL_DIRTY_RESTORE
+#define AFL_DIRTY_RESTORE 1
+#endif
+#endif
+
 #ifdef AFL_DEBUG
 #define AFL_ALTERNATE_STDOUT     1
 #define AFL_ALTERNATE_STDERR     1
@@ -178,6 +247,38 @@ static inline target_ulong afl_get_stack(afl_arch_t *arch)
    return env->regs[R_ESP];
 }
 
+/* CPU context rewound by persistent mode */
+#define AFL_REGS_SIZE   offsetof(CPUX86State, end_reset_fields)
+
+static inline void afl_save_regs(afl_arch_t *arch, void *regs)
+{
+   memcpy(regs, &arch->cpu->env, AFL_REGS_SIZE);
+}
+
+/*
+ * The debug register breakpoints are host objects referenced from the
+ * context: drop those of the test case, and insert those of the saved
+ * dr7 again, as cpu_post_load() does.
+ */
+static inline void afl_load_regs(afl_arch_t *arch, void *regs)
+{
+   CPUX86State *env = &arch->cpu->env;
+   target_ulong dr7;
+
+   cpu_breakpoint_remove_all(CPU(arch->cpu), BP_CPU);
+   cpu_watchpoint_remove_all(CPU(arch->cpu), BP_CPU);
+
+   memcpy(env, regs, AFL_REGS_SIZE);
+   memset(env->cpu_breakpoint, 0, sizeof(env->cpu_breakpoint));
+
+   dr7 = env->dr[7];
+   env->dr[7] = dr7 & ~(DR7_GLOBAL_BP_MASK | DR7_LOCAL_BP_MASK);
+   cpu_x86_update_dr7(env, dr7);
+}
+
+/* mov %eax, (doorbell) */
+#define AFL_DOORBELL_SIZE  5
+
 /*
  * PowerPC specific
  */
@@ -189,6 +290,7 @@ static inline target_ulong afl_get_stack(afl_arch_t *arch)
 
 #include "hw/ppc/ppc.h"
 #include "kvm_ppc.h"
+#include "helper_regs.h"
 
 typedef struct afl_powerpc_board
 {
@@ -216,6 +318,54 @@ static inline target_ulong afl_get_stack(afl_arch_t *arch)
    return env->gpr[1];
 }
 
+/*
+ * CPU context rewound by persistent mode: the registers up to
+ * CPU_COMMON, plus segment, special purpose and vector/FP registers
+ */
+typedef struct afl_ppc_regs
+{
+   uint8_t      head[offsetof(CPUPPCState, tlb_c)];
+   target_ulong sr[32];
+   target_ulong spr[1024];
+   ppc_vsr_t    vsr[64];
+   ppc_vsr_t    vscr_sat;
+   uint32_t     vscr;
+
+} afl_ppc_regs_t;
+
+#define AFL_REGS_SIZE   sizeof(afl_ppc_regs_t)
+
+static inline void afl_save_regs(afl_arch_t *arch, void *regs)
+{
+   CPUPPCState    *env = &arch->cpu->env;
+   afl_ppc_regs_t *r   = regs;
+
+   memcpy(r->head, env, sizeof(r->head));
+   memcpy(r->sr, env->sr, sizeof(r->sr));
+   memcpy(r->spr, env->spr, sizeof(r->spr));
+   memcpy(r->vsr, env->vsr, sizeof(r->vsr));
+   r->vscr_sat = env->vscr_sat;
+   r->vscr     = env->vscr;
+}
+
+/* hflags and mmu_idx derive from the restored msr */
+static inline void afl_load_regs(afl_arch_t *arch, void *regs)
+{
+   CPUPPCState    *env = &arch->cpu->env;
+   afl_ppc_regs_t *r   = regs;
+
+   memcpy(env, r->head, sizeof(r->head));
+   memcpy(env->sr, r->sr, sizeof(r->sr));
+   memcpy(env->spr, r->spr, sizeof(r->spr));
+   memcpy(env->vsr, r->vsr, sizeof(r->vsr));
+   env->vscr_sat = r->vscr_sat;
+   env->vscr     = r->vscr;
+   hreg_compute_hflags(env);
+}
+
+/* lis r11, doorbell@ha ; stw r0, doorbell@l(r11) */
+#define AFL_DOORBELL_SIZE  8
+
 #endif
 
 
@@ -224,6 +374,22 @@ static inline target_ulong afl_get_stack(afl_arch_t *arch)
  * Generic AFL board
  */
 
+/* Per phase cycle counters, cf. query-gustave-stats */
+#ifdef AFL_STATS
+#define afl_stats_start()  cpu_get_host_ticks()
+void    afl_stats_init(void);
+void    afl_stats_end(GustavePhase, int64_t);
+void    afl_stats_resume(void);
+void    afl_stats_stop(void);
+void    afl_stats_iteration(void);
+#else
+static inline int64_t afl_stats_start(void) { return 0; }
+static inline void afl_stats_end(GustavePhase phase, int64_t start) {}
+static inline void afl_stats_resume(void) {}
+static inline void afl_stats_stop(void) {}
+static inline void afl_stats_iteration(void) {}
+#endif
+
 /* waitpid() status format */
 #define create_wait_status(code, signal)        \
    (((int)code)<<8 | (int)(signal & 0x7f))
@@ -233,6 +399,110 @@ static inline target_ulong afl_get_stack(afl_arch_t *arch)
 #define sts_exit(code)   create_wait_status(code, 0)
 #define sts_stopped(sig) create_wait_status(sig, 0x7f)
 
+/* Snapshot shared between instances */
+typedef struct afl_shared_snapshot
+{
+   int     desc_fd;  /* descriptor file, primary only */
+   int     ram_fd;   /* pristine RAM memfd */
+   int     dev_fd;   /* device state memfd */
+   size_t  dev_size;
+   bool    attach;   /* secondary waiting for its first restore */
+
+} afl_shared_t;
+
+/* Forkserver hello options */
+#define AFL_FS_OPT_ENABLED       0x80000001
+#define AFL_FS_OPT_SHDMEM_FUZZ   0x01000000
+
+/* Test case delivered in shared memory (AFL++ layout) */
+typedef struct afl_testcase
+{
+   uint32_t len;
+   uint8_t  data[];
+
+} afl_testcase_t;
+
+/*
+ * Batched test cases shared ring. The fuzzer writes 'count' test
+ * cases, each in a slot of afl_testcase_t layout, following the
+ * status array. Each slot ends with a coverage map of trace_size
+ * bytes (8 bytes aligned). The board writes back one waitpid() status
+ * and the coverage map per test case.
+ */
+typedef struct afl_batch
+{
+   uint32_t count;
+   uint32_t status[];
+
+} afl_batch_t;
+
+/* Table driven code generator */
+#define AFL_GEN_MAX_ARGS 5
+
+typedef struct afl_gen_hole
+{
+   uint16_t out; /* template offset */
+   uint16_t in;  /* syscall input offset */
+   uint16_t len;
+
+} afl_gen_hole_t;
+
+typedef struct afl_gen_syscall
+{
+   uint32_t        id;
+   bool            enabled;
+   uint32_t        nbargs;
+   uint32_t        sizes[AFL_GEN_MAX_ARGS];  /* 0 for scalars */
+   uint32_t        in_off[AFL_GEN_MAX_ARGS]; /* argument input offset */
+   size_t          in_size;                  /* input bytes consumed */
+
+   uint8_t        *tpl;                      /* precompiled code */
+   size_t          tpl_size;
+   afl_gen_hole_t *holes;                    /* filled from input */
+   uint32_t        nholes;
+
+} afl_gen_syscall_t;
+
+typedef struct afl_gen
+{
+   afl_gen_syscall_t *sc;
+   uint32_t           nr;
+
+} afl_gen_t;
+
+/* Crash records, deduplicated by stack hash */
+typedef struct afl_triage
+{
+   GHashTable *seen;    /* stack hashes already recorded */
+   int         excp;    /* intercepted exception, -1 on panic */
+   uint64_t    crashes;
+   uint64_t    unique;
+
+} afl_triage_t;
+
+/* Built-in fuzz loop */
+typedef struct afl_fuzz_entry
+{
+   uint8_t *data;
+   size_t   len;
+
+} afl_fuzz_entry_t;
+
+typedef struct afl_fuzz
+{
+   GArray   *queue;        /* afl_fuzz_entry_t corpus */
+   uint32_t  seeds;        /* initial corpus entries, run as is */
+   uint32_t  cur;          /* queue entry being mutated */
+   uint32_t  rounds;       /* havoc rounds left for 'cur' */
+   GRand    *rand;
+   uint8_t  *virgin;       /* coverage never seen */
+   uint8_t  *virgin_crash; /* coverage never seen by a crash */
+   uint64_t  execs;
+   uint64_t  crashes;
+   uint64_t  hangs;
+
+} afl_fuzz_t;
+
 typedef struct afl_configuration
 {
    /* QEMU / AFL interaction information */
@@ -241,6 +511,17 @@ typedef struct afl_configuration
       int64_t     overhead; /* Estimated overhead for qemu/afl
                              * transitions used to setup timer */
       const char *vms_tpl;  /* vmstate template file path */
+#ifdef AFL_INSN_BUDGET
+      uint64_t    insn_budget; /* Test case instructions before
+                                * timeout, replaces user time out
+                                * (TCG -icount) */
+#endif
+#ifdef AFL_SHARED_SNAPSHOT
+      const char *shared_path; /* shared snapshot descriptor path */
+#endif
+#ifdef AFL_CRASH_TRIAGE
+      const char *crash_dir;   /* crash records directory */
+#endif
    } qemu;
 
    /* AFL internals */
@@ -253,6 +534,31 @@ typedef struct afl_configuration
       const char *trace_env;  /* AFL coverage bitmap shared memory
                                * identifier environment variable
                                * name */
+#ifdef AFL_SHM_TESTCASE
+      const char *testcase_env;  /* AFL test case shared memory
+                                  * identifier environment variable
+                                  * name */
+      size_t      testcase_size; /* Test case max size in bytes */
+#endif
+#ifdef AFL_BATCH
+      uint32_t    batch_count;   /* Max test cases per batch */
+#endif
+#ifdef AFL_STANDALONE
+      const char *fuzz_in;   /* initial corpus directory */
+      const char *fuzz_out;  /* queue/ and crashes/ output directory */
+      uint64_t    fuzz_seed; /* mutation engine random seed */
+#endif
+#ifdef AFL_TRACE_TCG
+      target_ulong tcg_start; /* TCG edge coverage vaddr range */
+      target_ulong tcg_end;
+#endif
+#ifdef AFL_TRACE_CMPLOG
+      const char *cmplog_env;  /* AFL compare log shared memory
+                                * identifier environment variable
+                                * name */
+      target_ulong cmplog_start; /* Compare log kernel vaddr range */
+      target_ulong cmplog_end;
+#endif
    } afl;
 
    /* Virtual Machine (Target) partition information */
@@ -273,6 +579,12 @@ typedef struct afl_configuration
       target_ulong  panic;            /* Target 'kernel panic' vaddr */
       target_ulong  cswitch;          /* Target context switch vaddr */
       target_ulong  cswitch_next;     /* Insn vaddr follwing 'vm_cswitch_next' */
+#ifdef AFL_PERSISTENT
+      uint32_t      persistent_iter;  /* Test cases between full restore */
+#endif
+#ifdef AFL_KVM_DOORBELL
+      target_ulong  doorbell;         /* End of test case MMIO paddr */
+#endif
    } tgt;
 
    /* Runtime operating mode/strategy */
@@ -299,21 +611,56 @@ typedef struct afl_board
    QEMUTimer     *user_timer;
 
    // VM state
+#ifdef AFL_MEMORY_VMSTATE
+   afl_vmb_t      vms;
+#else
    char           vms_path[32];
    int            vms_fd;
+#endif
    MemoryRegion  *ram_mr;
    void          *ram_ptr;
    uint32_t       ram_size;
    target_ulong   vm_exit;
    int            status;
+#ifdef AFL_DIRTY_RESTORE
+   void          *ram_snap; /* pristine RAM copy */
+   afl_vmb_t      dev_vmb;  /* cached device state */
+   size_t         inj_len;  /* injected code length since restore */
+#endif
+#ifdef AFL_PERSISTENT
+   void          *regs_snap; /* CPU registers at fuzzing entry point */
+   uint32_t       persistent_cnt;
+#endif
+#ifdef AFL_SHARED_SNAPSHOT
+   afl_shared_t   shared;
+#endif
+#ifdef AFL_GEN_TABLE
+   afl_gen_t      gen;
+#endif
+#ifdef AFL_KVM_DOORBELL
+   MemoryRegion   doorbell_mr;
+   bool           doorbell;  /* KVM only, TCG keeps the breakpoint */
+#endif
 
    // AFL internals
-   int            shm_id;
    MemoryRegion   trace_mr;
    void          *trace_bits;
-#ifdef AFL_CONTROL_CSWITCH
-   MemoryRegion   fake_mr;
-   void          *fake_bits;
+#ifdef AFL_TRACE_CMPLOG
+   afl_cmp_map_t *cmp_map;
+#endif
+#ifdef AFL_SHM_TESTCASE
+   afl_testcase_t *testcase;
+#endif
+#ifdef AFL_BATCH
+   afl_batch_t   *batch;
+   uint32_t       batch_idx;  /* current test case */
+   uint32_t       batch_cnt;  /* test cases in current batch */
+#endif
+#ifdef AFL_STANDALONE
+   afl_fuzz_t     fuzz;
+#endif
+#ifdef AFL_CRASH_TRIAGE
+   afl_triage_t   triage;
 #endif
    uid_t          euid;
    int            pid, ppid;
@@ -333,18 +680,51 @@ void    afl_init(afl_t*, MachineState*);
 void    afl_init_conf(afl_t*);
 void    afl_init_arch(afl_t*, MachineState*, MemoryRegion*);
 void    afl_init_trace_mem(afl_t *afl);
+void    afl_init_trace_tcg(afl_t *afl);
+void    afl_init_cmplog(afl_t *afl);
+void    afl_init_cswitch(afl_t *afl);
+void    afl_init_triage(afl_t *afl);
+void    afl_triage_crash(afl_t*);
+void    afl_triage_cleanup(afl_t*);
+int     afl_arch_backtrace(afl_t*, target_ulong*, int);
+void    afl_trace_gate(afl_t*, bool);
 
 void    afl_remove_breakpoint(afl_t*, uint32_t);
 void    afl_insert_breakpoint(afl_t*, uint32_t);
 void    afl_vm_state_change(void*, int, RunState);
 void    afl_forward_child(afl_t*);
+size_t  afl_batch_size(afl_t*);
+bool    afl_batch_pending(afl_t*);
+void    afl_batch_start(afl_t*);
+void    afl_batch_status(afl_t*);
+afl_testcase_t* afl_batch_case(afl_t*);
+void    afl_init_engine(afl_t*);
+void    afl_engine_next(afl_t*);
+void    afl_engine_status(afl_t*);
+void    afl_engine_cleanup(afl_t*);
 void    afl_user_timeout_cb(void*);
-void    afl_save_vm(afl_t*, int);
-void    afl_load_vm(afl_t*, int);
+void    afl_save_vm(afl_t*);
+void    afl_load_vm(afl_t*);
+bool    afl_load_vm_running(afl_t*);
+void    afl_init_doorbell(afl_t*);
+size_t  afl_arch_gen_doorbell(afl_t*, uint8_t*);
+void    afl_attach_vm(afl_t*);
+void    afl_dirty_log_start(afl_t*);
+void    afl_init_shared(afl_t*);
+void*   afl_shared_ram_alloc(afl_t*);
+void    afl_shared_publish(afl_t*);
+void    afl_shared_cleanup(afl_t*);
 size_t  afl_inject_test_case(afl_t*);
 void    afl_arch_ram_guard_setup(afl_t*);
+void    afl_ram_guard_tcg(afl_t*, int);
 ssize_t afl_gen_code(uint8_t*, size_t, uint8_t*, size_t);
+void    afl_init_gen(afl_t*, QDict*);
+ssize_t afl_gen_table_code(afl_t*, uint8_t*, size_t, uint8_t*, size_t);
+void    afl_gen_emit(afl_gen_syscall_t*, const void*, size_t);
+void    afl_gen_emit_hole(afl_gen_syscall_t*, size_t, size_t);
+void    afl_arch_gen_template(afl_gen_syscall_t*);
 void    afl_mem_invalidate(MemoryRegion*, hwaddr, hwaddr);
+void    afl_tb_invalidate(afl_t*);
 
 void    afl_trace_checksum(afl_t*, const char*);
 void    afl_trace_count(afl_t*, const char*);
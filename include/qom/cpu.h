@@ -258,6 +258,9 @@ struct kvm_run;
 
 struct hax_vcpu_state;
 
+/* Last executed TB addresses, for AFL crash records */
+#define AFL_TB_RING 64
+
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
@@ -338,6 +341,11 @@ struct qemu_work_item;
  * @ignore_memory_transaction_failures: Cached copy of the MachineState
  *    flag of the same name: allows the board to suppress calling of the
  *    CPU do_transaction_failed hook function.
+ * @afl_trace_off: AFL coverage writes of this vCPU are dropped, cf.
+ *    AFL_CONTROL_CSWITCH partition filtering.
+ * @afl_tb_ring_idx: Last recorded entry of @afl_tb_ring_pc.
+ * @afl_tb_ring_pc: Ring of the last TB addresses executed by this vCPU,
+ *    for AFL crash records. Written by TCG generated code at TB entry.
  *
  * State of one CPU core or thread.
  */
@@ -363,6 +371,7 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    bool afl_trace_off;
     uint32_t cflags_next_tb;
     /* updates protected by BQL */
     uint32_t interrupt_request;
@@ -434,6 +443,9 @@ struct CPUState {
 
     bool ignore_memory_transaction_failures;
 
+    uint32_t afl_tb_ring_idx;
+    uint64_t afl_tb_ring_pc[AFL_TB_RING];
+
     /* Note that this is accessed at the start of every TB via a negative
        offset from AREG0.  Leave this field at the end so as to make the
        (absolute value) offset as small as possible.  This reduces code
@@ -70,6 +70,7 @@
 #endif
 #include "exec/memory.h"
 #include "exec/exec-all.h"
+#include "exec/cputlb.h"
 #include "qemu/log.h"
 #include "qemu/option.h"
 #include "hmp.h"
@@ -1315,6 +1316,17 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
 {
     dump_opcount_info();
 }
+
+static void hmp_info_tlb_stats(Monitor *mon, const QDict *qdict)
+{
+    if (!tcg_enabled()) {
+        monitor_printf(mon, "TLB statistics are only available with "
+                       "accel=tcg\n");
+        return;
+    }
+
+    dump_tlb_stats();
+}
 #endif
 
 static void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
@@ -118,9 +118,16 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,tb-cache=file]\n"
+    "                [,superblock-threshold=n][,translate-threads=n]\n"
+    "                [,pin-globals=on|off][,perfmap=on|off][,jitdump=on|off]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                tb-cache=file (persistent TCG translation cache)\n"
+    "                superblock-threshold=n (retranslate hot TCG blocks as superblocks)\n"
+    "                translate-threads=n (form superblocks in n background threads)\n"
+    "                pin-globals=on|off (keep hot guest registers in host registers)\n"
+    "                perfmap=on|off, jitdump=on|off (export TCG code to perf)\n", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -134,6 +141,36 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item tb-cache=@var{file}
+Save the host code of TCG translations to @var{file}, and reuse it on later
+runs instead of translating guest code which did not change. The file is only
+valid for the same QEMU binary, host and guest CPU configuration, and is reset
+otherwise. Supported on x86_64 Linux hosts.
+@item superblock-threshold=@var{n}
+Count TCG block executions, and retranslate a block executed @var{n} times as
+a superblock following its hot forward jumps and its loop back edge, which
+removes the block exits and lookups along the hot path. Disabled by default,
+or with @var{n}=0. Only effective for
+targets supporting it (i386) and without icount.
+@item translate-threads=@var{n}
+With @option{superblock-threshold}, form superblocks in @var{n} background
+threads (at most 8), while the vCPUs keep running the hot blocks, instead of
+retranslating them on the vCPU thread. Not supported in user mode.
+@item pin-globals=on|off
+Keep a few frequently used guest registers (for i386: ESP, EAX and ECX) in
+callee-saved host registers while execution goes from one TCG block to the
+next, instead of storing and reloading them at each block boundary. They are
+still written back to the CPU state before helper calls and memory accesses,
+and when returning to the main loop. Only effective on 64-bit hosts, and not
+with the TCG interpreter. Off by default.
+@item perfmap=on|off
+Write @file{/tmp/perf-<pid>.map}, naming the host code of each TCG
+translation after its guest pc and symbol, for @command{perf report} and
+@command{perf top}.
+@item jitdump=on|off
+Write @file{/tmp/jit-<pid>.dump}, also holding a copy of the host code, to be
+merged with @command{perf inject --jit} into a @command{perf record -k 1}
+recording, for annotation.
 @end table
 ETEXI
 
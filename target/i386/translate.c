@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -673,8 +674,9 @@ static void gen_op_update3_cc(DisasContext *s, TCGv reg)
     tcg_gen_mov_tl(cpu_cc_dst, s->T0);
 }
 
-static inline void gen_op_testl_T0_T1_cc(DisasContext *s)
+static inline void gen_op_testl_T0_T1_cc(DisasContext *s, TCGMemOp ot)
 {
+    gen_afl_cmplog(s->pc_start, s->T0, s->T1, ot);
     tcg_gen_and_tl(cpu_cc_dst, s->T0, s->T1);
 }
 
@@ -1344,6 +1346,7 @@ static void gen_op(DisasContext *s1, int op, TCGMemOp ot, int d)
                                         s1->mem_index, ot | MO_LE);
             tcg_gen_sub_tl(s1->T0, s1->cc_srcT, s1->T1);
         } else {
+            gen_afl_cmplog(s1->pc_start, s1->T0, s1->T1, ot);
             tcg_gen_mov_tl(s1->cc_srcT, s1->T0);
             tcg_gen_sub_tl(s1->T0, s1->T0, s1->T1);
             gen_op_st_rm_T0_A0(s1, ot, d);
@@ -1386,6 +1389,7 @@ static void gen_op(DisasContext *s1, int op, TCGMemOp ot, int d)
         set_cc_op(s1, CC_OP_LOGICB + ot);
         break;
     case OP_CMPL:
+        gen_afl_cmplog(s1->pc_start, s1->T0, s1->T1, ot);
         tcg_gen_mov_tl(cpu_cc_src, s1->T1);
         tcg_gen_mov_tl(s1->cc_srcT, s1->T0);
         tcg_gen_sub_tl(cpu_cc_dst, s1->T0, s1->T1);
@@ -2225,7 +2229,14 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
 {
     target_ulong pc = s->cs_base + eip;
 
-    if (use_goto_tb(s, pc))  {
+    if (translator_trace_goto(&s->base, pc)) {
+        /* hot path: translation goes on at pc */
+        s->base.is_jmp = DISAS_NORETURN;
+        return;
+    }
+
+    tb_num = translator_goto_tb_slot(&s->base, tb_num);
+    if (tb_num >= 0 && use_goto_tb(s, pc))  {
         /* jump to same page: we can use a direct jump */
         tcg_gen_goto_tb(tb_num);
         gen_jmp_im(s, eip);
@@ -2244,6 +2255,14 @@ static inline void gen_jcc(DisasContext *s, int b,
     TCGLabel *l1, *l2;
 
     if (s->jmp_opt) {
+        /* the hot path of a superblock falls through */
+        if (translator_trace_hot(&s->base, s->cs_base + val)) {
+            target_ulong t = val;
+
+            val = next_eip;
+            next_eip = t;
+            b ^= 1;
+        }
         l1 = gen_new_label();
         gen_jcc1(s, b, l1);
 
@@ -2682,10 +2701,7 @@ static inline void gen_sto_env_A0(DisasContext *s, int offset)
 
 static inline void gen_op_movo(DisasContext *s, int d_offset, int s_offset)
 {
-    tcg_gen_ld_i64(s->tmp1_i64, cpu_env, s_offset + offsetof(ZMMReg, ZMM_Q(0)));
-    tcg_gen_st_i64(s->tmp1_i64, cpu_env, d_offset + offsetof(ZMMReg, ZMM_Q(0)));
-    tcg_gen_ld_i64(s->tmp1_i64, cpu_env, s_offset + offsetof(ZMMReg, ZMM_Q(1)));
-    tcg_gen_st_i64(s->tmp1_i64, cpu_env, d_offset + offsetof(ZMMReg, ZMM_Q(1)));
+    tcg_gen_gvec_mov(MO_64, d_offset, s_offset, 16, 16);
 }
 
 static inline void gen_op_movq(DisasContext *s, int d_offset, int s_offset)
@@ -3036,6 +3052,116 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/*
+ * Integer MMX/SSE operations with a TCG vector equivalent are expanded
+ * inline with gvec, which the backend compiles to host vector insns,
+ * instead of calling their ops_sse.h helper. Return false if @b has
+ * none.
+ */
+static bool gen_sse_gvec(int b, int op1_offset, int op2_offset, int is_xmm)
+{
+    int oprsz = is_xmm ? 16 : 8;
+    int d = op1_offset, a = op1_offset, s = op2_offset;
+
+    switch (b) {
+    case 0xfc: /* paddb */
+    case 0xfd: /* paddw */
+    case 0xfe: /* paddd */
+        tcg_gen_gvec_add(b - 0xfc, d, a, s, oprsz, oprsz);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_gvec_add(MO_64, d, a, s, oprsz, oprsz);
+        break;
+    case 0xf8: /* psubb */
+    case 0xf9: /* psubw */
+    case 0xfa: /* psubd */
+    case 0xfb: /* psubq */
+        tcg_gen_gvec_sub(b - 0xf8, d, a, s, oprsz, oprsz);
+        break;
+    case 0xec: /* paddsb */
+    case 0xed: /* paddsw */
+        tcg_gen_gvec_ssadd(b - 0xec, d, a, s, oprsz, oprsz);
+        break;
+    case 0xdc: /* paddusb */
+    case 0xdd: /* paddusw */
+        tcg_gen_gvec_usadd(b - 0xdc, d, a, s, oprsz, oprsz);
+        break;
+    case 0xe8: /* psubsb */
+    case 0xe9: /* psubsw */
+        tcg_gen_gvec_sssub(b - 0xe8, d, a, s, oprsz, oprsz);
+        break;
+    case 0xd8: /* psubusb */
+    case 0xd9: /* psubusw */
+        tcg_gen_gvec_ussub(b - 0xd8, d, a, s, oprsz, oprsz);
+        break;
+    case 0xda: /* pminub */
+        tcg_gen_gvec_umin(MO_8, d, a, s, oprsz, oprsz);
+        break;
+    case 0xde: /* pmaxub */
+        tcg_gen_gvec_umax(MO_8, d, a, s, oprsz, oprsz);
+        break;
+    case 0xea: /* pminsw */
+        tcg_gen_gvec_smin(MO_16, d, a, s, oprsz, oprsz);
+        break;
+    case 0xee: /* pmaxsw */
+        tcg_gen_gvec_smax(MO_16, d, a, s, oprsz, oprsz);
+        break;
+    case 0xdb: /* pand */
+        tcg_gen_gvec_and(MO_64, d, a, s, oprsz, oprsz);
+        break;
+    case 0xdf: /* pandn */
+        tcg_gen_gvec_andc(MO_64, d, s, a, oprsz, oprsz);
+        break;
+    case 0xeb: /* por */
+        tcg_gen_gvec_or(MO_64, d, a, s, oprsz, oprsz);
+        break;
+    case 0xef: /* pxor */
+        tcg_gen_gvec_xor(MO_64, d, a, s, oprsz, oprsz);
+        break;
+    case 0x74: /* pcmpeqb */
+    case 0x75: /* pcmpeqw */
+    case 0x76: /* pcmpeqd */
+        tcg_gen_gvec_cmp(TCG_COND_EQ, b - 0x74, d, a, s, oprsz, oprsz);
+        break;
+    case 0x64: /* pcmpgtb */
+    case 0x65: /* pcmpgtw */
+    case 0x66: /* pcmpgtd */
+        tcg_gen_gvec_cmp(TCG_COND_GT, b - 0x64, d, a, s, oprsz, oprsz);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* Same for shifts by immediate (0x71-0x73), @op being the modrm reg */
+static bool gen_sse_gvec_shift(int b, int op, int val, int offset, int is_xmm)
+{
+    int oprsz = is_xmm ? 16 : 8;
+    int vece = b == 0x71 ? MO_16 : b == 0x72 ? MO_32 : MO_64;
+    int bits = 8 << vece;
+
+    switch (op) {
+    case 2: /* psrl */
+    case 6: /* psll */
+        if (val >= bits) {
+            tcg_gen_gvec_dup8i(offset, oprsz, oprsz, 0);
+        } else if (op == 2) {
+            tcg_gen_gvec_shri(vece, offset, offset, val, oprsz, oprsz);
+        } else {
+            tcg_gen_gvec_shli(vece, offset, offset, val, oprsz, oprsz);
+        }
+        break;
+    case 4: /* psra */
+        tcg_gen_gvec_sari(vece, offset, offset, MIN(val, bits - 1),
+                          oprsz, oprsz);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -3453,6 +3579,22 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                 goto unknown_op;
             }
             val = x86_ldub_code(env, s);
+            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
+                                       (((modrm >> 3)) & 7)][b1];
+            if (!sse_fn_epp) {
+                goto unknown_op;
+            }
+            if (is_xmm) {
+                rm = (modrm & 7) | REX_B(s);
+                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
+            } else {
+                rm = (modrm & 7);
+                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
+            }
+            if (gen_sse_gvec_shift(b & 0xff, (modrm >> 3) & 7, val,
+                                   op2_offset, is_xmm)) {
+                break;
+            }
             if (is_xmm) {
                 tcg_gen_movi_tl(s->T0, val);
                 tcg_gen_st32_tl(s->T0, cpu_env,
@@ -3470,18 +3612,6 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                                 offsetof(CPUX86State, mmx_t0.MMX_L(1)));
                 op1_offset = offsetof(CPUX86State,mmx_t0);
             }
-            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
-                                       (((modrm >> 3)) & 7)][b1];
-            if (!sse_fn_epp) {
-                goto unknown_op;
-            }
-            if (is_xmm) {
-                rm = (modrm & 7) | REX_B(s);
-                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
-            } else {
-                rm = (modrm & 7);
-                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
-            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -4470,6 +4600,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, s->ptr0, s->ptr1, s->A0);
             break;
         default:
+            if (gen_sse_gvec(b, op1_offset, op2_offset, is_xmm)) {
+                break;
+            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -4804,7 +4937,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         case 0: /* test */
             val = insn_get(env, s, ot);
             tcg_gen_movi_tl(s->T1, val);
-            gen_op_testl_T0_T1_cc(s);
+            gen_op_testl_T0_T1_cc(s, ot);
             set_cc_op(s, CC_OP_LOGICB + ot);
             break;
         case 2: /* not */
@@ -5127,7 +5260,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
 
         gen_ldst_modrm(env, s, modrm, ot, OR_TMP0, 0);
         gen_op_mov_v_reg(s, ot, s->T1, reg);
-        gen_op_testl_T0_T1_cc(s);
+        gen_op_testl_T0_T1_cc(s, ot);
         set_cc_op(s, CC_OP_LOGICB + ot);
         break;
 
@@ -5138,7 +5271,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
 
         gen_op_mov_v_reg(s, ot, s->T0, OR_EAX);
         tcg_gen_movi_tl(s->T1, val);
-        gen_op_testl_T0_T1_cc(s);
+        gen_op_testl_T0_T1_cc(s, ot);
         set_cc_op(s, CC_OP_LOGICB + ot);
         break;
 
@@ -8410,6 +8543,11 @@ void tcg_x86_init(void)
                                          reg_names[i]);
     }
 
+    /* The stack pointer, accumulator and count registers, by use */
+    tcg_global_pin(cpu_regs[R_ESP]);
+    tcg_global_pin(cpu_regs[R_EAX]);
+    tcg_global_pin(cpu_regs[R_ECX]);
+
     for (i = 0; i < 6; ++i) {
         cpu_seg_base[i]
             = tcg_global_mem_new(cpu_env,
@@ -8452,7 +8590,9 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     /* select memory access functions */
     dc->mem_index = 0;
 #ifdef CONFIG_SOFTMMU
-    dc->mem_index = cpu_mmu_index(env, false);
+    /* background translations don't look at the live hflags */
+    dc->mem_index = tb_code_view ? tb_code_view->mmu_idx :
+                    cpu_mmu_index(env, false);
 #endif
     dc->cpuid_features = env->features[FEAT_1_EDX];
     dc->cpuid_ext_features = env->features[FEAT_1_ECX];
@@ -8587,6 +8727,7 @@ static const TranslatorOps i386_tr_ops = {
     .translate_insn     = i386_tr_translate_insn,
     .tb_stop            = i386_tr_tb_stop,
     .disas_log          = i386_tr_disas_log,
+    .superblock         = true,
 };
 
 /* generate intermediate code for basic block 'tb'.  */
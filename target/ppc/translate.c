@@ -665,9 +665,13 @@ static inline void gen_set_Rc0(DisasContext *ctx, TCGv reg)
 static void gen_cmp(DisasContext *ctx)
 {
     if ((ctx->opcode & 0x00200000) && (ctx->insns_flags & PPC_64B)) {
+        gen_afl_cmplog(ctx->base.pc_next - 4, cpu_gpr[rA(ctx->opcode)],
+                       cpu_gpr[rB(ctx->opcode)], MO_64);
         gen_op_cmp(cpu_gpr[rA(ctx->opcode)], cpu_gpr[rB(ctx->opcode)],
                    1, crfD(ctx->opcode));
     } else {
+        gen_afl_cmplog(ctx->base.pc_next - 4, cpu_gpr[rA(ctx->opcode)],
+                       cpu_gpr[rB(ctx->opcode)], MO_32);
         gen_op_cmp32(cpu_gpr[rA(ctx->opcode)], cpu_gpr[rB(ctx->opcode)],
                      1, crfD(ctx->opcode));
     }
@@ -689,9 +693,13 @@ static void gen_cmpi(DisasContext *ctx)
 static void gen_cmpl(DisasContext *ctx)
 {
     if ((ctx->opcode & 0x00200000) && (ctx->insns_flags & PPC_64B)) {
+        gen_afl_cmplog(ctx->base.pc_next - 4, cpu_gpr[rA(ctx->opcode)],
+                       cpu_gpr[rB(ctx->opcode)], MO_64);
         gen_op_cmp(cpu_gpr[rA(ctx->opcode)], cpu_gpr[rB(ctx->opcode)],
                    0, crfD(ctx->opcode));
     } else {
+        gen_afl_cmplog(ctx->base.pc_next - 4, cpu_gpr[rA(ctx->opcode)],
+                       cpu_gpr[rB(ctx->opcode)], MO_32);
         gen_op_cmp32(cpu_gpr[rA(ctx->opcode)], cpu_gpr[rB(ctx->opcode)],
                      0, crfD(ctx->opcode));
     }
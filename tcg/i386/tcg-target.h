@@ -135,6 +135,11 @@ extern bool have_avx2;
 #define TCG_TARGET_HAS_goto_ptr         1
 #define TCG_TARGET_HAS_direct_jump      1
 
+/* Persistent TB cache relies on rip-relative addressing.  */
+#if TCG_TARGET_REG_BITS == 64 && defined(CONFIG_LINUX)
+#define TCG_TARGET_HAS_tb_cache         1
+#endif
+
 #if TCG_TARGET_REG_BITS == 64
 /* Keep target addresses zero-extended in a register.  */
 #define TCG_TARGET_HAS_extrl_i64_i32    (TARGET_LONG_BITS == 32)
@@ -961,9 +961,10 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         return;
     }
 
-    /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
+    /* Try a 7 byte pc-relative lea before the 10 byte movq.
+       Constants can't be told from host addresses when caching TBs.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
-    if (diff == (int32_t)diff) {
+    if (diff == (int32_t)diff && !s->tb_cache) {
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -974,6 +975,19 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     tcg_out64(s, arg);
 }
 
+/* Load an address within the TB being generated.  */
+static void tcg_out_movi_tb(TCGContext *s, TCGReg ret, void *ptr)
+{
+    /* Position independent, for the persistent TB cache.  */
+    if (TCG_TARGET_REG_BITS == 64 && s->tb_cache) {
+        tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
+        tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
+        tcg_out32(s, (uintptr_t)ptr - ((uintptr_t)s->code_ptr + 4));
+        return;
+    }
+    tcg_out_movi(s, TCG_TYPE_PTR, ret, (uintptr_t)ptr);
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -1533,6 +1547,7 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
 
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
+        tcg_tb_cache_reloc(s, TCG_HOST_RELOC_PC32, s->code_ptr, dest);
         tcg_out32(s, disp);
     } else {
         /* rip-relative addressing into the constant pool.
@@ -1541,7 +1556,7 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
            be able to re-use the pool constant for more calls.  */
         tcg_out_opc(s, OPC_GRP5, 0, 0, 0);
         tcg_out8(s, (call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev) << 3 | 5);
-        new_pool_label(s, (uintptr_t)dest, R_386_PC32, s->code_ptr, -4);
+        new_pool_host_ptr(s, dest, R_386_PC32, s->code_ptr, -4);
         tcg_out32(s, 0);
     }
 }
@@ -1766,8 +1781,7 @@ static bool tcg_out_qemu_ld_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
         tcg_out_mov(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[0], TCG_AREG0);
         /* The second argument is already loaded with addrlo.  */
         tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[2], oi);
-        tcg_out_movi(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[3],
-                     (uintptr_t)l->raddr);
+        tcg_out_movi_tb(s, tcg_target_call_iarg_regs[3], l->raddr);
     }
 
     tcg_out_call(s, qemu_ld_helpers[opc & (MO_BSWAP | MO_SIZE)]);
@@ -1866,10 +1880,10 @@ static bool tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
 
         if (ARRAY_SIZE(tcg_target_call_iarg_regs) > 4) {
             retaddr = tcg_target_call_iarg_regs[4];
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_tb(s, retaddr, l->raddr);
         } else {
             retaddr = TCG_REG_RAX;
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_tb(s, retaddr, l->raddr);
             tcg_out_st(s, TCG_TYPE_PTR, retaddr, TCG_REG_ESP,
                        TCG_TARGET_CALL_STACK_OFFSET);
         }
@@ -2203,7 +2217,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         if (a0 == 0) {
             tcg_out_jmp(s, s->code_gen_epilogue);
         } else {
-            tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, a0);
+            tcg_out_movi_tb(s, TCG_REG_EAX, (void *)a0);
             tcg_out_jmp(s, tb_ret_addr);
         }
         break;
@@ -3583,6 +3597,16 @@ static void tcg_out_nop_fill(tcg_insn_unit *p, int count)
     memset(p, 0x90, count);
 }
 
+#if TCG_TARGET_HAS_tb_cache
+/* Host features the generated code depends on.  */
+static uint64_t tcg_target_cache_id(void)
+{
+    return have_cmov | have_movbe << 1 | have_bmi1 << 2 | have_bmi2 << 3
+        | have_lzcnt << 4 | have_popcnt << 5 | have_avx1 << 6
+        | have_avx2 << 7;
+}
+#endif
+
 static void tcg_target_init(TCGContext *s)
 {
 #ifdef CONFIG_CPUID_H
@@ -26,6 +26,7 @@ typedef struct TCGLabelPoolData {
     intptr_t addend;
     int rtype;
     unsigned nlong;
+    bool host_ptr;
     tcg_target_ulong data[];
 } TCGLabelPoolData;
 
@@ -40,6 +41,7 @@ static TCGLabelPoolData *new_pool_alloc(TCGContext *s, int nlong, int rtype,
     n->addend = addend;
     n->rtype = rtype;
     n->nlong = nlong;
+    n->host_ptr = false;
     return n;
 }
 
@@ -73,6 +75,16 @@ static inline void new_pool_label(TCGContext *s, tcg_target_ulong d, int rtype,
     new_pool_insert(s, n);
 }
 
+/* For a host code address, e.g. a far call target.  */
+static inline void new_pool_host_ptr(TCGContext *s, void *d, int rtype,
+                                     tcg_insn_unit *label, intptr_t addend)
+{
+    TCGLabelPoolData *n = new_pool_alloc(s, 1, rtype, label, addend);
+    n->data[0] = (uintptr_t)d;
+    n->host_ptr = true;
+    new_pool_insert(s, n);
+}
+
 /* For v64 or v128, depending on the host.  */
 static inline void new_pool_l2(TCGContext *s, int rtype, tcg_insn_unit *label,
                                intptr_t addend, tcg_target_ulong d0,
@@ -151,6 +163,10 @@ static int tcg_out_pool_finalize(TCGContext *s)
         if (!patch_reloc(p->label, p->rtype, (intptr_t)a - size, p->addend)) {
             return -2;
         }
+        if (p->host_ptr) {
+            tcg_tb_cache_reloc(s, TCG_HOST_RELOC_ABS64, a - size,
+                               (void *)p->data[0]);
+        }
     }
 
     s->code_ptr = a;
@@ -130,12 +130,17 @@ static int tcg_target_const_match(tcg_target_long val, TCGType type,
 #ifdef TCG_TARGET_NEED_LDST_LABELS
 static int tcg_out_ldst_finalize(TCGContext *s);
 #endif
+#ifdef TCG_TARGET_NEED_THREADED_CODE
+static void tcg_out_threaded_entry(TCGContext *s);
+static int tcg_out_threaded_finalize(TCGContext *s, tcg_insn_unit *entry);
+#endif
 
 #define TCG_HIGHWATER 1024
 
 static TCGContext **tcg_ctxs;
 static unsigned int n_tcg_ctxs;
 TCGv_env cpu_env = 0;
+bool tcg_pin_globals;
 
 struct tcg_region_tree {
     QemuMutex lock;
@@ -317,6 +322,131 @@ static void set_jmp_reset_offset(TCGContext *s, int which)
     assert(s->tb_jmp_reset_offset[which] == off);
 }
 
+#if TCG_TARGET_HAS_tb_cache
+/* Host binary text bounds, provided by the linker */
+extern const char __executable_start[], etext[];
+
+/*
+ * Persistent TB cache: record a host address embedded in the code of
+ * the TB being generated. Addresses within the TB are position
+ * independent. The prologue and helpers are rebased on load. Anything
+ * else makes the TB uncacheable.
+ */
+static void tcg_tb_cache_reloc(TCGContext *s, TCGHostRelocKind kind,
+                               void *field, const void *target)
+{
+    const void *tb_start = (void *)s->code_buf -
+        ROUND_UP(sizeof(TranslationBlock), qemu_icache_linesize);
+    TCGHostReloc *r;
+
+    if (!s->tb_cache || s->tb_cache_skip) {
+        return;
+    }
+    if (target >= tb_start &&
+        target < s->code_gen_buffer + s->code_gen_buffer_size) {
+        return;
+    }
+    if (s->nb_host_relocs == TCG_MAX_HOST_RELOCS) {
+        s->tb_cache_skip = true;
+        return;
+    }
+
+    r = &s->host_relocs[s->nb_host_relocs];
+    r->offset = field - (void *)s->code_buf;
+    r->kind = kind;
+
+    if (target >= s->code_gen_prologue && target < s->code_gen_buffer) {
+        r->base = TCG_HOST_RELOC_PROLOGUE;
+        r->addend = target - s->code_gen_prologue;
+    } else if (target >= (void *)__executable_start &&
+               target < (void *)etext) {
+        r->base = TCG_HOST_RELOC_TEXT;
+        r->addend = target - (void *)__executable_start;
+    } else {
+        s->tb_cache_skip = true;
+        return;
+    }
+    s->nb_host_relocs++;
+}
+
+static uint64_t tcg_target_cache_id(void);
+
+/*
+ * Cached code is only valid for the same host code layout: backend
+ * features, TB and prologue placement, binary text.
+ */
+uint64_t tcg_tb_cache_id(TCGContext *s)
+{
+    uint64_t v[] = {
+        tcg_target_cache_id(),
+        sizeof(TranslationBlock),
+        qemu_icache_linesize,
+        s->code_gen_buffer - s->code_gen_prologue,
+        s->code_gen_epilogue - s->code_gen_prologue,
+        etext - __executable_start,
+        tcg_pin_globals,
+    };
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(v); i++) {
+        h = (h ^ v[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Rebase the host addresses of cached code copied at @code.  */
+bool tcg_tb_cache_relocate(TCGContext *s, tcg_insn_unit *code,
+                           const TCGHostReloc *relocs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        const TCGHostReloc *r = &relocs[i];
+        void *field = (void *)code + r->offset;
+        intptr_t target, disp;
+
+        if (r->base == TCG_HOST_RELOC_PROLOGUE) {
+            target = (intptr_t)s->code_gen_prologue + r->addend;
+        } else {
+            target = (intptr_t)__executable_start + r->addend;
+        }
+
+        switch (r->kind) {
+        case TCG_HOST_RELOC_PC32:
+            disp = target - ((intptr_t)field + 4);
+            if (disp != (int32_t)disp) {
+                return false;
+            }
+            tcg_patch32(field, disp);
+            break;
+        case TCG_HOST_RELOC_ABS64:
+            tcg_patch64(field, target);
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+#else
+static inline void tcg_tb_cache_reloc(TCGContext *s, TCGHostRelocKind kind,
+                                      void *field, const void *target)
+{
+}
+
+uint64_t tcg_tb_cache_id(TCGContext *s)
+{
+    g_assert_not_reached();
+}
+
+bool tcg_tb_cache_relocate(TCGContext *s, tcg_insn_unit *code,
+                           const TCGHostReloc *relocs, int n)
+{
+    return false;
+}
+#endif
+
 #include "tcg-target.inc.c"
 
 /* compare a pointer @ptr and a tb_tc @s */
@@ -596,27 +726,31 @@ static size_t tcg_n_regions(void)
  */
 static size_t tcg_n_regions(void)
 {
-    size_t i;
+    size_t i, n_threads;
+
+    /* vCPU threads, and background translation threads */
+    n_threads = qemu_tcg_mttcg_enabled() ? max_cpus : 1;
+    n_threads += tb_bg_threads;
 
-    /* Use a single region if all we have is one vCPU thread */
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
+    /* Use a single region if all we have is one TCG thread */
+    if (n_threads == 1) {
         return 1;
     }
 
-    /* Try to have more regions than max_cpus, with each region being >= 2 MB */
+    /* Try to have more regions than threads, with each region being >= 2 MB */
     for (i = 8; i > 0; i--) {
         size_t regions_per_thread = i;
         size_t region_size;
 
         region_size = tcg_init_ctx.code_gen_buffer_size;
-        region_size /= max_cpus * regions_per_thread;
+        region_size /= n_threads * regions_per_thread;
 
         if (region_size >= 2 * 1024u * 1024) {
-            return max_cpus * regions_per_thread;
+            return n_threads * regions_per_thread;
         }
     }
-    /* If we can't, then just allocate one region per vCPU thread */
-    return max_cpus;
+    /* If we can't, then just allocate one region per thread */
+    return n_threads;
 }
 #endif
 
@@ -631,7 +765,8 @@ static size_t tcg_n_regions(void)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG we use a single region. Each
+ * background translation thread adds one more TCG thread.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
@@ -748,7 +883,7 @@ void tcg_register_thread(void)
 
     /* Claim an entry in tcg_ctxs */
     n = atomic_fetch_inc(&n_tcg_ctxs);
-    g_assert(n < max_cpus);
+    g_assert(n < max_cpus + tb_bg_threads);
     atomic_set(&tcg_ctxs[n], s);
 
     tcg_ctx = s;
@@ -952,13 +1087,14 @@ void tcg_context_init(TCGContext *s)
      * In user-mode we simply share the init context among threads, since we
      * use a single region. See the documentation tcg_region_init() for the
      * reasoning behind this.
-     * In softmmu we will have at most max_cpus TCG threads.
+     * In softmmu we will have at most max_cpus TCG threads, plus background
+     * translation threads, whose number is not known yet.
      */
 #ifdef CONFIG_USER_ONLY
     tcg_ctxs = &tcg_ctx;
     n_tcg_ctxs = 1;
 #else
-    tcg_ctxs = g_new(TCGContext *, max_cpus);
+    tcg_ctxs = g_new(TCGContext *, max_cpus + TCG_MAX_BG_THREADS);
 #endif
 
     tcg_debug_assert(!tcg_regset_test_reg(s->reserved_regs, TCG_AREG0));
@@ -1086,6 +1222,9 @@ void tcg_func_start(TCGContext *s)
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
 
+    s->tb_cache_skip = false;
+    s->nb_host_relocs = 0;
+
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
 #endif
@@ -1198,6 +1337,48 @@ TCGTemp *tcg_global_mem_new_internal(TCGType type, TCGv_ptr base,
     return ts;
 }
 
+/*
+ * With tcg_pin_globals, keep a frequently used global in a callee-saved
+ * host register, from the entry of a TB through the TBs it is chained
+ * to.  Its memory slot is only written before the helper calls and
+ * ops that may read it, and when leaving for cpu_exec; it is reloaded
+ * after helpers that may write it, and when entering from cpu_exec.
+ * Globals must be pinned by the target before translating any code.
+ */
+void tcg_global_pin_internal(TCGTemp *ts)
+{
+#if TCG_TARGET_REG_BITS == 64 && !defined(TCG_TARGET_INTERPRETER)
+    TCGContext *s = tcg_ctx;
+    TCGRegSet free_regs;
+    int i;
+
+    tcg_debug_assert(ts->temp_global);
+    if (!tcg_pin_globals || ts->fixed_reg || ts->indirect_reg) {
+        return;
+    }
+
+    /* Leave the register allocator at least two callee-saved registers */
+    free_regs = tcg_target_available_regs[ts->type]
+        & ~tcg_target_call_clobber_regs & ~s->reserved_regs;
+    if (ctpop64(free_regs) < 3) {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
+        TCGReg reg = tcg_target_reg_alloc_order[i];
+
+        if (tcg_regset_test_reg(free_regs, reg)) {
+            ts->fixed_reg = 1;
+            ts->pinned = 1;
+            ts->reg = reg;
+            tcg_regset_set_reg(s->reserved_regs, reg);
+            tcg_regset_set_reg(s->pinned_regs, reg);
+            return;
+        }
+    }
+#endif
+}
+
 TCGTemp *tcg_temp_new_internal(TCGType type, bool temp_local)
 {
     TCGContext *s = tcg_ctx;
@@ -2444,6 +2625,29 @@ static void la_global_sync(TCGContext *s, int ng)
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced to memory for the branch target,
+   and stay live on the fall through path.  */
+static void la_bb_sync(TCGContext *s, int ng, int nt)
+{
+    int i;
+
+    la_global_sync(s, ng);
+
+    for (i = ng; i < nt; ++i) {
+        if (s->temps[i].temp_local) {
+            int state = s->temps[i].state;
+            s->temps[i].state = state | TS_MEM;
+            if (state != TS_DEAD) {
+                continue;
+            }
+        } else {
+            s->temps[i].state = TS_DEAD;
+        }
+        la_reset_pref(&s->temps[i]);
+    }
+}
+
 /* liveness analysis: sync globals back to memory and kill.  */
 static void la_global_kill(TCGContext *s, int ng)
 {
@@ -2720,6 +2924,8 @@ static void liveness_pass_1(TCGContext *s)
             /* If end of basic block, update.  */
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
+            } else if (def->flags & TCG_OPF_COND_BRANCH) {
+                la_bb_sync(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2832,7 +3038,10 @@ static bool liveness_pass_2(TCGContext *s)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -3223,6 +3432,56 @@ static void temp_save(TCGContext *s, TCGTemp *ts, TCGRegSet allocated_regs)
     tcg_debug_assert(ts->val_type == TEMP_VAL_MEM || ts->fixed_reg);
 }
 
+/* store the pinned globals modified since they were last stored or
+   loaded to their memory slot */
+static void sync_pinned_globals(TCGContext *s)
+{
+    int i, n;
+
+    if (!s->pinned_regs) {
+        return;
+    }
+    for (i = 0, n = s->nb_globals; i < n; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (ts->pinned && !ts->mem_coherent) {
+            tcg_out_st(s, ts->type, ts->reg,
+                       ts->mem_base->reg, ts->mem_offset);
+            ts->mem_coherent = 1;
+        }
+    }
+}
+
+/* load the pinned globals from their memory slot */
+static void load_pinned_globals(TCGContext *s)
+{
+    int i, n;
+
+    if (!s->pinned_regs) {
+        return;
+    }
+    for (i = 0, n = s->nb_globals; i < n; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (ts->pinned) {
+            tcg_out_ld(s, ts->type, ts->reg,
+                       ts->mem_base->reg, ts->mem_offset);
+            ts->mem_coherent = 1;
+        }
+    }
+}
+
+/* pinned globals stay in their register, but code reached from
+   elsewhere may find their memory slot out of date */
+static void dirty_pinned_globals(TCGContext *s)
+{
+    int i, n;
+
+    for (i = 0, n = s->nb_globals; i < n; i++) {
+        if (s->temps[i].pinned) {
+            s->temps[i].mem_coherent = 0;
+        }
+    }
+}
+
 /* save globals to their canonical location and assume they can be
    modified be the following code. 'allocated_regs' is used in case a
    temporary registers needs to be allocated to store a constant. */
@@ -3248,6 +3507,7 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
                          || ts->fixed_reg
                          || ts->mem_coherent);
     }
+    sync_pinned_globals(s);
 }
 
 /* at the end of a basic block, we assume all temporaries are dead and
@@ -3268,6 +3528,29 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     }
 
     save_globals(s, allocated_regs);
+    dirty_pinned_globals(s);
+}
+
+/* at a conditional branch, globals and local temps are in memory for
+   the branch target, and stay in their registers on the fall through
+   path.  The branch target label dirties the pinned globals. */
+static void tcg_reg_alloc_cbranch(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        /* The liveness analysis already ensures that globals and local
+           temps are synced, and that temps are dead.  Keep an
+           tcg_debug_assert for safety. */
+        if (ts->temp_global || ts->temp_local) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->fixed_reg
+                             || ts->mem_coherent);
+        } else {
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
 }
 
 static void tcg_reg_alloc_do_movi(TCGContext *s, TCGTemp *ots,
@@ -3277,6 +3560,7 @@ static void tcg_reg_alloc_do_movi(TCGContext *s, TCGTemp *ots,
     if (ots->fixed_reg) {
         /* For fixed registers, we do not do any constant propagation.  */
         tcg_out_movi(s, ots->type, ots->reg, val);
+        ots->mem_coherent = 0;
         return;
     }
 
@@ -3481,7 +3765,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -3551,8 +3837,11 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
     for(i = 0; i < nb_oargs; i++) {
         ts = arg_temp(op->args[i]);
         reg = new_args[i];
-        if (ts->fixed_reg && ts->reg != reg) {
-            tcg_out_mov(s, ts->type, ts->reg, reg);
+        if (ts->fixed_reg) {
+            if (ts->reg != reg) {
+                tcg_out_mov(s, ts->type, ts->reg, reg);
+            }
+            ts->mem_coherent = 0;
         }
         if (NEED_SYNC_ARG(i)) {
             temp_sync(s, ts, o_allocated_regs, 0, IS_DEAD_ARG(i));
@@ -3665,11 +3954,16 @@ static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
     } else if (flags & TCG_CALL_NO_WRITE_GLOBALS) {
         sync_globals(s, allocated_regs);
     } else {
+        sync_pinned_globals(s);
         save_globals(s, allocated_regs);
     }
 
     tcg_out_call(s, func_addr);
 
+    if (!(flags & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS))) {
+        load_pinned_globals(s);
+    }
+
     /* assign output registers and emit moves if needed */
     for(i = 0; i < nb_oargs; i++) {
         arg = op->args[i];
@@ -3681,6 +3975,7 @@ static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
             if (ts->reg != reg) {
                 tcg_out_mov(s, ts->type, ts->reg, reg);
             }
+            ts->mem_coherent = 0;
         } else {
             if (ts->val_type == TEMP_VAL_REG) {
                 s->reg_to_temp[ts->reg] = NULL;
@@ -3924,6 +4219,15 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
     s->pool_labels = NULL;
 #endif
 
+    /* Entered from cpu_exec, load the pinned globals.  Jumps from other
+       TBs skip the loads, and leave the memory slots out of date.  */
+    load_pinned_globals(s);
+    tb->chain_offset = tcg_current_code_size(s);
+    dirty_pinned_globals(s);
+#ifdef TCG_TARGET_NEED_THREADED_CODE
+    tcg_out_threaded_entry(s);
+#endif
+
     num_insns = -1;
     QTAILQ_FOREACH(op, &s->ops, link) {
         TCGOpcode opc = op->opc;
@@ -3971,6 +4275,12 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
         case INDEX_op_call:
             tcg_reg_alloc_call(s, op);
             break;
+        case INDEX_op_exit_tb:
+        case INDEX_op_goto_ptr:
+            /* Leaving the chain of TBs, store the pinned globals.  */
+            sync_pinned_globals(s);
+            tcg_reg_alloc_op(s, op);
+            break;
         default:
             /* Sanity check that we've not introduced any unhandled opcodes. */
             tcg_debug_assert(tcg_op_supported(opc));
@@ -4014,6 +4324,12 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
     if (!tcg_resolve_relocs(s)) {
         return -2;
     }
+#ifdef TCG_TARGET_NEED_THREADED_CODE
+    i = tcg_out_threaded_finalize(s, s->code_buf + tb->chain_offset);
+    if (i < 0) {
+        return i;
+    }
+#endif
 
     /* flush instruction cache */
     flush_icache_range((uintptr_t)s->code_buf, (uintptr_t)s->code_ptr);
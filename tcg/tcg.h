@@ -198,6 +198,9 @@ typedef uint64_t TCGRegSet;
 #ifndef TCG_TARGET_HAS_v256
 #define TCG_TARGET_HAS_v256             0
 #endif
+#ifndef TCG_TARGET_HAS_tb_cache
+#define TCG_TARGET_HAS_tb_cache         0
+#endif
 
 #ifndef TARGET_INSN_START_EXTRA_WORDS
 # define TARGET_INSN_START_WORDS 1
@@ -271,6 +274,9 @@ typedef struct TCGPool {
 #define TCG_MAX_TEMPS 512
 #define TCG_MAX_INSNS 512
 
+/* Background translation threads, each with its own TCGContext */
+#define TCG_MAX_BG_THREADS 8
+
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
 #define TCG_STATIC_CALL_ARGS_SIZE 128
@@ -582,6 +588,9 @@ typedef struct TCGTemp {
        dead at the end of basic blocks.  */
     unsigned int temp_local:1;
     unsigned int temp_allocated:1;
+    /* If true, the global lives in the fixed register 'reg' across
+       chained TBs, and is synced to its memory slot as needed.  */
+    unsigned int pinned:1;
 
     tcg_target_long val;
     struct TCGTemp *mem_base;
@@ -661,6 +670,29 @@ typedef struct TCGProfile {
     int64_t table_op_count[NB_OPS];
 } TCGProfile;
 
+/*
+ * Host address embedded in generated code, relative to a base which
+ * changes from one run to another.
+ */
+#define TCG_MAX_HOST_RELOCS 128
+
+typedef enum TCGHostRelocKind {
+    TCG_HOST_RELOC_PC32,        /* 32-bit pc-relative displacement */
+    TCG_HOST_RELOC_ABS64,       /* 64-bit absolute address */
+} TCGHostRelocKind;
+
+typedef enum TCGHostRelocBase {
+    TCG_HOST_RELOC_PROLOGUE,    /* code_gen_prologue */
+    TCG_HOST_RELOC_TEXT,        /* host binary text */
+} TCGHostRelocBase;
+
+typedef struct TCGHostReloc {
+    uint32_t offset;            /* patched field, from the TB code */
+    uint16_t kind;
+    uint16_t base;
+    int64_t addend;             /* target, from the base */
+} TCGHostReloc;
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -677,6 +709,7 @@ struct TCGContext {
     uintptr_t *tb_jmp_target_addr; /* tb->jmp_target_arg if !direct_jump */
 
     TCGRegSet reserved_regs;
+    TCGRegSet pinned_regs; /* registers of the pinned globals */
     uint32_t tb_cflags; /* cflags of the current TB */
     intptr_t current_frame_offset;
     intptr_t frame_start;
@@ -723,6 +756,12 @@ struct TCGContext {
 
     TCGLabel *exitreq_label;
 
+    /* Persistent TB cache, cf. accel/tcg/tb-cache.c */
+    bool tb_cache;              /* record host addresses of the TB */
+    bool tb_cache_skip;         /* the TB can't be relocated */
+    int nb_host_relocs;
+    TCGHostReloc host_relocs[TCG_MAX_HOST_RELOCS];
+
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
 
@@ -740,6 +779,7 @@ struct TCGContext {
 extern TCGContext tcg_init_ctx;
 extern __thread TCGContext *tcg_ctx;
 extern TCGv_env cpu_env;
+extern bool tcg_pin_globals;
 
 static inline size_t temp_idx(TCGTemp *ts)
 {
@@ -913,6 +953,9 @@ static inline void *tcg_malloc(int size)
 void tcg_context_init(TCGContext *s);
 void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
+uint64_t tcg_tb_cache_id(TCGContext *s);
+bool tcg_tb_cache_relocate(TCGContext *s, tcg_insn_unit *code,
+                           const TCGHostReloc *relocs, int n);
 void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb);
@@ -921,6 +964,7 @@ void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
 
 TCGTemp *tcg_global_mem_new_internal(TCGType, TCGv_ptr,
                                      intptr_t, const char *);
+void tcg_global_pin_internal(TCGTemp *);
 TCGTemp *tcg_temp_new_internal(TCGType, bool);
 void tcg_temp_free_internal(TCGTemp *);
 TCGv_vec tcg_temp_new_vec(TCGType type);
@@ -953,6 +997,11 @@ static inline TCGv_i32 tcg_global_mem_new_i32(TCGv_ptr reg, intptr_t offset,
     return temp_tcgv_i32(t);
 }
 
+static inline void tcg_global_pin_i32(TCGv_i32 arg)
+{
+    tcg_global_pin_internal(tcgv_i32_temp(arg));
+}
+
 static inline TCGv_i32 tcg_temp_new_i32(void)
 {
     TCGTemp *t = tcg_temp_new_internal(TCG_TYPE_I32, false);
@@ -972,6 +1021,11 @@ static inline TCGv_i64 tcg_global_mem_new_i64(TCGv_ptr reg, intptr_t offset,
     return temp_tcgv_i64(t);
 }
 
+static inline void tcg_global_pin_i64(TCGv_i64 arg)
+{
+    tcg_global_pin_internal(tcgv_i64_temp(arg));
+}
+
 static inline TCGv_i64 tcg_temp_new_i64(void)
 {
     TCGTemp *t = tcg_temp_new_internal(TCG_TYPE_I64, false);
@@ -1054,6 +1108,9 @@ enum {
     TCG_OPF_NOT_PRESENT  = 0x20,
     /* Instruction operands are vectors.  */
     TCG_OPF_VECTOR       = 0x40,
+    /* Instruction is a conditional branch: globals stay live on the
+       fall through path.  */
+    TCG_OPF_COND_BRANCH  = 0x80,
 };
 
 typedef struct TCGOpDef {
@@ -1101,12 +1158,17 @@ TCGv_vec tcg_const_ones_vec(TCGType);
 TCGv_vec tcg_const_zeros_vec_matching(TCGv_vec);
 TCGv_vec tcg_const_ones_vec_matching(TCGv_vec);
 
+/* Host pointers can't be relocated by the persistent TB cache.  */
 #if UINTPTR_MAX == UINT32_MAX
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i32((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
+# define tcg_const_ptr(x)        (tcg_ctx->tb_cache_skip = true, \
+                                  (TCGv_ptr)tcg_const_i32((intptr_t)(x)))
+# define tcg_const_local_ptr(x)  (tcg_ctx->tb_cache_skip = true, \
+                                  (TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
 #else
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i64((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
+# define tcg_const_ptr(x)        (tcg_ctx->tb_cache_skip = true, \
+                                  (TCGv_ptr)tcg_const_i64((intptr_t)(x)))
+# define tcg_const_local_ptr(x)  (tcg_ctx->tb_cache_skip = true, \
+                                  (TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
 #endif
 
 TCGLabel *gen_new_label(void);
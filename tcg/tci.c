@@ -32,6 +32,63 @@
 #include "exec/cpu_ldst.h"
 #include "tcg-op.h"
 
+/*
+ * With CONFIG_TCI_THREADED, each TB is pre-decoded by tci_decode() when
+ * it is generated, and the interpreter runs the decoded form rather
+ * than the bytecode: the address of each handler (GCC labels as
+ * values), followed by operands that need no decoding at run time.
+ * Each handler ends with its own indirect jump to the next one, cf.
+ * tci_next(), so that the host predicts each opcode transition
+ * separately. Configure with --disable-tci-threaded to compare with
+ * the switch on the bytecode.
+ */
+#ifdef CONFIG_TCI_THREADED
+# define tci_case(op)           case op: tci_label_##op
+# define tci_dispatch_op(op)    [op] = &&tci_label_##op
+/* end of handler: jump to the handler of the next op */
+# define tci_next()                                             \
+    do {                                                        \
+        tb_ptr = QEMU_ALIGN_PTR_UP(tb_ptr, sizeof(void *));     \
+        tb_ptr += sizeof(void *);                               \
+        goto *((void **)tb_ptr)[-1];                            \
+    } while (0)
+/* end of handler which moved tb_ptr to a branch target */
+# define tci_jump()             tci_next()
+#else
+# define tci_case(op)           case op
+# define tci_next()             break
+# define tci_jump()             continue
+#endif
+
+#if defined(CONFIG_DEBUG_TCG) && !defined(NDEBUG) && \
+    !defined(CONFIG_TCI_THREADED)
+# define tci_fetch_check()                                      \
+    do {                                                        \
+        op_size = tb_ptr[1];                                    \
+        old_code_ptr = tb_ptr;                                  \
+    } while (0)
+/* all the operands of the op were read */
+# define tci_assert_op_end()    tci_assert(tb_ptr == old_code_ptr + op_size)
+#else
+# define tci_fetch_check()      do { } while (0)
+# define tci_assert_op_end()    do { } while (0)
+#endif
+
+#if defined(GETPC)
+# define tci_fetch_pc()         (tci_tb_ptr = (uintptr_t)tb_ptr)
+#else
+# define tci_fetch_pc()         do { } while (0)
+#endif
+
+/* Read the opcode at tb_ptr, then skip opcode and size entry. */
+#define tci_fetch()                                             \
+    do {                                                        \
+        opc = tb_ptr[0];                                        \
+        tci_fetch_check();                                      \
+        tci_fetch_pc();                                         \
+        tb_ptr += 2;                                            \
+    } while (0)
+
 /* Marker for missing code. */
 #define TODO() \
     do { \
@@ -56,9 +113,22 @@ typedef uint64_t (*helper_function)(tcg_target_ulong, tcg_target_ulong,
                                     tcg_target_ulong, tcg_target_ulong);
 #endif
 
+#ifdef CONFIG_TCI_THREADED
+/* tci_decode() moves constant operands to two extra registers */
+# define TCI_REG_K0     TCG_TARGET_NB_REGS
+# define TCI_REG_K1     (TCG_TARGET_NB_REGS + 1)
+# define TCI_NB_REGS    (TCG_TARGET_NB_REGS + 2)
+/* handlers which load them, after those of the opcodes */
+# define TCI_OP_CONST1  NB_OPS
+# define TCI_OP_CONST2  (NB_OPS + 1)
+# define TCI_NB_HANDLERS (NB_OPS + 2)
+#else
+# define TCI_NB_REGS    TCG_TARGET_NB_REGS
+#endif
+
 static tcg_target_ulong tci_read_reg(const tcg_target_ulong *regs, TCGReg index)
 {
-    tci_assert(index < TCG_TARGET_NB_REGS);
+    tci_assert(index < TCI_NB_REGS);
     return regs[index];
 }
 
@@ -279,6 +349,18 @@ tci_read_ulong(const tcg_target_ulong *regs, uint8_t **tb_ptr)
     return taddr;
 }
 
+#ifdef CONFIG_TCI_THREADED
+/* Constant operands are in TCI_REG_K0/K1, cf. tci_decode(). */
+# define tci_read_ri32          tci_read_r32
+# define tci_read_ri64          tci_read_r64
+
+/* Read the bytecode address of a call, for GETPC(), then the helper. */
+static tcg_target_ulong tci_read_call(uint8_t **tb_ptr)
+{
+    tci_tb_ptr = tci_read_i(tb_ptr);
+    return tci_read_i(tb_ptr);
+}
+#else
 /* Read indexed register or constant (native size) from bytecode. */
 static tcg_target_ulong
 tci_read_ri(const tcg_target_ulong *regs, uint8_t **tb_ptr)
@@ -331,6 +413,9 @@ static uint64_t tci_read_ri64(const tcg_target_ulong *regs, uint8_t **tb_ptr)
 }
 #endif
 
+# define tci_read_call(tb_ptr)  tci_read_ri(regs, tb_ptr)
+#endif
+
 static tcg_target_ulong tci_read_label(uint8_t **tb_ptr)
 {
     tcg_target_ulong label = tci_read_i(tb_ptr);
@@ -338,6 +423,31 @@ static tcg_target_ulong tci_read_label(uint8_t **tb_ptr)
     return label;
 }
 
+#ifdef CONFIG_TCI_THREADED
+/* Decoded form of the TB whose bytecode is at @tb_ptr. */
+static uint8_t *tci_entry(uint8_t *tb_ptr)
+{
+    tci_assert(tb_ptr[0] == INDEX_op_br);
+    tb_ptr += 2;
+    return (uint8_t *)tci_read_label(&tb_ptr);
+}
+
+/*
+ * The operand of a decoded goto_tb is the jump slot in the bytecode,
+ * patched when chaining TBs. A reset slot goes on with the next op.
+ */
+static uint8_t *tci_goto_tb(uint8_t *tb_ptr)
+{
+    int32_t *slot = (int32_t *)tci_read_i(&tb_ptr);
+    int32_t disp = atomic_read(slot);
+
+    if (disp == 0) {
+        return tb_ptr;
+    }
+    return tci_entry((uint8_t *)(slot + 1) + disp);
+}
+#endif
+
 static bool tci_compare32(uint32_t u0, uint32_t u1, TCGCond condition)
 {
     bool result = false;
@@ -423,35 +533,42 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
 }
 
 #ifdef CONFIG_SOFTMMU
+/* Host return address of the access: the end of its bytecode. */
+# ifdef CONFIG_TCI_THREADED
+#  define tci_read_ra()     (ra = tci_read_i(&tb_ptr))
+# else
+#  define tci_read_ra()     (ra = (uintptr_t)tb_ptr)
+# endif
 # define qemu_ld_ub \
-    helper_ret_ldub_mmu(env, taddr, oi, (uintptr_t)tb_ptr)
+    helper_ret_ldub_mmu(env, taddr, oi, ra)
 # define qemu_ld_leuw \
-    helper_le_lduw_mmu(env, taddr, oi, (uintptr_t)tb_ptr)
+    helper_le_lduw_mmu(env, taddr, oi, ra)
 # define qemu_ld_leul \
-    helper_le_ldul_mmu(env, taddr, oi, (uintptr_t)tb_ptr)
+    helper_le_ldul_mmu(env, taddr, oi, ra)
 # define qemu_ld_leq \
-    helper_le_ldq_mmu(env, taddr, oi, (uintptr_t)tb_ptr)
+    helper_le_ldq_mmu(env, taddr, oi, ra)
 # define qemu_ld_beuw \
-    helper_be_lduw_mmu(env, taddr, oi, (uintptr_t)tb_ptr)
+    helper_be_lduw_mmu(env, taddr, oi, ra)
 # define qemu_ld_beul \
-    helper_be_ldul_mmu(env, taddr, oi, (uintptr_t)tb_ptr)
+    helper_be_ldul_mmu(env, taddr, oi, ra)
 # define qemu_ld_beq \
-    helper_be_ldq_mmu(env, taddr, oi, (uintptr_t)tb_ptr)
+    helper_be_ldq_mmu(env, taddr, oi, ra)
 # define qemu_st_b(X) \
-    helper_ret_stb_mmu(env, taddr, X, oi, (uintptr_t)tb_ptr)
+    helper_ret_stb_mmu(env, taddr, X, oi, ra)
 # define qemu_st_lew(X) \
-    helper_le_stw_mmu(env, taddr, X, oi, (uintptr_t)tb_ptr)
+    helper_le_stw_mmu(env, taddr, X, oi, ra)
 # define qemu_st_lel(X) \
-    helper_le_stl_mmu(env, taddr, X, oi, (uintptr_t)tb_ptr)
+    helper_le_stl_mmu(env, taddr, X, oi, ra)
 # define qemu_st_leq(X) \
-    helper_le_stq_mmu(env, taddr, X, oi, (uintptr_t)tb_ptr)
+    helper_le_stq_mmu(env, taddr, X, oi, ra)
 # define qemu_st_bew(X) \
-    helper_be_stw_mmu(env, taddr, X, oi, (uintptr_t)tb_ptr)
+    helper_be_stw_mmu(env, taddr, X, oi, ra)
 # define qemu_st_bel(X) \
-    helper_be_stl_mmu(env, taddr, X, oi, (uintptr_t)tb_ptr)
+    helper_be_stl_mmu(env, taddr, X, oi, ra)
 # define qemu_st_beq(X) \
-    helper_be_stq_mmu(env, taddr, X, oi, (uintptr_t)tb_ptr)
+    helper_be_stq_mmu(env, taddr, X, oi, ra)
 #else
+# define tci_read_ra()   do { } while (0)
 # define qemu_ld_ub      ldub_p(g2h(taddr))
 # define qemu_ld_leuw    lduw_le_p(g2h(taddr))
 # define qemu_ld_leul    (uint32_t)ldl_le_p(g2h(taddr))
@@ -468,23 +585,199 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
 # define qemu_st_beq(X)  stq_be_p(g2h(taddr), X)
 #endif
 
-/* Interpret pseudo code in tb. */
+/*
+ * Interpret pseudo code in tb.
+ *
+ * With CONFIG_TCI_THREADED, @tb_ptr is the bytecode of the TB, which
+ * starts with a branch to its decoded form. A NULL @env returns the
+ * table of handler addresses, indexed by opcode, for tci_decode().
+ */
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
 {
-    tcg_target_ulong regs[TCG_TARGET_NB_REGS];
+    tcg_target_ulong regs[TCI_NB_REGS];
     long tcg_temps[CPU_TEMP_BUF_NLONGS];
     uintptr_t sp_value = (uintptr_t)(tcg_temps + CPU_TEMP_BUF_NLONGS);
     uintptr_t ret = 0;
+#ifdef CONFIG_TCI_THREADED
+    static const void *const tci_dispatch[TCI_NB_HANDLERS] = {
+        [0 ... NB_OPS - 1] = &&tci_unknown,
+        [TCI_OP_CONST1] = &&tci_const1,
+        [TCI_OP_CONST2] = &&tci_const2,
+        tci_dispatch_op(INDEX_op_call),
+        tci_dispatch_op(INDEX_op_br),
+        tci_dispatch_op(INDEX_op_setcond_i32),
+#if TCG_TARGET_REG_BITS == 32
+        tci_dispatch_op(INDEX_op_setcond2_i32),
+#elif TCG_TARGET_REG_BITS == 64
+        tci_dispatch_op(INDEX_op_setcond_i64),
+#endif
+        tci_dispatch_op(INDEX_op_mov_i32),
+        tci_dispatch_op(INDEX_op_movi_i32),
+        tci_dispatch_op(INDEX_op_ld8u_i32),
+        tci_dispatch_op(INDEX_op_ld8s_i32),
+        tci_dispatch_op(INDEX_op_ld16u_i32),
+        tci_dispatch_op(INDEX_op_ld16s_i32),
+        tci_dispatch_op(INDEX_op_ld_i32),
+        tci_dispatch_op(INDEX_op_st8_i32),
+        tci_dispatch_op(INDEX_op_st16_i32),
+        tci_dispatch_op(INDEX_op_st_i32),
+        tci_dispatch_op(INDEX_op_add_i32),
+        tci_dispatch_op(INDEX_op_sub_i32),
+        tci_dispatch_op(INDEX_op_mul_i32),
+#if TCG_TARGET_HAS_div_i32
+        tci_dispatch_op(INDEX_op_div_i32),
+        tci_dispatch_op(INDEX_op_divu_i32),
+        tci_dispatch_op(INDEX_op_rem_i32),
+        tci_dispatch_op(INDEX_op_remu_i32),
+#elif TCG_TARGET_HAS_div2_i32
+        tci_dispatch_op(INDEX_op_div2_i32),
+        tci_dispatch_op(INDEX_op_divu2_i32),
+#endif
+        tci_dispatch_op(INDEX_op_and_i32),
+        tci_dispatch_op(INDEX_op_or_i32),
+        tci_dispatch_op(INDEX_op_xor_i32),
+        tci_dispatch_op(INDEX_op_shl_i32),
+        tci_dispatch_op(INDEX_op_shr_i32),
+        tci_dispatch_op(INDEX_op_sar_i32),
+#if TCG_TARGET_HAS_rot_i32
+        tci_dispatch_op(INDEX_op_rotl_i32),
+        tci_dispatch_op(INDEX_op_rotr_i32),
+#endif
+#if TCG_TARGET_HAS_deposit_i32
+        tci_dispatch_op(INDEX_op_deposit_i32),
+#endif
+        tci_dispatch_op(INDEX_op_brcond_i32),
+#if TCG_TARGET_REG_BITS == 32
+        tci_dispatch_op(INDEX_op_add2_i32),
+        tci_dispatch_op(INDEX_op_sub2_i32),
+        tci_dispatch_op(INDEX_op_brcond2_i32),
+        tci_dispatch_op(INDEX_op_mulu2_i32),
+#endif /* TCG_TARGET_REG_BITS == 32 */
+#if TCG_TARGET_HAS_ext8s_i32
+        tci_dispatch_op(INDEX_op_ext8s_i32),
+#endif
+#if TCG_TARGET_HAS_ext16s_i32
+        tci_dispatch_op(INDEX_op_ext16s_i32),
+#endif
+#if TCG_TARGET_HAS_ext8u_i32
+        tci_dispatch_op(INDEX_op_ext8u_i32),
+#endif
+#if TCG_TARGET_HAS_ext16u_i32
+        tci_dispatch_op(INDEX_op_ext16u_i32),
+#endif
+#if TCG_TARGET_HAS_bswap16_i32
+        tci_dispatch_op(INDEX_op_bswap16_i32),
+#endif
+#if TCG_TARGET_HAS_bswap32_i32
+        tci_dispatch_op(INDEX_op_bswap32_i32),
+#endif
+#if TCG_TARGET_HAS_not_i32
+        tci_dispatch_op(INDEX_op_not_i32),
+#endif
+#if TCG_TARGET_HAS_neg_i32
+        tci_dispatch_op(INDEX_op_neg_i32),
+#endif
+#if TCG_TARGET_REG_BITS == 64
+        tci_dispatch_op(INDEX_op_mov_i64),
+        tci_dispatch_op(INDEX_op_movi_i64),
+        tci_dispatch_op(INDEX_op_ld8u_i64),
+        tci_dispatch_op(INDEX_op_ld8s_i64),
+        tci_dispatch_op(INDEX_op_ld16u_i64),
+        tci_dispatch_op(INDEX_op_ld16s_i64),
+        tci_dispatch_op(INDEX_op_ld32u_i64),
+        tci_dispatch_op(INDEX_op_ld32s_i64),
+        tci_dispatch_op(INDEX_op_ld_i64),
+        tci_dispatch_op(INDEX_op_st8_i64),
+        tci_dispatch_op(INDEX_op_st16_i64),
+        tci_dispatch_op(INDEX_op_st32_i64),
+        tci_dispatch_op(INDEX_op_st_i64),
+        tci_dispatch_op(INDEX_op_add_i64),
+        tci_dispatch_op(INDEX_op_sub_i64),
+        tci_dispatch_op(INDEX_op_mul_i64),
+#if TCG_TARGET_HAS_div_i64
+        tci_dispatch_op(INDEX_op_div_i64),
+        tci_dispatch_op(INDEX_op_divu_i64),
+        tci_dispatch_op(INDEX_op_rem_i64),
+        tci_dispatch_op(INDEX_op_remu_i64),
+#elif TCG_TARGET_HAS_div2_i64
+        tci_dispatch_op(INDEX_op_div2_i64),
+        tci_dispatch_op(INDEX_op_divu2_i64),
+#endif
+        tci_dispatch_op(INDEX_op_and_i64),
+        tci_dispatch_op(INDEX_op_or_i64),
+        tci_dispatch_op(INDEX_op_xor_i64),
+        tci_dispatch_op(INDEX_op_shl_i64),
+        tci_dispatch_op(INDEX_op_shr_i64),
+        tci_dispatch_op(INDEX_op_sar_i64),
+#if TCG_TARGET_HAS_rot_i64
+        tci_dispatch_op(INDEX_op_rotl_i64),
+        tci_dispatch_op(INDEX_op_rotr_i64),
+#endif
+#if TCG_TARGET_HAS_deposit_i64
+        tci_dispatch_op(INDEX_op_deposit_i64),
+#endif
+        tci_dispatch_op(INDEX_op_brcond_i64),
+#if TCG_TARGET_HAS_ext8u_i64
+        tci_dispatch_op(INDEX_op_ext8u_i64),
+#endif
+#if TCG_TARGET_HAS_ext8s_i64
+        tci_dispatch_op(INDEX_op_ext8s_i64),
+#endif
+#if TCG_TARGET_HAS_ext16s_i64
+        tci_dispatch_op(INDEX_op_ext16s_i64),
+#endif
+#if TCG_TARGET_HAS_ext16u_i64
+        tci_dispatch_op(INDEX_op_ext16u_i64),
+#endif
+#if TCG_TARGET_HAS_ext32s_i64
+        tci_dispatch_op(INDEX_op_ext32s_i64),
+#endif
+        tci_dispatch_op(INDEX_op_ext_i32_i64),
+#if TCG_TARGET_HAS_ext32u_i64
+        tci_dispatch_op(INDEX_op_ext32u_i64),
+#endif
+        tci_dispatch_op(INDEX_op_extu_i32_i64),
+#if TCG_TARGET_HAS_bswap16_i64
+        tci_dispatch_op(INDEX_op_bswap16_i64),
+#endif
+#if TCG_TARGET_HAS_bswap32_i64
+        tci_dispatch_op(INDEX_op_bswap32_i64),
+#endif
+#if TCG_TARGET_HAS_bswap64_i64
+        tci_dispatch_op(INDEX_op_bswap64_i64),
+#endif
+#if TCG_TARGET_HAS_not_i64
+        tci_dispatch_op(INDEX_op_not_i64),
+#endif
+#if TCG_TARGET_HAS_neg_i64
+        tci_dispatch_op(INDEX_op_neg_i64),
+#endif
+#endif /* TCG_TARGET_REG_BITS == 64 */
+        tci_dispatch_op(INDEX_op_exit_tb),
+        tci_dispatch_op(INDEX_op_goto_tb),
+        tci_dispatch_op(INDEX_op_qemu_ld_i32),
+        tci_dispatch_op(INDEX_op_qemu_ld_i64),
+        tci_dispatch_op(INDEX_op_qemu_st_i32),
+        tci_dispatch_op(INDEX_op_qemu_st_i64),
+        tci_dispatch_op(INDEX_op_mb),
+    };
+
+    if (!env) {
+        return (uintptr_t)tci_dispatch;
+    }
+    tb_ptr = tci_entry(tb_ptr);
+#endif
 
     regs[TCG_AREG0] = (tcg_target_ulong)env;
     regs[TCG_REG_CALL_STACK] = sp_value;
     tci_assert(tb_ptr);
 
     for (;;) {
-        TCGOpcode opc = tb_ptr[0];
-#if defined(CONFIG_DEBUG_TCG) && !defined(NDEBUG)
-        uint8_t op_size = tb_ptr[1];
-        uint8_t *old_code_ptr = tb_ptr;
+        TCGOpcode opc;
+#if defined(CONFIG_DEBUG_TCG) && !defined(NDEBUG) && \
+    !defined(CONFIG_TCI_THREADED)
+        uint8_t op_size;
+        uint8_t *old_code_ptr;
 #endif
         tcg_target_ulong t0;
         tcg_target_ulong t1;
@@ -500,17 +793,20 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
         uint64_t v64;
 #endif
         TCGMemOpIdx oi;
-
-#if defined(GETPC)
-        tci_tb_ptr = (uintptr_t)tb_ptr;
+#ifdef CONFIG_SOFTMMU
+        uintptr_t ra;
 #endif
 
-        /* Skip opcode and size entry. */
-        tb_ptr += 2;
+#ifdef CONFIG_TCI_THREADED
+        /* tb_ptr is the handler of the first decoded op */
+        tb_ptr += sizeof(void *);
+        goto *((void **)tb_ptr)[-1];
+#endif
+        tci_fetch();
 
         switch (opc) {
-        case INDEX_op_call:
-            t0 = tci_read_ri(regs, &tb_ptr);
+        tci_case(INDEX_op_call):
+            t0 = tci_read_call(&tb_ptr);
 #if TCG_TARGET_REG_BITS == 32
             tmp64 = ((helper_function)t0)(tci_read_reg(regs, TCG_REG_R0),
                                           tci_read_reg(regs, TCG_REG_R1),
@@ -535,194 +831,194 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
                                           tci_read_reg(regs, TCG_REG_R6));
             tci_write_reg(regs, TCG_REG_R0, tmp64);
 #endif
-            break;
-        case INDEX_op_br:
+            tci_next();
+        tci_case(INDEX_op_br):
             label = tci_read_label(&tb_ptr);
-            tci_assert(tb_ptr == old_code_ptr + op_size);
+            tci_assert_op_end();
             tb_ptr = (uint8_t *)label;
-            continue;
-        case INDEX_op_setcond_i32:
+            tci_jump();
+        tci_case(INDEX_op_setcond_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg32(regs, t0, tci_compare32(t1, t2, condition));
-            break;
+            tci_next();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_setcond2_i32:
+        tci_case(INDEX_op_setcond2_i32):
             t0 = *tb_ptr++;
             tmp64 = tci_read_r64(regs, &tb_ptr);
             v64 = tci_read_ri64(regs, &tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg32(regs, t0, tci_compare64(tmp64, v64, condition));
-            break;
+            tci_next();
 #elif TCG_TARGET_REG_BITS == 64
-        case INDEX_op_setcond_i64:
+        tci_case(INDEX_op_setcond_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg64(regs, t0, tci_compare64(t1, t2, condition));
-            break;
+            tci_next();
 #endif
-        case INDEX_op_mov_i32:
+        tci_case(INDEX_op_mov_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1);
-            break;
-        case INDEX_op_movi_i32:
+            tci_next();
+        tci_case(INDEX_op_movi_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_i32(&tb_ptr);
             tci_write_reg32(regs, t0, t1);
-            break;
+            tci_next();
 
             /* Load/store operations (32 bit). */
 
-        case INDEX_op_ld8u_i32:
+        tci_case(INDEX_op_ld8u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg8(regs, t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i32:
-        case INDEX_op_ld16u_i32:
+            tci_next();
+        tci_case(INDEX_op_ld8s_i32):
+        tci_case(INDEX_op_ld16u_i32):
             TODO();
-            break;
-        case INDEX_op_ld16s_i32:
+            tci_next();
+        tci_case(INDEX_op_ld16s_i32):
             TODO();
-            break;
-        case INDEX_op_ld_i32:
+            tci_next();
+        tci_case(INDEX_op_ld_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32(regs, t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i32:
+            tci_next();
+        tci_case(INDEX_op_st8_i32):
             t0 = tci_read_r8(regs, &tb_ptr);
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i32:
+            tci_next();
+        tci_case(INDEX_op_st16_i32):
             t0 = tci_read_r16(regs, &tb_ptr);
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i32:
+            tci_next();
+        tci_case(INDEX_op_st_i32):
             t0 = tci_read_r32(regs, &tb_ptr);
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_assert(t1 != sp_value || (int32_t)t2 < 0);
             *(uint32_t *)(t1 + t2) = t0;
-            break;
+            tci_next();
 
             /* Arithmetic operations (32 bit). */
 
-        case INDEX_op_add_i32:
+        tci_case(INDEX_op_add_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i32:
+            tci_next();
+        tci_case(INDEX_op_sub_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i32:
+            tci_next();
+        tci_case(INDEX_op_mul_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 * t2);
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_div_i32
-        case INDEX_op_div_i32:
+        tci_case(INDEX_op_div_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, (int32_t)t1 / (int32_t)t2);
-            break;
-        case INDEX_op_divu_i32:
+            tci_next();
+        tci_case(INDEX_op_divu_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 / t2);
-            break;
-        case INDEX_op_rem_i32:
+            tci_next();
+        tci_case(INDEX_op_rem_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, (int32_t)t1 % (int32_t)t2);
-            break;
-        case INDEX_op_remu_i32:
+            tci_next();
+        tci_case(INDEX_op_remu_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 % t2);
-            break;
+            tci_next();
 #elif TCG_TARGET_HAS_div2_i32
-        case INDEX_op_div2_i32:
-        case INDEX_op_divu2_i32:
+        tci_case(INDEX_op_div2_i32):
+        tci_case(INDEX_op_divu2_i32):
             TODO();
-            break;
+            tci_next();
 #endif
-        case INDEX_op_and_i32:
+        tci_case(INDEX_op_and_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 & t2);
-            break;
-        case INDEX_op_or_i32:
+            tci_next();
+        tci_case(INDEX_op_or_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i32:
+            tci_next();
+        tci_case(INDEX_op_xor_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 ^ t2);
-            break;
+            tci_next();
 
             /* Shift/rotate operations (32 bit). */
 
-        case INDEX_op_shl_i32:
+        tci_case(INDEX_op_shl_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 << (t2 & 31));
-            break;
-        case INDEX_op_shr_i32:
+            tci_next();
+        tci_case(INDEX_op_shr_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1 >> (t2 & 31));
-            break;
-        case INDEX_op_sar_i32:
+            tci_next();
+        tci_case(INDEX_op_sar_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, ((int32_t)t1 >> (t2 & 31)));
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_rot_i32
-        case INDEX_op_rotl_i32:
+        tci_case(INDEX_op_rotl_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, rol32(t1, t2 & 31));
-            break;
-        case INDEX_op_rotr_i32:
+            tci_next();
+        tci_case(INDEX_op_rotr_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(regs, &tb_ptr);
             t2 = tci_read_ri32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, ror32(t1, t2 & 31));
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_deposit_i32
-        case INDEX_op_deposit_i32:
+        tci_case(INDEX_op_deposit_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             t2 = tci_read_r32(regs, &tb_ptr);
@@ -730,266 +1026,266 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             tmp8 = *tb_ptr++;
             tmp32 = (((1 << tmp8) - 1) << tmp16);
             tci_write_reg32(regs, t0, (t1 & ~tmp32) | ((t2 << tmp16) & tmp32));
-            break;
+            tci_next();
 #endif
-        case INDEX_op_brcond_i32:
+        tci_case(INDEX_op_brcond_i32):
             t0 = tci_read_r32(regs, &tb_ptr);
             t1 = tci_read_ri32(regs, &tb_ptr);
             condition = *tb_ptr++;
             label = tci_read_label(&tb_ptr);
             if (tci_compare32(t0, t1, condition)) {
-                tci_assert(tb_ptr == old_code_ptr + op_size);
+                tci_assert_op_end();
                 tb_ptr = (uint8_t *)label;
-                continue;
+                tci_jump();
             }
-            break;
+            tci_next();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_add2_i32:
+        tci_case(INDEX_op_add2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             tmp64 = tci_read_r64(regs, &tb_ptr);
             tmp64 += tci_read_r64(regs, &tb_ptr);
             tci_write_reg64(regs, t1, t0, tmp64);
-            break;
-        case INDEX_op_sub2_i32:
+            tci_next();
+        tci_case(INDEX_op_sub2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             tmp64 = tci_read_r64(regs, &tb_ptr);
             tmp64 -= tci_read_r64(regs, &tb_ptr);
             tci_write_reg64(regs, t1, t0, tmp64);
-            break;
-        case INDEX_op_brcond2_i32:
+            tci_next();
+        tci_case(INDEX_op_brcond2_i32):
             tmp64 = tci_read_r64(regs, &tb_ptr);
             v64 = tci_read_ri64(regs, &tb_ptr);
             condition = *tb_ptr++;
             label = tci_read_label(&tb_ptr);
             if (tci_compare64(tmp64, v64, condition)) {
-                tci_assert(tb_ptr == old_code_ptr + op_size);
+                tci_assert_op_end();
                 tb_ptr = (uint8_t *)label;
-                continue;
+                tci_jump();
             }
-            break;
-        case INDEX_op_mulu2_i32:
+            tci_next();
+        tci_case(INDEX_op_mulu2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             t2 = tci_read_r32(regs, &tb_ptr);
             tmp64 = tci_read_r32(regs, &tb_ptr);
             tci_write_reg64(regs, t1, t0, t2 * tmp64);
-            break;
+            tci_next();
 #endif /* TCG_TARGET_REG_BITS == 32 */
 #if TCG_TARGET_HAS_ext8s_i32
-        case INDEX_op_ext8s_i32:
+        tci_case(INDEX_op_ext8s_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r8s(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_ext16s_i32
-        case INDEX_op_ext16s_i32:
+        tci_case(INDEX_op_ext16s_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16s(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_ext8u_i32
-        case INDEX_op_ext8u_i32:
+        tci_case(INDEX_op_ext8u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r8(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_ext16u_i32
-        case INDEX_op_ext16u_i32:
+        tci_case(INDEX_op_ext16u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(regs, &tb_ptr);
             tci_write_reg32(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_bswap16_i32
-        case INDEX_op_bswap16_i32:
+        tci_case(INDEX_op_bswap16_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(regs, &tb_ptr);
             tci_write_reg32(regs, t0, bswap16(t1));
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_bswap32_i32
-        case INDEX_op_bswap32_i32:
+        tci_case(INDEX_op_bswap32_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, bswap32(t1));
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_not_i32
-        case INDEX_op_not_i32:
+        tci_case(INDEX_op_not_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, ~t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_neg_i32
-        case INDEX_op_neg_i32:
+        tci_case(INDEX_op_neg_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             tci_write_reg32(regs, t0, -t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_mov_i64:
+        tci_case(INDEX_op_mov_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
-        case INDEX_op_movi_i64:
+            tci_next();
+        tci_case(INDEX_op_movi_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_i64(&tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
+            tci_next();
 
             /* Load/store operations (64 bit). */
 
-        case INDEX_op_ld8u_i64:
+        tci_case(INDEX_op_ld8u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg8(regs, t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i64:
-        case INDEX_op_ld16u_i64:
-        case INDEX_op_ld16s_i64:
+            tci_next();
+        tci_case(INDEX_op_ld8s_i64):
+        tci_case(INDEX_op_ld16u_i64):
+        tci_case(INDEX_op_ld16s_i64):
             TODO();
-            break;
-        case INDEX_op_ld32u_i64:
+            tci_next();
+        tci_case(INDEX_op_ld32u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32(regs, t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld32s_i64:
+            tci_next();
+        tci_case(INDEX_op_ld32s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32s(regs, t0, *(int32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld_i64:
+            tci_next();
+        tci_case(INDEX_op_ld_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg64(regs, t0, *(uint64_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i64:
+            tci_next();
+        tci_case(INDEX_op_st8_i64):
             t0 = tci_read_r8(regs, &tb_ptr);
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i64:
+            tci_next();
+        tci_case(INDEX_op_st16_i64):
             t0 = tci_read_r16(regs, &tb_ptr);
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st32_i64:
+            tci_next();
+        tci_case(INDEX_op_st32_i64):
             t0 = tci_read_r32(regs, &tb_ptr);
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint32_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i64:
+            tci_next();
+        tci_case(INDEX_op_st_i64):
             t0 = tci_read_r64(regs, &tb_ptr);
             t1 = tci_read_r(regs, &tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_assert(t1 != sp_value || (int32_t)t2 < 0);
             *(uint64_t *)(t1 + t2) = t0;
-            break;
+            tci_next();
 
             /* Arithmetic operations (64 bit). */
 
-        case INDEX_op_add_i64:
+        tci_case(INDEX_op_add_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i64:
+            tci_next();
+        tci_case(INDEX_op_sub_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i64:
+            tci_next();
+        tci_case(INDEX_op_mul_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 * t2);
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_div_i64
-        case INDEX_op_div_i64:
-        case INDEX_op_divu_i64:
-        case INDEX_op_rem_i64:
-        case INDEX_op_remu_i64:
+        tci_case(INDEX_op_div_i64):
+        tci_case(INDEX_op_divu_i64):
+        tci_case(INDEX_op_rem_i64):
+        tci_case(INDEX_op_remu_i64):
             TODO();
-            break;
+            tci_next();
 #elif TCG_TARGET_HAS_div2_i64
-        case INDEX_op_div2_i64:
-        case INDEX_op_divu2_i64:
+        tci_case(INDEX_op_div2_i64):
+        tci_case(INDEX_op_divu2_i64):
             TODO();
-            break;
+            tci_next();
 #endif
-        case INDEX_op_and_i64:
+        tci_case(INDEX_op_and_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 & t2);
-            break;
-        case INDEX_op_or_i64:
+            tci_next();
+        tci_case(INDEX_op_or_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i64:
+            tci_next();
+        tci_case(INDEX_op_xor_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 ^ t2);
-            break;
+            tci_next();
 
             /* Shift/rotate operations (64 bit). */
 
-        case INDEX_op_shl_i64:
+        tci_case(INDEX_op_shl_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 << (t2 & 63));
-            break;
-        case INDEX_op_shr_i64:
+            tci_next();
+        tci_case(INDEX_op_shr_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1 >> (t2 & 63));
-            break;
-        case INDEX_op_sar_i64:
+            tci_next();
+        tci_case(INDEX_op_sar_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, ((int64_t)t1 >> (t2 & 63)));
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_rot_i64
-        case INDEX_op_rotl_i64:
+        tci_case(INDEX_op_rotl_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, rol64(t1, t2 & 63));
-            break;
-        case INDEX_op_rotr_i64:
+            tci_next();
+        tci_case(INDEX_op_rotr_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(regs, &tb_ptr);
             t2 = tci_read_ri64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, ror64(t1, t2 & 63));
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_deposit_i64
-        case INDEX_op_deposit_i64:
+        tci_case(INDEX_op_deposit_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(regs, &tb_ptr);
             t2 = tci_read_r64(regs, &tb_ptr);
@@ -997,118 +1293,123 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             tmp8 = *tb_ptr++;
             tmp64 = (((1ULL << tmp8) - 1) << tmp16);
             tci_write_reg64(regs, t0, (t1 & ~tmp64) | ((t2 << tmp16) & tmp64));
-            break;
+            tci_next();
 #endif
-        case INDEX_op_brcond_i64:
+        tci_case(INDEX_op_brcond_i64):
             t0 = tci_read_r64(regs, &tb_ptr);
             t1 = tci_read_ri64(regs, &tb_ptr);
             condition = *tb_ptr++;
             label = tci_read_label(&tb_ptr);
             if (tci_compare64(t0, t1, condition)) {
-                tci_assert(tb_ptr == old_code_ptr + op_size);
+                tci_assert_op_end();
                 tb_ptr = (uint8_t *)label;
-                continue;
+                tci_jump();
             }
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_ext8u_i64
-        case INDEX_op_ext8u_i64:
+        tci_case(INDEX_op_ext8u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r8(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_ext8s_i64
-        case INDEX_op_ext8s_i64:
+        tci_case(INDEX_op_ext8s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r8s(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_ext16s_i64
-        case INDEX_op_ext16s_i64:
+        tci_case(INDEX_op_ext16s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r16s(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_ext16u_i64
-        case INDEX_op_ext16u_i64:
+        tci_case(INDEX_op_ext16u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_ext32s_i64
-        case INDEX_op_ext32s_i64:
+        tci_case(INDEX_op_ext32s_i64):
 #endif
-        case INDEX_op_ext_i32_i64:
+        tci_case(INDEX_op_ext_i32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32s(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_ext32u_i64
-        case INDEX_op_ext32u_i64:
+        tci_case(INDEX_op_ext32u_i64):
 #endif
-        case INDEX_op_extu_i32_i64:
+        tci_case(INDEX_op_extu_i32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             tci_write_reg64(regs, t0, t1);
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_bswap16_i64
-        case INDEX_op_bswap16_i64:
+        tci_case(INDEX_op_bswap16_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(regs, &tb_ptr);
             tci_write_reg64(regs, t0, bswap16(t1));
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_bswap32_i64
-        case INDEX_op_bswap32_i64:
+        tci_case(INDEX_op_bswap32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(regs, &tb_ptr);
             tci_write_reg64(regs, t0, bswap32(t1));
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_bswap64_i64
-        case INDEX_op_bswap64_i64:
+        tci_case(INDEX_op_bswap64_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, bswap64(t1));
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_not_i64
-        case INDEX_op_not_i64:
+        tci_case(INDEX_op_not_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, ~t1);
-            break;
+            tci_next();
 #endif
 #if TCG_TARGET_HAS_neg_i64
-        case INDEX_op_neg_i64:
+        tci_case(INDEX_op_neg_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(regs, &tb_ptr);
             tci_write_reg64(regs, t0, -t1);
-            break;
+            tci_next();
 #endif
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
             /* QEMU specific operations. */
 
-        case INDEX_op_exit_tb:
+        tci_case(INDEX_op_exit_tb):
             ret = *(uint64_t *)tb_ptr;
             goto exit;
             break;
-        case INDEX_op_goto_tb:
+        tci_case(INDEX_op_goto_tb):
+#ifdef CONFIG_TCI_THREADED
+            tb_ptr = tci_goto_tb(tb_ptr);
+#else
             /* Jump address is aligned */
             tb_ptr = QEMU_ALIGN_PTR_UP(tb_ptr, 4);
             t0 = atomic_read((int32_t *)tb_ptr);
             tb_ptr += sizeof(int32_t);
-            tci_assert(tb_ptr == old_code_ptr + op_size);
+            tci_assert_op_end();
             tb_ptr += (int32_t)t0;
-            continue;
-        case INDEX_op_qemu_ld_i32:
+#endif
+            tci_jump();
+        tci_case(INDEX_op_qemu_ld_i32):
             t0 = *tb_ptr++;
             taddr = tci_read_ulong(regs, &tb_ptr);
             oi = tci_read_i(&tb_ptr);
+            tci_read_ra();
             switch (get_memop(oi) & (MO_BSWAP | MO_SSIZE)) {
             case MO_UB:
                 tmp32 = qemu_ld_ub;
@@ -1138,14 +1439,15 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
                 tcg_abort();
             }
             tci_write_reg(regs, t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld_i64:
+            tci_next();
+        tci_case(INDEX_op_qemu_ld_i64):
             t0 = *tb_ptr++;
             if (TCG_TARGET_REG_BITS == 32) {
                 t1 = *tb_ptr++;
             }
             taddr = tci_read_ulong(regs, &tb_ptr);
             oi = tci_read_i(&tb_ptr);
+            tci_read_ra();
             switch (get_memop(oi) & (MO_BSWAP | MO_SSIZE)) {
             case MO_UB:
                 tmp64 = qemu_ld_ub;
@@ -1190,11 +1492,12 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (TCG_TARGET_REG_BITS == 32) {
                 tci_write_reg(regs, t1, tmp64 >> 32);
             }
-            break;
-        case INDEX_op_qemu_st_i32:
+            tci_next();
+        tci_case(INDEX_op_qemu_st_i32):
             t0 = tci_read_r(regs, &tb_ptr);
             taddr = tci_read_ulong(regs, &tb_ptr);
             oi = tci_read_i(&tb_ptr);
+            tci_read_ra();
             switch (get_memop(oi) & (MO_BSWAP | MO_SIZE)) {
             case MO_UB:
                 qemu_st_b(t0);
@@ -1214,11 +1517,12 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             default:
                 tcg_abort();
             }
-            break;
-        case INDEX_op_qemu_st_i64:
+            tci_next();
+        tci_case(INDEX_op_qemu_st_i64):
             tmp64 = tci_read_r64(regs, &tb_ptr);
             taddr = tci_read_ulong(regs, &tb_ptr);
             oi = tci_read_i(&tb_ptr);
+            tci_read_ra();
             switch (get_memop(oi) & (MO_BSWAP | MO_SIZE)) {
             case MO_UB:
                 qemu_st_b(tmp64);
@@ -1244,17 +1548,304 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             default:
                 tcg_abort();
             }
-            break;
-        case INDEX_op_mb:
+            tci_next();
+        tci_case(INDEX_op_mb):
             /* Ensure ordering for all kinds */
             smp_mb();
-            break;
+            tci_next();
+#ifdef CONFIG_TCI_THREADED
+            /* Constant operands of the next op, cf. tci_decode(). */
+        tci_const1:
+            regs[TCI_REG_K0] = tci_read_i(&tb_ptr);
+            tci_next();
+        tci_const2:
+            regs[TCI_REG_K0] = tci_read_i(&tb_ptr);
+            regs[TCI_REG_K1] = tci_read_i(&tb_ptr);
+            tci_next();
+#endif
         default:
+#ifdef CONFIG_TCI_THREADED
+        tci_unknown:
+#endif
             TODO();
             break;
         }
-        tci_assert(tb_ptr == old_code_ptr + op_size);
+        tci_assert_op_end();
     }
 exit:
     return ret;
 }
+
+#ifdef CONFIG_TCI_THREADED
+#if TCG_TARGET_REG_BITS == 64
+# define TCI_R64        "r"
+#else
+# define TCI_R64        "rr"
+#endif
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+# define TCI_ADDR       "rr"
+#else
+# define TCI_ADDR       "r"
+#endif
+
+/*
+ * Operands of the bytecode ops, as written by tcg/tci/tcg-target.inc.c:
+ *   r  register                    b  8 bit immediate
+ *   c  register or 32 bit constant i  32 bit immediate
+ *   C  register or 64 bit constant q  64 bit immediate
+ *   l  label                       n  native immediate
+ * call and goto_tb are decoded apart.
+ */
+static const char *const tci_operands[NB_OPS] = {
+    [INDEX_op_br] = "l",
+    [INDEX_op_setcond_i32] = "rrcb",
+    [INDEX_op_mov_i32] = "rr",
+    [INDEX_op_movi_i32] = "ri",
+    [INDEX_op_ld8u_i32] = "rri",
+    [INDEX_op_ld8s_i32] = "rri",
+    [INDEX_op_ld16u_i32] = "rri",
+    [INDEX_op_ld16s_i32] = "rri",
+    [INDEX_op_ld_i32] = "rri",
+    [INDEX_op_st8_i32] = "rri",
+    [INDEX_op_st16_i32] = "rri",
+    [INDEX_op_st_i32] = "rri",
+    [INDEX_op_add_i32] = "rcc",
+    [INDEX_op_sub_i32] = "rcc",
+    [INDEX_op_mul_i32] = "rcc",
+    [INDEX_op_div_i32] = "rcc",
+    [INDEX_op_divu_i32] = "rcc",
+    [INDEX_op_rem_i32] = "rcc",
+    [INDEX_op_remu_i32] = "rcc",
+    [INDEX_op_and_i32] = "rcc",
+    [INDEX_op_or_i32] = "rcc",
+    [INDEX_op_xor_i32] = "rcc",
+    [INDEX_op_shl_i32] = "rcc",
+    [INDEX_op_shr_i32] = "rcc",
+    [INDEX_op_sar_i32] = "rcc",
+    [INDEX_op_rotl_i32] = "rcc",
+    [INDEX_op_rotr_i32] = "rcc",
+    [INDEX_op_deposit_i32] = "rrrbb",
+    [INDEX_op_brcond_i32] = "rcbl",
+    [INDEX_op_ext8s_i32] = "rr",
+    [INDEX_op_ext16s_i32] = "rr",
+    [INDEX_op_ext8u_i32] = "rr",
+    [INDEX_op_ext16u_i32] = "rr",
+    [INDEX_op_bswap16_i32] = "rr",
+    [INDEX_op_bswap32_i32] = "rr",
+    [INDEX_op_not_i32] = "rr",
+    [INDEX_op_neg_i32] = "rr",
+#if TCG_TARGET_REG_BITS == 32
+    [INDEX_op_setcond2_i32] = "rrrccb",
+    [INDEX_op_add2_i32] = "rrrrrr",
+    [INDEX_op_sub2_i32] = "rrrrrr",
+    [INDEX_op_brcond2_i32] = "rrccbl",
+    [INDEX_op_mulu2_i32] = "rrrr",
+#elif TCG_TARGET_REG_BITS == 64
+    [INDEX_op_setcond_i64] = "rrCb",
+    [INDEX_op_mov_i64] = "rr",
+    [INDEX_op_movi_i64] = "rq",
+    [INDEX_op_ld8u_i64] = "rri",
+    [INDEX_op_ld8s_i64] = "rri",
+    [INDEX_op_ld16u_i64] = "rri",
+    [INDEX_op_ld16s_i64] = "rri",
+    [INDEX_op_ld32u_i64] = "rri",
+    [INDEX_op_ld32s_i64] = "rri",
+    [INDEX_op_ld_i64] = "rri",
+    [INDEX_op_st8_i64] = "rri",
+    [INDEX_op_st16_i64] = "rri",
+    [INDEX_op_st32_i64] = "rri",
+    [INDEX_op_st_i64] = "rri",
+    [INDEX_op_add_i64] = "rCC",
+    [INDEX_op_sub_i64] = "rCC",
+    [INDEX_op_mul_i64] = "rCC",
+    [INDEX_op_and_i64] = "rCC",
+    [INDEX_op_or_i64] = "rCC",
+    [INDEX_op_xor_i64] = "rCC",
+    [INDEX_op_shl_i64] = "rCC",
+    [INDEX_op_shr_i64] = "rCC",
+    [INDEX_op_sar_i64] = "rCC",
+    [INDEX_op_rotl_i64] = "rCC",
+    [INDEX_op_rotr_i64] = "rCC",
+    [INDEX_op_deposit_i64] = "rrrbb",
+    [INDEX_op_brcond_i64] = "rCbl",
+    [INDEX_op_ext8u_i64] = "rr",
+    [INDEX_op_ext8s_i64] = "rr",
+    [INDEX_op_ext16s_i64] = "rr",
+    [INDEX_op_ext16u_i64] = "rr",
+    [INDEX_op_ext32s_i64] = "rr",
+    [INDEX_op_ext32u_i64] = "rr",
+    [INDEX_op_ext_i32_i64] = "rr",
+    [INDEX_op_extu_i32_i64] = "rr",
+    [INDEX_op_bswap16_i64] = "rr",
+    [INDEX_op_bswap32_i64] = "rr",
+    [INDEX_op_bswap64_i64] = "rr",
+    [INDEX_op_not_i64] = "rr",
+    [INDEX_op_neg_i64] = "rr",
+#endif
+    [INDEX_op_exit_tb] = "q",
+    [INDEX_op_qemu_ld_i32] = "r" TCI_ADDR "n",
+    [INDEX_op_qemu_ld_i64] = TCI_R64 TCI_ADDR "n",
+    [INDEX_op_qemu_st_i32] = "r" TCI_ADDR "n",
+    [INDEX_op_qemu_st_i64] = TCI_R64 TCI_ADDR "n",
+    [INDEX_op_mb] = "",
+};
+
+typedef struct TCIDecoder {
+    const void *const *handlers;
+    uint8_t *code;              /* bytecode of the TB */
+    uint8_t *out;               /* decoded form, NULL while sizing it */
+    uint32_t *offset;           /* decoded offset of each bytecode op */
+} TCIDecoder;
+
+static void tci_put(uint8_t **ptr, const void *value, size_t size)
+{
+    memcpy(*ptr, value, size);
+    *ptr += size;
+}
+
+static void tci_put_word(uint8_t **ptr, uintptr_t value)
+{
+    tci_put(ptr, &value, sizeof(value));
+}
+
+/* Decode the bytecode op at @op, to d->out + @pos. Return its size. */
+static size_t tci_decode_op(TCIDecoder *d, uint8_t *op, size_t pos)
+{
+    TCGOpcode opc = op[0];
+    const char *f = tci_operands[opc];
+    tcg_target_ulong k[2], label;
+    uint8_t args[32], *a = args;
+    uint8_t *p = op + 2, *q;
+    size_t size;
+    int i, nk = 0;
+
+    switch (opc) {
+    case INDEX_op_call:
+        /* GETPC() is the bytecode of the call, the helper a constant */
+        tci_assert(*p == TCG_CONST);
+        tci_put_word(&a, (uintptr_t)op);
+        tci_put(&a, p + 1, sizeof(tcg_target_ulong));
+        p += 1 + sizeof(tcg_target_ulong);
+        break;
+    case INDEX_op_goto_tb:
+        p = QEMU_ALIGN_PTR_UP(p, 4);
+        tci_put_word(&a, (uintptr_t)p);
+        p += sizeof(int32_t);
+        break;
+    default:
+        tci_assert(f);
+        for (; *f; f++) {
+            switch (*f) {
+            case 'c':
+            case 'C':
+                if (*p == TCG_CONST) {
+                    tci_assert(nk < ARRAY_SIZE(k));
+                    if (*f == 'c') {
+                        k[nk] = *(uint32_t *)(p + 1);
+                        p += 1 + sizeof(uint32_t);
+                    } else {
+                        k[nk] = *(uint64_t *)(p + 1);
+                        p += 1 + sizeof(uint64_t);
+                    }
+                    *a++ = TCI_REG_K0 + nk++;
+                    break;
+                }
+                /* fall through */
+            case 'r':
+            case 'b':
+                *a++ = *p++;
+                break;
+            case 'i':
+                tci_put(&a, p, sizeof(uint32_t));
+                p += sizeof(uint32_t);
+                break;
+            case 'q':
+                tci_put(&a, p, sizeof(uint64_t));
+                p += sizeof(uint64_t);
+                break;
+            case 'n':
+                tci_put(&a, p, sizeof(tcg_target_ulong));
+                p += sizeof(tcg_target_ulong);
+                break;
+            case 'l':
+                label = *(tcg_target_ulong *)p;
+                p += sizeof(tcg_target_ulong);
+                tci_put_word(&a, d->out ? (uintptr_t)d->out +
+                             d->offset[label - (uintptr_t)d->code] : 0);
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+#ifdef CONFIG_SOFTMMU
+        if (opc == INDEX_op_qemu_ld_i32 || opc == INDEX_op_qemu_ld_i64 ||
+            opc == INDEX_op_qemu_st_i32 || opc == INDEX_op_qemu_st_i64) {
+            /* the host return address, cf. tci_read_ra() */
+            tci_put_word(&a, (uintptr_t)p);
+        }
+#endif
+        break;
+    }
+    tci_assert(p == op + op[1]);
+    tci_assert(a <= args + sizeof(args));
+
+    size = (nk ? 1 + nk : 0) * sizeof(void *) + sizeof(void *) +
+        ROUND_UP(a - args, sizeof(void *));
+    if (d->out) {
+        q = d->out + pos;
+        if (nk) {
+            tci_put_word(&q, (uintptr_t)d->handlers[TCI_OP_CONST1 + nk - 1]);
+            for (i = 0; i < nk; i++) {
+                tci_put_word(&q, k[i]);
+            }
+        }
+        tci_put_word(&q, (uintptr_t)d->handlers[opc]);
+        tci_put(&q, args, a - args);
+        memset(q, 0, d->out + pos + size - q);
+    }
+    return size;
+}
+
+/*
+ * Pre-decode the bytecode of a TB, from @code to @end, into the form
+ * run by tcg_qemu_tb_exec() at @out, a word aligned address: for each
+ * op, the address of its handler followed by its operands. Constant
+ * operands go to TCI_REG_K0/K1 through a tci_const op ahead of it, so
+ * handlers only read registers. Labels are addresses of decoded ops.
+ *
+ * Return the end of the decoded form, or NULL if it would go past
+ * @out_end.
+ */
+uint8_t *tci_decode(uint8_t *code, uint8_t *end, uint8_t *out, void *out_end)
+{
+    static const void *const *handlers;
+    TCIDecoder d = { .code = code };
+    uint8_t *op;
+    size_t pos = 0;
+
+    if (!handlers) {
+        handlers = (const void *const *)tcg_qemu_tb_exec(NULL, NULL);
+    }
+    d.handlers = handlers;
+    d.offset = g_new(uint32_t, end - code + 1);
+
+    /* size the ops first, for the labels branching forward */
+    for (op = code; op < end; op += op[1]) {
+        d.offset[op - code] = pos;
+        pos += tci_decode_op(&d, op, pos);
+    }
+    d.offset[end - code] = pos;
+
+    if (out + pos > (uint8_t *)out_end) {
+        out = NULL;
+    } else {
+        d.out = out;
+        for (op = code, pos = 0; op < end; op += op[1]) {
+            pos += tci_decode_op(&d, op, pos);
+        }
+        out += pos;
+    }
+    g_free(d.offset);
+    return out;
+}
+#endif
@@ -191,6 +191,12 @@ void tci_disas(uint8_t opc);
 
 #define HAVE_TCG_QEMU_TB_EXEC
 
+#ifdef CONFIG_TCI_THREADED
+/* TBs start with a branch to their pre-decoded form, cf. tcg/tci.c */
+#define TCG_TARGET_NEED_THREADED_CODE
+uint8_t *tci_decode(uint8_t *code, uint8_t *end, uint8_t *out, void *out_end);
+#endif
+
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
 }
@@ -553,6 +553,38 @@ static inline void tcg_out_call(TCGContext *s, tcg_insn_unit *arg)
     old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
+#ifdef TCG_TARGET_NEED_THREADED_CODE
+/* Branch to the decoded form of the TB, set by tcg_out_threaded_finalize. */
+static void tcg_out_threaded_entry(TCGContext *s)
+{
+    uint8_t *old_code_ptr = s->code_ptr;
+
+    /* Entered from cpu_exec and from other TBs at the same address */
+    tcg_debug_assert(s->code_ptr == s->code_buf);
+    tcg_out_op_t(s, INDEX_op_br);
+    tcg_out_i(s, 0);
+    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+}
+
+/* Append the decoded form of the bytecode following @entry. */
+static int tcg_out_threaded_finalize(TCGContext *s, tcg_insn_unit *entry)
+{
+    uint8_t *code = QEMU_ALIGN_PTR_UP(s->code_ptr, sizeof(void *));
+    uint8_t *end = tci_decode(entry + entry[1], s->code_ptr, code,
+                              s->code_gen_highwater);
+
+    if (!end) {
+        return -1;
+    }
+    patch_reloc(entry + 2, sizeof(tcg_target_long), (intptr_t)code, 0);
+    /* Logged as data, after the bytecode */
+    memset(s->code_ptr, 0, code - s->code_ptr);
+    s->data_gen_ptr = s->code_ptr;
+    s->code_ptr = end;
+    return 0;
+}
+#endif
+
 static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
                        const int *const_args)
 {
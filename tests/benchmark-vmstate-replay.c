@@ -0,0 +1,174 @@
+/*
+ * QEMU savevm stream replay speed benchmark
+ *
+ * Compare the two ways the AFL board reloads a cached device state
+ * stream:
+ *
+ *  - file: the stream is kept in a temporary file, reopened through
+ *    QIOChannelFile after a seek, as afl_load_vm() does without
+ *    AFL_MEMORY_VMSTATE;
+ *  - buffer: the stream is replayed with afl_vmb_reader(), the code
+ *    used by the board itself (hw/fuzz/vmb.c).
+ *
+ * The stream is a real device state blob, as cached by the board with
+ * qemu_save_device_state(). Save it from the fuzzed VM with:
+ *
+ *   { "execute": "xen-save-devices-state",
+ *     "arguments": { "filename": "/tmp/dev.state", "live": false } }
+ *
+ * and run with VMSTATE_REPLAY_BLOB=/tmp/dev.state. Tests are skipped
+ * otherwise.
+ *
+ * Each load checks the stream header as afl_load_dirty() does, then
+ * reads the rest of the stream. Parsing the device sections needs the
+ * machine and is not included: the figures are the stream access cost
+ * of a load, not board execs/sec.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu-common.h"
+#include "migration/qemu-file-types.h"
+#include "../migration/qemu-file.h"
+#include "../migration/qemu-file-channel.h"
+#include "../migration/savevm.h"
+#include "io/channel-file.h"
+#include "qemu/afl-vmb.h"
+
+#define STREAM_CHUNK  (4 * KiB)
+
+static uint8_t *blob;
+static gsize blob_size;
+
+static bool blob_load(void)
+{
+    const char *path = getenv("VMSTATE_REPLAY_BLOB");
+    GError *err = NULL;
+
+    if (blob) {
+        return true;
+    }
+    if (!path) {
+        g_test_skip("VMSTATE_REPLAY_BLOB not set");
+        return false;
+    }
+    if (!g_file_get_contents(path, (gchar **)&blob, &blob_size, &err)) {
+        g_test_message("%s", err->message);
+        g_error_free(err);
+        g_test_fail();
+        return false;
+    }
+    g_assert(blob_size > 8);
+    return true;
+}
+
+/* header check of afl_load_dirty(), then the sections */
+static void stream_load(QEMUFile *f, uint8_t *chunk)
+{
+    size_t left = blob_size - 8;
+
+    g_assert(qemu_get_be32(f) == QEMU_VM_FILE_MAGIC);
+    g_assert(qemu_get_be32(f) == QEMU_VM_FILE_VERSION);
+
+    while (left) {
+        size_t len = MIN(left, STREAM_CHUNK);
+
+        g_assert(qemu_get_buffer(f, chunk, len) == len);
+        left -= len;
+    }
+}
+
+static void report(const char *name, unsigned long loads)
+{
+    g_print("%s: stream %zu KiB ", name, blob_size / KiB);
+    g_print("done: %lu loads in %.2f secs: ", loads, g_test_timer_last());
+    g_print("%.2f loads/sec\n", loads / g_test_timer_last());
+}
+
+static void test_replay_file(void)
+{
+    char path[] = "/tmp/qemu-vmstate-replay.XXXXXX";
+    unsigned long loads = 0;
+    uint8_t *chunk;
+    QIOChannel *ioc;
+    QEMUFile *f;
+    int fd;
+
+    if (!blob_load()) {
+        return;
+    }
+
+    fd = mkstemp(path);
+    g_assert(fd >= 0);
+    g_assert(write(fd, blob, blob_size) == (ssize_t)blob_size);
+
+    chunk = g_new(uint8_t, STREAM_CHUNK);
+
+    g_test_timer_start();
+    do {
+        int lfd = dup(fd);
+
+        lseek(lfd, 0, SEEK_SET);
+        ioc = QIO_CHANNEL(qio_channel_file_new_fd(lfd));
+        f = qemu_fopen_channel_input(ioc);
+        object_unref(OBJECT(ioc));
+
+        stream_load(f, chunk);
+        qemu_fclose(f);
+        loads++;
+    } while (g_test_timer_elapsed() < 5.0);
+
+    report("file", loads);
+
+    close(fd);
+    unlink(path);
+    g_free(chunk);
+}
+
+static void test_replay_buffer(void)
+{
+    unsigned long loads = 0;
+    afl_vmb_t vmb;
+    uint8_t *chunk;
+    QEMUFile *f;
+
+    if (!blob_load()) {
+        return;
+    }
+
+    afl_vmb_init(&vmb, 0);
+    f = afl_vmb_writer(&vmb, blob_size);
+    qemu_put_buffer(f, blob, blob_size);
+    qemu_fflush(f);
+    g_assert(vmb.bioc->usage == blob_size);
+
+    chunk = g_new(uint8_t, STREAM_CHUNK);
+
+    g_test_timer_start();
+    do {
+        stream_load(afl_vmb_reader(&vmb), chunk);
+        loads++;
+    } while (g_test_timer_elapsed() < 5.0);
+
+    report("buffer", loads);
+
+    afl_vmb_cleanup(&vmb);
+    g_free(chunk);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/vmstate/replay/file", test_replay_file);
+    g_test_add_func("/vmstate/replay/buffer", test_replay_buffer);
+
+    ret = g_test_run();
+    g_free(blob);
+    return ret;
+}
@@ -0,0 +1,70 @@
+/*
+ * Interpreter dispatch micro-benchmark
+ *
+ * Runs a loop of short integer, memory and branch operations, the
+ * kind of code where TCG execution time is dominated by the dispatch
+ * of TCG ops rather than by helpers, and reports its speed. Compare
+ * the figures of QEMU built with --enable-tcg-interpreter, with and
+ * without --disable-tci-threaded.
+ *
+ * It is built with the other tests but only run with
+ * "make check-tcg SPEED=slow", which leaves the figures in
+ * tci-bench.out. It can also be run by hand:
+ *
+ *   qemu-<arch> tci-bench [iterations]
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+/* guest instructions per iteration, roughly, on most targets */
+#define OPS_PER_ITER  24
+
+static uint32_t table[256];
+
+static uint32_t bench(unsigned long iters)
+{
+    uint32_t h = 0x811c9dc5, x = 1;
+    unsigned long i;
+
+    for (i = 0; i < iters; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (x & 1) {
+            h += table[x & 0xff];
+        } else {
+            h ^= x;
+        }
+        table[h & 0xff] = h * 0x01000193;
+    }
+    return h;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iters = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+    double start, secs;
+    uint32_t h;
+
+    start = now();
+    h = bench(iters);
+    secs = now() - start;
+
+    printf("%lu iterations in %.3f s, %.1f M iter/s, ~%.1f M insn/s "
+           "(hash %08x)\n", iters, secs, iters / secs / 1e6,
+           iters * (double)OPS_PER_ITER / secs / 1e6, h);
+    return 0;
+}
@@ -316,6 +316,36 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "tb-cache",
+            .type = QEMU_OPT_STRING,
+            .help = "Persistent TCG translation cache file",
+        },
+        {
+            .name = "superblock-threshold",
+            .type = QEMU_OPT_NUMBER,
+            .help = "TB executions before forming a superblock (0: off)",
+        },
+        {
+            .name = "translate-threads",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Threads forming superblocks in the background",
+        },
+        {
+            .name = "pin-globals",
+            .type = QEMU_OPT_BOOL,
+            .help = "Keep hot guest registers in host registers across TBs",
+        },
+        {
+            .name = "perfmap",
+            .type = QEMU_OPT_BOOL,
+            .help = "Write /tmp/perf-<pid>.map for perf",
+        },
+        {
+            .name = "jitdump",
+            .type = QEMU_OPT_BOOL,
+            .help = "Write /tmp/jit-<pid>.dump for perf",
+        },
         { /* end of list */ }
     },
 };